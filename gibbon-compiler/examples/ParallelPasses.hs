@@ -0,0 +1,27 @@
+module ParallelPasses where
+
+-- Compiled with --parallel-passes, see test-gibbon-examples.yaml. The
+-- output has to be the same as with the sequential pipeline.
+
+data Tree = Leaf Int
+          | Node Tree Tree
+
+mkTree :: Int -> Tree
+mkTree n =
+  if n == 0
+  then Leaf 1
+  else Node (mkTree (n - 1)) (mkTree (n - 1))
+
+add1Tree :: Tree -> Tree
+add1Tree tr =
+  case tr of
+    Leaf x   -> Leaf (x + 1)
+    Node l r -> Node (add1Tree l) (add1Tree r)
+
+sumTree :: Tree -> Int
+sumTree tr =
+  case tr of
+    Leaf x   -> x
+    Node l r -> (sumTree l) + (sumTree r)
+
+gibbon_main = sumTree (add1Tree (mkTree 10))
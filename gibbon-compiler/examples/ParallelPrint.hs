@@ -0,0 +1,19 @@
+module ParallelPrint where
+
+-- Compiled with --parallel, see test-gibbon-examples.yaml. The numbers are
+-- printed by spawned calls, and have to come out in the same order as in a
+-- sequential run.
+
+printRange :: Int -> Int -> Int
+printRange lo hi =
+  if (hi - lo) <= 1
+  then let _ = printint lo
+           _ = printsym (quote "\n")
+       in 1
+  else let mid = div (lo + hi) 2
+           x = spawn (printRange lo mid)
+           y = printRange mid hi
+           _ = sync
+       in x + y
+
+gibbon_main = printRange 0 64
@@ -0,0 +1,42 @@
+module PointerAlloc where
+
+-- Run in pointer mode, see test-gibbon-examples.yaml. The nodes of the tree
+-- come from the slab allocator, a Big is too large for a size class and is
+-- malloc'd, and the set is allocated by the RTS.
+
+data Tree = Leaf Int
+          | Node Tree Int Tree
+
+data Big = Big Int Int Int Int Int Int Int Int Int Int Int Int Int Int Int Int
+    Int Int Int Int Int Int Int Int Int Int Int Int Int Int Int Int Int Int
+
+mkTree :: Int -> Tree
+mkTree d =
+  if d == 0
+  then Leaf 1
+  else Node (mkTree (d - 1)) d (mkTree (d - 1))
+
+sumTree :: Tree -> Int
+sumTree tr =
+  case tr of
+    Leaf n     -> n
+    Node l k r -> (sumTree l) + k + (sumTree r)
+
+mkBig :: Int -> Big
+mkBig i = Big i i i i i i i i i i i i i i i i i i i i i i i i i i i i i i i i i i
+
+sumBig :: Big -> Int
+sumBig b =
+  case b of
+    Big x0 x1 x2 x3 x4 x5 x6 x7 x8 x9 x10 x11 x12 x13 x14 x15 x16 x17 x18 x19
+        x20 x21 x22 x23 x24 x25 x26 x27 x28 x29 x30 x31 x32 x33 ->
+      x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7 + x8 + x9 + x10 + x11 + x12 + x13
+      + x14 + x15 + x16 + x17 + x18 + x19 + x20 + x21 + x22 + x23 + x24 + x25
+      + x26 + x27 + x28 + x29 + x30 + x31 + x32 + x33
+
+gibbon_main =
+  let s = insert_set (insert_set empty_set (quote "a")) (quote "b")
+      n = (sumTree (mkTree 16)) + (sumBig (mkBig 1))
+  in if contains_set s (quote "b")
+     then n + 1
+     else n
@@ -0,0 +1,19 @@
+module RandRange where
+
+-- The generator depends on --seed and on the number of workers, so don't
+-- check particular numbers, only that they stay in range.
+inRange :: Int -> Bool
+inRange n =
+  if n == 0
+  then True
+  else let i = rand
+           f = frand
+       in if i < 0
+          then False
+          else if f .<. 0.0
+               then False
+               else if f .>=. 1.0
+                    then False
+                    else inRange (n - 1)
+
+gibbon_main = inRange 100000
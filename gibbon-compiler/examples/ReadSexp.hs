@@ -0,0 +1,28 @@
+module ReadSexp where
+
+-- Packs examples/ReadSexp.sexp as it's read, writes it out to a packed file
+-- and reads that back. sumR and sumL weigh the subtrees differently, so the
+-- fields have to end up in the right places.
+
+data Tree = Leaf Int
+          | Node Int Tree Tree
+
+sumR :: Tree -> Int
+sumR tr =
+  case tr of
+    Leaf x     -> x
+    Node k l r -> (sumR r) + k + (2 * (sumR l))
+
+sumL :: Tree -> Int
+sumL tr =
+  case tr of
+    Leaf x     -> x
+    Node k l r -> (sumL l) + k + (2 * (sumL r))
+
+gibbon_main =
+  let tr = readPackedFile @Tree (Just "examples/ReadSexp.sexp")
+      n = (sumR tr) + (sumL tr)
+      _ = writePackedFile "examples/build_tmp/ReadSexp.gpkd" tr
+      tr2 = readPackedFile @Tree (Just "examples/build_tmp/ReadSexp.gpkd")
+      m = (sumR tr2) + (sumL tr2)
+  in if n == m then n else 0 - 1
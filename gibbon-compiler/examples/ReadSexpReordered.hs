@@ -0,0 +1,29 @@
+module ReadSexpReordered where
+
+-- Like ReadSexp, but compiled with --layout-profile
+-- examples/ReadSexpReordered.layout, see test-gibbon-examples.yaml. The
+-- fields of Node are reordered to (k, r, l), and the S-expression still has
+-- them in source order.
+
+data Tree = Leaf Int
+          | Node Int Tree Tree
+
+sumR :: Tree -> Int
+sumR tr =
+  case tr of
+    Leaf x     -> x
+    Node k l r -> (sumR r) + k + (2 * (sumR l))
+
+sumL :: Tree -> Int
+sumL tr =
+  case tr of
+    Leaf x     -> x
+    Node k l r -> (sumL l) + k + (2 * (sumL r))
+
+gibbon_main =
+  let tr = readPackedFile @Tree (Just "examples/ReadSexp.sexp")
+      n = (sumR tr) + (sumL tr)
+      _ = writePackedFile "examples/build_tmp/ReadSexpReordered.gpkd" tr
+      tr2 = readPackedFile @Tree (Just "examples/build_tmp/ReadSexpReordered.gpkd")
+      m = (sumR tr2) + (sumL tr2)
+  in if n == m then n else 0 - 1
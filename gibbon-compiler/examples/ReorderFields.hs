@@ -0,0 +1,31 @@
+module ReorderFields where
+
+-- Compiled with --layout-profile examples/ReorderFields.layout, see
+-- test-gibbon-examples.yaml. sumR runs most often and reads the right
+-- subtree first, so the fields of Node are reordered to (k, r, l). The
+-- output has to be the same as with the source order.
+
+data Tree = Leaf Int
+          | Node Tree Int Tree
+
+mkTree :: Int -> Tree
+mkTree n =
+  if n == 0
+  then Leaf 1
+  else Node (mkTree (n - 1)) n (Leaf n)
+
+sumR :: Tree -> Int
+sumR tr =
+  case tr of
+    Leaf x     -> x
+    Node l k r -> (sumR r) + k + (2 * (sumR l))
+
+sumL :: Tree -> Int
+sumL tr =
+  case tr of
+    Leaf x     -> x
+    Node l k r -> (sumL l) + k + (2 * (sumL r))
+
+gibbon_main =
+  let tr = mkTree 5
+  in (sumR tr) + (sumL tr)
@@ -0,0 +1,30 @@
+module SoAGenGc where
+
+-- Compiled with --SoA and --gen-gc, see test-gibbon-examples.yaml. The
+-- generational collector can't evacuate factored values, so the compiler
+-- rejects the combination; the answer file is only there so that a
+-- successful run shows up as an unexpected pass.
+
+data Point = Point Int Int
+
+data PList = PNil
+           | PCons Point PList
+
+mkList :: Int -> PList
+mkList n =
+  if n == 0
+  then PNil
+  else PCons (Point n (n * 2)) (mkList (n - 1))
+
+sumList :: PList -> Int
+sumList ls =
+  case ls of
+    PNil        -> 0
+    PCons p rst ->
+      case p of
+        Point x y -> x + y + (sumList rst)
+
+gibbon_main = sumList (mkList 10)
+
+main :: IO ()
+main = print gibbon_main
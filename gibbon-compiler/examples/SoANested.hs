@@ -0,0 +1,38 @@
+module SoANested where
+
+-- Run with --SoA, see test-gibbon-examples.yaml. Point is a packed type with
+-- fields of its own, so the field regions of a PList are themselves factored.
+-- shift returns a PList, so the regions it writes to are threaded through a
+-- call, and main binds its regions in a letregion.
+
+data Point = Point Int Int
+
+data PList = PNil
+           | PCons Point PList
+
+mkList :: Int -> PList
+mkList n =
+  if n == 0
+  then PNil
+  else PCons (Point n (n * 2)) (mkList (n - 1))
+
+shift :: PList -> PList
+shift ls =
+  case ls of
+    PNil        -> PNil
+    PCons p rst ->
+      case p of
+        Point x y -> PCons (Point (x + 1) y) (shift rst)
+
+sumList :: PList -> Int
+sumList ls =
+  case ls of
+    PNil        -> 0
+    PCons p rst ->
+      case p of
+        Point x y -> x + y + (sumList rst)
+
+gibbon_main = sumList (shift (mkList 100))
+
+main :: IO ()
+main = print gibbon_main
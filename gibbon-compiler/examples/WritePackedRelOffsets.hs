@@ -0,0 +1,33 @@
+module WritePackedRelOffsets where
+
+-- Compiled with --reloffsets, see test-gibbon-examples.yaml. rightmost skips
+-- the left subtree, so Node gets relative random access nodes. The tree is
+-- larger than the buffer of the packed file writer, and its offsets have to
+-- be right after it's been written out and read back.
+
+data Tree = Leaf Int
+          | Node Tree Tree
+
+mkTree :: Int -> Int -> Tree
+mkTree d n =
+  if d == 0
+  then Leaf n
+  else Node (mkTree (d - 1) (2 * n)) (mkTree (d - 1) ((2 * n) + 1))
+
+sumTree :: Tree -> Int
+sumTree tr =
+  case tr of
+    Leaf n   -> n
+    Node l r -> (sumTree l) + (sumTree r)
+
+rightmost :: Tree -> Int
+rightmost tr =
+  case tr of
+    Leaf n   -> n
+    Node l r -> rightmost r
+
+gibbon_main =
+  let tr = mkTree 18 1
+      _ = writePackedFile "examples/build_tmp/WritePackedRelOffsets.gpkd" tr
+      tr2 = readPackedFile @Tree (Just "examples/build_tmp/WritePackedRelOffsets.gpkd")
+  in (rightmost tr2) + (sumTree tr2)
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Compare the layout benchmarks that skip over fields (and hence follow random
+# access nodes) with and without --prefetch, over a range of prefetch distances.
+
+set -eo pipefail
+
+BENCHMARKS=(calcAdtLengthCa processAdtContentCA processAdtTagsCta processAdtTagsCat)
+DISTANCES=(0 64 128 256)
+ITERS=9
+
+for bench in ${BENCHMARKS[@]}; do
+    gibbon --packed --to-exe "$bench.hs" -o "$bench.base.exe"
+    echo "$bench: baseline"
+    "./$bench.base.exe" --iterate "$ITERS"
+
+    for dist in ${DISTANCES[@]}; do
+        gibbon --packed --prefetch --optc="-std=gnu11 -O3 -DGIB_PREFETCH_DISTANCE=$dist" \
+               --to-exe "$bench.hs" -o "$bench.prefetch$dist.exe"
+        echo "$bench: --prefetch, distance $dist"
+        "./$bench.prefetch$dist.exe" --iterate "$ITERS"
+    done
+done
@@ -20,7 +20,7 @@ module Gibbon.Common
        , SyM, gensym, gensym_tag, genLetter, newUniq, runSyM
 
          -- * PassM monad
-       , PassM, runPassM, defaultRunPassM, defaultPackedRunPassM
+       , PassM, runPassM, defaultRunPassM, defaultPackedRunPassM, parMapM
        , getDynFlags
 
          -- * Gibbon configuration
@@ -47,6 +47,7 @@ where
 
 import Control.DeepSeq (NFData(..), force)
 import Control.Exception (evaluate)
+import GHC.Conc (par, pseq)
 #if !MIN_VERSION_base(4,13,0)
 -- https://downloads.haskell.org/ghc/8.8.1/docs/html/users_guide/8.8.1-notes.html
 import Control.Monad.Fail(MonadFail(..))
@@ -254,6 +255,27 @@ defaultPackedRunPassM :: PassM a -> (a,Int)
 defaultPackedRunPassM = runPassM (defaultConfig { dynflags = dflags}) 0
   where dflags = gopt_set Opt_Packed defaultDynFlags
 
+-- | Like 'mapM', but with --parallel-passes the computations run in parallel.
+-- They can only share the gensym counter, so every one of them gets a block
+-- of 'parGensymBlock' names of its own, which keeps the output independent
+-- of scheduling. If any of them runs out of its block, everything is rerun
+-- sequentially.
+parMapM :: NFData b => (a -> PassM b) -> [a] -> PassM [b]
+parMapM f xs = do
+  cfg <- ask
+  base <- get
+  let runs = [ runPassM cfg (base + i * parGensymBlock) (f x) | (i,x) <- zip [0..] xs ]
+      fits = and [ cnt' <= base + (i+1) * parGensymBlock | (i,(_,cnt')) <- zip [0..] runs ]
+  if not (gopt Opt_ParallelPasses (dynflags cfg)) || length xs < 2
+  then mapM f xs
+  else if L.foldr (\r acc -> rnf r `par` acc) () runs `pseq` fits
+  then do put (base + length xs * parGensymBlock)
+          pure (L.map fst runs)
+  else mapM f xs
+
+parGensymBlock :: Int
+parGensymBlock = 2 ^ (20 :: Int)
+
 getDynFlags :: MonadReader Config m => m DynFlags
 getDynFlags = asks dynflags
 
@@ -270,6 +292,7 @@ data Config = Config
   , mode       :: Mode -- ^ How to run, which backend.
   , benchInput :: Maybe FilePath -- ^ What packed, binary .gpkd file to use as input.
   , arrayInput :: Maybe FilePath -- ^ What array file to use as input.
+  , layoutProfile :: Maybe FilePath -- ^ Function counts recorded by a --profile-layout build.
   , verbosity  :: Int   -- ^ Debugging output, equivalent to DEBUG env var.
   , cc         :: String -- ^ C compiler to use
   , optc       :: String -- ^ Options to the C compiler
@@ -311,6 +334,7 @@ defaultConfig =
          , mode  = ToExe
          , benchInput = Nothing
          , arrayInput = Nothing
+         , layoutProfile = Nothing
          , verbosity = 1
          , cc = "gcc"
          , optc = " -O3  -flto "
@@ -29,6 +29,13 @@ import           Control.Monad.Reader (ask)
 
 
 
+import           Data.Char ( isUpper )
+import           Data.List ( intercalate, isPrefixOf, sort, sortOn )
+import qualified Data.Map as M
+import           Data.Word ( Word64 )
+import           GHC.Clock ( getMonotonicTime )
+import           GHC.Conc ( getNumProcessors, setNumCapabilities )
+import           GHC.Stats ( getRTSStatsEnabled, getRTSStats, RTSStats(allocated_bytes) )
 import           Options.Applicative
 import           System.Directory
 import           System.Environment
@@ -38,6 +45,7 @@ import           System.IO
 import           System.IO.Error (isDoesNotExistError)
 import           System.Process
 import           Text.PrettyPrint.GenericPretty
+import           Text.Printf ( printf, hPrintf )
 
 import           Gibbon.Common
 import           Gibbon.DynFlags
@@ -89,11 +97,14 @@ import           Gibbon.Passes.ReorderScalarWrites  ( reorderScalarWrites, write
 import           Gibbon.Passes.Unariser       (unariser)
 import           Gibbon.Passes.Lower          (lower)
 import           Gibbon.Passes.RearrangeFree  (rearrangeFree)
-import           Gibbon.Passes.Codegen        (codegenProg)
+import           Gibbon.Passes.Codegen        (codegenProg, codegenUnits, CUnits(..), unitHeaderName)
+import           Gibbon.Passes.Incremental    (canonicalizeNames, hashString, getCacheDir, touchCacheEntry, trimCache)
 import           Gibbon.Passes.AddCastInstructions (addCasts)
 import           Gibbon.Passes.Fusion2        (fusion2)
-import           Gibbon.Passes.HoistBoundsCheck (hoistBoundsCheckProg)
+import           Gibbon.Passes.HoistBoundsCheck (hoistBoundsCheckProg, dropStaticBoundsChecksProg)
+import           Gibbon.Passes.CalculateBounds (inferRegSize)
 import           Gibbon.Passes.ReorderLetExprs (reorderLetExprs)
+import           Gibbon.Passes.ReorderFields  (reorderFields, fieldOrders, readLayoutProfile)
 import           Gibbon.Pretty
 import           Gibbon.L1.GenSML
 -- Configuring and launching the compiler.
@@ -123,6 +134,14 @@ configParser = Config <$> inputParser
                           , " becomes a command-line argument of the resulting binary."
                           ]
                         ])
+                      <*> optional (strOption $ mconcat
+                        [ long "layout-profile"
+                        , metavar "FILE"
+                        , help $ mconcat
+                          [ "Reorder the fields of packed datatypes using the profile"
+                          , " written by a program compiled with --profile-layout."
+                          ]
+                        ])
                       <*> (option auto (mconcat
                         [ short 'v'
                         , long "verbose"
@@ -207,6 +226,15 @@ sepline = replicate 80 '='
 data CompileState a = CompileState
     { cnt :: Int -- ^ Gensym counter
     , result :: Maybe (Value a) -- ^ Result of evaluating output of prior pass, if available.
+    , timings :: [PassTiming] -- ^ Recorded with --time-passes, most recent first.
+    }
+
+-- | What --time-passes records about a single run of a pass.
+data PassTiming = PassTiming
+    { ptName    :: String
+    , ptSeconds :: Double
+    , ptAlloc   :: Maybe Word64 -- ^ Bytes allocated by GHC, if RTS stats are enabled (+RTS -T).
+    , ptNodes   :: Int          -- ^ Size of the pass output, see 'irSize'.
     }
 
 -- | Compiler entrypoint, given a full configuration and a list of
@@ -216,6 +244,10 @@ compile config@Config{mode,input,verbosity,backend,cfile} fp0 = do
   -- set the env var DEBUG, to verbosity, when > 1
   setDebugEnvVar verbosity
 
+  -- The RTS starts with one capability, only use every core when asked to.
+  when (gopt Opt_ParallelPasses (dynflags config)) $
+    getNumProcessors >>= setNumCapabilities
+
   -- Use absolute path
   dir <- getCurrentDirectory
   let fp1 = dir </> fp0
@@ -256,39 +288,47 @@ compile config@Config{mode,input,verbosity,backend,cfile} fp0 = do
 
       -- run the initial program through the compiler pipeline
       let stM = passes config' l0
-      l4  <- evalStateT stM (CompileState {cnt=cnt0, result=initResult})
-
-      case mode of
-        Interp2 -> do
-          error "TODO: Interp2"
-          -- l4res <- execProg l4
-          -- mapM_ (\(IntVal v) -> liftIO $ print v) l4res
-          -- exitSuccess
+          runPipeline = do
+            (l4, CompileState{timings}) <- runStateT stM (CompileState {cnt=cnt0, result=initResult, timings=[]})
+            when (gopt Opt_TimePasses (dynflags config)) $
+              reportPassTimings (replaceExtension fp ".passes.json") (reverse timings)
+            pure l4
+
+      if incrementalC config
+      then compileIncremental config' fp l0 runPipeline
+      else do
+        l4 <- runPipeline
+        case mode of
+          Interp2 -> do
+            error "TODO: Interp2"
+            -- l4res <- execProg l4
+            -- mapM_ (\(IntVal v) -> liftIO $ print v) l4res
+            -- exitSuccess
         
-        ToMPL -> return ()
-        ToMPLExe -> return ()
-        RunMPL -> return ()
+          ToMPL -> return ()
+          ToMPLExe -> return ()
+          RunMPL -> return ()
 
-        _ -> do
-          str <- case backend of
-                  C    -> codegenProg config' l4
+          _ -> do
+            str <- case backend of
+                    C    -> codegenProg config' l4
 
 
 
-                  LLVM -> error $ "Cannot execute through the LLVM backend. To build Gibbon with LLVM: "
-                          ++ "stack build --flag gibbon:llvm_enabled"
+                    LLVM -> error $ "Cannot execute through the LLVM backend. To build Gibbon with LLVM: "
+                            ++ "stack build --flag gibbon:llvm_enabled"
 
-          -- The C code is long, so put this at a higher verbosity level.
-          dbgPrint passChatterLvl $ " [compiler] Final C codegen: " ++show (length str) ++" characters."
-          dbgPrintLn 4 $ sepline ++ "\n" ++ str
+            -- The C code is long, so put this at a higher verbosity level.
+            dbgPrint passChatterLvl $ " [compiler] Final C codegen: " ++show (length str) ++" characters."
+            dbgPrintLn 4 $ sepline ++ "\n" ++ str
 
-          clearFile outfile
-          writeFile outfile str
+            clearFile outfile
+            writeFile outfile str
 
-          -- (Stage 3) Code written, now compile if warranted.
-          when (mode == ToExe || mode == RunExe || isBench mode ) $ do
-            compileAndRunExe config fp >>= putStr
-            return ()
+            -- (Stage 3) Code written, now compile if warranted.
+            when (mode == ToExe || mode == RunExe || isBench mode ) $ do
+              compileAndRunExe config fp >>= putStr
+              return ()
 
 runL0 :: L0.Prog0 -> IO ()
 runL0 l0 = do
@@ -433,12 +473,15 @@ compileAndRunExe cfg@Config{backend,arrayInput,benchInput,mode,cfile,exefile} fp
             compileRTS cfg
             lib_dir <- getRTSBuildDir
             let rts_o_path = lib_dir </> "gibbon_rts.o"
+            srcs <- if incrementalC cfg
+                    then compileUnits cfg lib_dir (unitsDir outfile)
+                    else pure [outfile]
             let compile_prog_cmd = compilationCmd backend cfg
                                    ++ " -o " ++ exe
                                    ++" -I" ++ lib_dir
                                    ++" -L" ++ lib_dir
                                    ++ " -Wl,-rpath=" ++ lib_dir ++ " "
-                                   ++ outfile ++ " " ++ rts_o_path
+                                   ++ unwords srcs ++ " " ++ rts_o_path
                                    ++ links ++ " -lgibbon_rts_ng"
 
             execCmd
@@ -448,6 +491,108 @@ compileAndRunExe cfg@Config{backend,arrayInput,benchInput,mode,cfile,exefile} fp
               (show backend ++" compiler failed! ")
             pure ()
 
+-- | Whether to take the --incremental route, which only exists for C.
+incrementalC :: Config -> Bool
+incrementalC Config{mode,backend,dynflags} =
+  gopt Opt_Incremental dynflags && backend == C &&
+  mode `notElem` [Interp2, ToMPL, ToMPLExe, RunMPL]
+
+-- | Where --incremental puts the translation units of a program.
+unitsDir :: FilePath -> FilePath
+unitsDir outfile = dropExtension outfile ++ "_units"
+
+-- | Generate C with --incremental. The units are looked up in the cache by
+-- the parsed program, the configuration and the compiler binary, and only
+-- generated if they aren't there. They are copied into a directory next to
+-- the output file, and the output file itself just includes all of them, so
+-- it can still be compiled on its own.
+compileIncremental :: Config -> FilePath -> L0.Prog0 -> IO L4.Prog -> IO ()
+compileIncremental config@Config{mode,backend,cfile,layoutProfile} fp l0 runPipeline = do
+  cache_dir <- getCacheDir
+  compiler_stamp <- getExecutablePath >>= getModificationTime
+  profile <- maybe (pure "") readFile layoutProfile
+  let key = hashString $ unlines
+              [ show compiler_stamp
+              , show config { verbosity = 1, cc = "", optc = "", cfile = Nothing, exefile = Nothing }
+              , profile
+              , show l0 ]
+      entry = cache_dir </> "c" </> key
+      index = entry </> "units"
+      outfile = getOutfile backend fp cfile
+      units_dir = unitsDir outfile
+  hit <- doesFileExist index
+  files <-
+    if hit
+    then do
+      dbgPrintLn passChatterLvl $ " [compiler] --incremental: reusing generated C from " ++ entry
+      touchCacheEntry entry
+      lines <$> readFile index
+    else do
+      l4 <- runPipeline
+      CUnits{unitHeader,unitMain,unitSCCs} <- codegenUnits config (canonicalizeNames l4)
+      let units = (unitHeaderName, unitHeader) : ("main.c", unitMain) :
+                  [ (name <.> "c", str) | (name,str) <- unitSCCs ]
+      createDirectoryIfMissing True entry
+      forM_ units $ \(f,str) -> writeFile (entry </> f) str
+      -- Written last, an entry without an index is incomplete.
+      writeFile index (unlines (map fst units))
+      trimCache cache_dir [entry]
+      pure (map fst units)
+  removePathForcibly units_dir
+  createDirectoryIfMissing True units_dir
+  forM_ files $ \f -> copyFile (entry </> f) (units_dir </> f)
+  clearFile outfile
+  writeFile outfile $ concat
+    [ "#include \"" ++ takeFileName units_dir </> f ++ "\"\n" | f <- files, takeExtension f == ".c" ]
+  when (mode == ToExe || mode == RunExe || isBench mode ) $ do
+    compileAndRunExe config fp >>= putStr
+    return ()
+
+-- | Compile the translation units written by 'compileIncremental' to object
+-- files, reusing the ones in the cache. Returns the object files to link.
+--
+-- The objects are compiled without -flto. Otherwise the link step would
+-- optimize the whole program again, which is the cost we are trying to
+-- avoid. Mutually recursive functions end up in the same unit, so the
+-- inlining that matters most still happens.
+compileUnits :: Config -> FilePath -> FilePath -> IO [FilePath]
+compileUnits cfg lib_dir units_dir = do
+  cache_dir <- getCacheDir
+  let obj_dir = cache_dir </> "o"
+  createDirectoryIfMissing True obj_dir
+  srcs <- sort . filter ((== ".c") . takeExtension) <$> listDirectory units_dir
+  header <- readFile (units_dir </> unitHeaderName)
+  rts_header <- readFile (lib_dir </> "gibbon_rts.h")
+  let cmd = unwords (filter (not . ("-flto" `isPrefixOf`)) (words (compilationCmd C cfg)))
+            ++ " -I" ++ lib_dir ++ " -c "
+  jobs <- forM srcs $ \src -> do
+    str <- readFile (units_dir </> src)
+    key <- evaluate $ force $ hashString (cmd ++ rts_header ++ header ++ str)
+    let obj = obj_dir </> key <.> "o"
+    hit <- doesFileExist obj
+    when hit $ touchCacheEntry obj
+    pure (units_dir </> src, obj, hit)
+  let todo = [ (src,obj) | (src,obj,False) <- jobs ]
+  dbgPrintLn passChatterLvl $ " [compiler] --incremental: compiling " ++ show (length todo) ++
+                              " of " ++ show (length jobs) ++ " translation units"
+  n <- getNumProcessors
+  let start (src,obj) = do
+        (_,_,_,phandle) <- createProcess (shell (cmd ++ " -o " ++ obj <.> "tmp" ++ " " ++ src))
+        pure (src, obj, phandle)
+      finish (src, obj, phandle) = do
+        exit_code <- waitForProcess phandle
+        case exit_code of
+          ExitSuccess   -> renameFile (obj <.> "tmp") obj
+          ExitFailure c -> die $ "C compiler failed on " ++ src ++ "\nCode: " ++ show c
+      go [] = pure ()
+      go ls = do let (now, later) = splitAt n ls
+                 mapM start now >>= mapM_ finish
+                 go later
+  go todo
+  let objs = [ obj | (_,obj,_) <- jobs ]
+  unless (null todo) $ trimCache cache_dir objs
+  pure objs
+
 getGibbonDir :: IO String
 getGibbonDir =
   do env <- getEnvironment
@@ -644,6 +789,11 @@ passes config@Config{dynflags} l0 = do
           parallel   = gopt Opt_Parallel dynflags
           should_fuse = gopt Opt_Fusion dynflags
           tcProg3     = L3.tcProg isPacked
+      -- The generational GC evacuates a packed value assuming that it's
+      -- serialized in a single buffer. Factored values are allocated on the
+      -- heap and reference counted instead.
+      when (isSoA && gopt Opt_GenGc dynflags) $
+        error "--SoA can't be used with --gen-gc, the collector can't evacuate factored values."
       l0 <- go  "freshen"         freshNames            l0
       l0 <- goE0 "typecheck"       L0.tcProg             l0
       --l0 <- go  "elimNewtypes"     L0.elimNewtypes            l0
@@ -686,13 +836,20 @@ passes config@Config{dynflags} l0 = do
         _ -> return l1
 
       -- -- TODO: Write interpreters for L2 and L3
-      l3 <- if isPacked
+      (l3, field_orders) <- if isPacked
             then do
               -- TODO: push data contstructors under conditional
               -- branches before InferLocations.
 
               -- Note: L1 -> L2
               -- l1 <- goE1 "copyOutOfOrderPacked" copyOutOfOrderPacked l1
+              (l1, field_orders) <- case layoutProfile config of
+                      Just fp | not isSoA -> do
+                        profile <- lift $ readLayoutProfile fp
+                        let field_orders = fieldOrders profile l1
+                        l1' <- goE1 "reorderFields" (reorderFields field_orders) l1
+                        pure (l1', field_orders)
+                      _ -> pure (l1, M.empty)
               l1 <- go "L1.typecheck"    L1.tcProg     l1
               l1 <- goE1 "removeCopyAliases" removeAliasesForCopyCalls l1
               l2 <- goE2 "inferLocations"  inferLocs    l1
@@ -820,9 +977,11 @@ Also see Note [Adding dummy traversals] and Note [Adding random access nodes].
               {- VS: The Argument to simplify loc binds used to be False, why doesn't true work ? -}
               l2 <- goE2 "simplifyLocBinds" (simplifyLocBinds True) l2 
               l2 <- go "addRedirectionCon" addRedirectionCon l2
-              -- l2 <- if gibbon1
-              --      then pure l2
-              --      else go "inferRegSize" inferRegSize l2
+              -- Regions whose size is known statically are allocated with
+              -- exactly that many bytes, and aren't bounds checked.
+              l2 <- if gibbon1 || isSoA
+                    then pure l2
+                    else go "inferRegSize" inferRegSize l2
               l2 <- if gibbon1
                     then pure l2
                     else go "followPtrs" followPtrs l2
@@ -833,6 +992,7 @@ Also see Note [Adding dummy traversals] and Note [Adding random access nodes].
               -- typechecker doesn't know how to handle.
               -- l2' <- go "threadRegions"    threadRegions l2'
               l2' <- go "threadRegions2" threadRegions2 l2'
+              l2' <- go "dropStaticBoundsChecks" dropStaticBoundsChecksProg l2'
               l2' <- go "hoistBoundsCheck" hoistBoundsCheckProg l2'
 
               -- L2 -> L3
@@ -845,11 +1005,11 @@ Also see Note [Adding dummy traversals] and Note [Adding random access nodes].
               l3 <- go "L3.typecheck"     tcProg3       l3
               l3 <- go "hoistNewBuf"      hoistNewBuf   l3
               l3 <- go "L3.typecheck"     tcProg3       l3
-              return l3
+              return (l3, field_orders)
             else do
               l3 <- go "directL3"         directL3      l1
               l3 <- go "L3.typecheck"     tcProg3       l3
-              return l3
+              return (l3, M.empty)
 
       l3 <- go "unariser"       unariser                l3
       l3 <- go "L3.typecheck"   tcProg3                 l3
@@ -857,7 +1017,7 @@ Also see Note [Adding dummy traversals] and Note [Adding random access nodes].
       l3 <- go "L3.typecheck"   tcProg3                 l3
 
       -- Note: L3 -> L4
-      l4 <- go "lower"          lower                   l3
+      l4 <- go "lower"          (lower field_orders)    l3
       l4 <- go "lateInlineTriv" lateInlineTriv          l4
       l4 <- if gibbon1 || not isPacked
             then do
@@ -892,17 +1052,28 @@ type InterpPassRunner a b s v = (HasPretty a, HasPretty b, HasOut a, HasOut b,
 --
 pass :: Config -> PassRunner a b v
 pass config who fn x = do
-  cs@CompileState{cnt} <- get
-  x' <- if dbgLvl >= passChatterLvl
+  cs@CompileState{cnt,timings} <- get
+  -- With --time-passes the input is forced first, so that the time of a
+  -- pass doesn't include the lazy leftovers of the previous one.
+  let time_passes = gopt Opt_TimePasses (dynflags config)
+  x' <- if dbgLvl >= passChatterLvl || time_passes
         then lift $ evaluate $ force x
         else return x
   lift$ dbgPrint passChatterLvl $ " [compiler] Running pass, " ++who
 
+  before <- lift $ if time_passes then Just <$> passClock else pure Nothing
   let (y,cnt') = runPassM config cnt (fn x')
-  put cs{cnt=cnt'}
-  y' <- if dbgLvl >= passChatterLvl
+  y' <- if dbgLvl >= passChatterLvl || time_passes
         then lift $ evaluate $ force y
         else return y
+  timing <- case before of
+              Nothing -> pure []
+              Just (t0,a0) -> do
+                (t1,a1) <- lift passClock
+                -- Evaluated right away, to not keep every program alive.
+                nodes <- lift $ evaluate (irSize y')
+                pure [PassTiming who (t1 - t0) ((-) <$> a1 <*> a0) nodes]
+  put cs{cnt=cnt', timings = timing ++ timings}
   if dbgLvl >= passChatterLvl+1
      then lift$ dbgPrintLn (passChatterLvl+1) $ "Pass output:\n"++sepline++"\n"++ (pprender y')
      -- TODO: Switch to a node-count for size output (add to GenericOps):
@@ -913,6 +1084,76 @@ pass config who fn x = do
 passChatterLvl :: Int
 passChatterLvl = 3
 
+-- | Wall clock time and bytes allocated by GHC so far.
+passClock :: IO (Double, Maybe Word64)
+passClock = do
+  t <- getMonotonicTime
+  enabled <- getRTSStatsEnabled
+  alloc <- if enabled
+           then Just . allocated_bytes <$> getRTSStats
+           else pure Nothing
+  pure (t, alloc)
+
+-- | Approximate number of nodes in an IR: the constructor applications in
+-- its generic pretty printed form.
+irSize :: Out a => a -> Int
+irSize = length . filter isCon . words . map (\c -> if c `elem` ("()[]{},"::String) then ' ' else c) . sdoc
+  where isCon (c:_) = isUpper c
+        isCon []    = False
+
+-- | Print a table of the recorded pass timings to stderr, and write them to
+-- a JSON file.
+--
+-- We can't tell from a single compile how a pass scales, but a superlinear
+-- pass shows up as one whose time per node of its input is far above that of
+-- the other passes. Passes that cost more than 'suspectFactor' times the
+-- median per node, and take at least 5% of the total, are flagged.
+reportPassTimings :: FilePath -> [PassTiming] -> IO ()
+reportPassTimings json_fp ts = do
+  hPrintf stderr "%-28s %10s %6s %12s %10s %10s\n"
+    ("pass"::String) ("time (ms)"::String) ("%"::String) ("alloc (MB)"::String) ("nodes"::String) ("ns/node"::String)
+  forM_ rows $ \(PassTiming{ptName,ptSeconds,ptAlloc,ptNodes}, per_node, suspect) ->
+    hPrintf stderr "%-28s %10.2f %6.1f %12s %10d %10.1f%s\n"
+      ptName (ptSeconds * 1000) (100 * ptSeconds / total) (showAlloc ptAlloc) ptNodes
+      (per_node * 1e9) (if suspect then "  <- superlinear?" else "" :: String)
+  hPrintf stderr "%-28s %10.2f\n" ("total"::String) (total * 1000)
+  hPutStrLn stderr "Slowest passes (all runs combined):"
+  forM_ (take 5 by_name) $ \(name, secs) ->
+    hPrintf stderr "  %-26s %10.2f ms\n" name (secs * 1000)
+  writeFile json_fp $
+    "[" ++ intercalate ",\n " (map toJSON rows) ++ "]\n"
+  hPutStrLn stderr $ "Wrote " ++ json_fp
+  where
+    total = max 1e-9 (sum (map ptSeconds ts))
+
+    -- The input of a pass is (almost always) the output of the previous one.
+    sizes_in = map (max 1) (take 1 (map ptNodes ts) ++ map ptNodes ts)
+    per_nodes = zipWith (\t n -> ptSeconds t / fromIntegral n) ts sizes_in
+
+    median_per_node = case sort per_nodes of
+                        [] -> 0
+                        xs -> xs !! (length xs `div` 2)
+
+    rows = [ (t, pn, pn > suspectFactor * median_per_node && ptSeconds t >= 0.05 * total)
+           | (t, pn) <- zip ts per_nodes ]
+
+    by_name = sortOn (negate . snd) $ M.toList $
+                M.fromListWith (+) [ (ptName t, ptSeconds t) | t <- ts ]
+
+    showAlloc :: Maybe Word64 -> String
+    showAlloc = maybe "-" (\a -> printf "%.1f" (fromIntegral a / (1024 * 1024) :: Double))
+
+    toJSON (PassTiming{ptName,ptSeconds,ptAlloc,ptNodes}, per_node, suspect) =
+      "{\"pass\": " ++ show ptName ++
+      ", \"seconds\": " ++ show ptSeconds ++
+      ", \"alloc_bytes\": " ++ maybe "null" show ptAlloc ++
+      ", \"nodes\": " ++ show ptNodes ++
+      ", \"ns_per_node\": " ++ show (per_node * 1e9) ++
+      ", \"suspect\": " ++ (if suspect then "true" else "false") ++ "}"
+
+suspectFactor :: Double
+suspectFactor = 10
+
 
 -- | Like 'pass', but also evaluates and checks the result.
 --
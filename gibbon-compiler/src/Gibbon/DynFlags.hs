@@ -41,6 +41,11 @@ data GeneralFlag
   | Opt_SimpleWriteBarrier -- ^ Disables eliminate-indirection-chains optimization.
   | Opt_Packed_SoA         -- ^ Use packed representation but use a structure of arrays representation for the datatype
   | Opt_No_RAN             -- ^ Don't use shortcut pointers instead use extra traversals to reach get endwitness
+  | Opt_Prefetch           -- ^ Prefetch the targets of indirections and random access nodes.
+  | Opt_ProfileLayout      -- ^ Count function entries for profile-guided field reordering.
+  | Opt_TimePasses         -- ^ Report the time, allocation and output size of every pass.
+  | Opt_ParallelPasses     -- ^ Run per-function passes on all cores.
+  | Opt_Incremental        -- ^ Cache generated C and object files, one translation unit per SCC.
   deriving (Show,Read,Eq,Ord)
 
 -- | Exactly like GHC's ddump flags.
@@ -120,7 +125,17 @@ dynflagsParser = DynFlags <$> (S.fromList <$> many gflagsParser) <*> (S.fromList
                    flag' Opt_Packed_SoA (long "SoA" <>
                                          help "Use a structure of arrays representation for all datatypes.") <|>
                    flag' Opt_No_RAN (long "no-ran" <>
-                                         help "Don't use RAN pointers, instead, use extra traversals.")
+                                         help "Don't use RAN pointers, instead, use extra traversals.") <|>
+                   flag' Opt_Prefetch (long "prefetch" <>
+                                         help "Prefetch the targets of indirections and random access nodes. The distance can be tuned with --optc=\"-DGIB_PREFETCH_DISTANCE=<bytes>\".") <|>
+                   flag' Opt_ProfileLayout (long "profile-layout" <>
+                                         help "Count how often every function runs and write the counts out at exit, for --layout-profile.") <|>
+                   flag' Opt_TimePasses (long "time-passes" <>
+                                         help "Report the wall time, GHC allocation and output size of every pass, as a table on stderr and as JSON next to the output.") <|>
+                   flag' Opt_ParallelPasses (long "parallel-passes" <>
+                                         help "Compile functions in parallel in the passes that handle them one at a time (cursorize, threadRegions, lower).") <|>
+                   flag' Opt_Incremental (long "incremental" <>
+                                         help "Emit one C translation unit per recursive group of functions and cache the generated C and the object files in $GIBBON_CACHE_DIR (default ~/.cache/gibbon), evicting the least recently used ones above $GIBBON_CACHE_SIZE megabytes (default 1024).")
                                          
     dflagsParser :: Parser DebugFlag
     dflagsParser = flag' Opt_D_Dump_Repair (long "ddump-repair" <>
@@ -112,6 +112,7 @@ data DataConInfo = DataConInfo
   , num_scalars :: Int
   , num_packed :: Int
   , field_tys :: [L3.Ty3]
+  , field_order :: [Int] -- ^ Source position of every field, if --layout-profile reordered them.
   }
   deriving (Show, Ord, Eq, Generic, NFData, Out)
 
@@ -349,7 +350,8 @@ data Prim
     | PrintFloat  -- ^ Print a floating point number to stdout.
     | PrintBool   -- ^ Print a boolean to stdout.
     | PrintSym    -- ^ Fetch a symbol from the symbol table, and print it.
-    | PrintString String -- ^ Print a constant string to stdout.
+    | PrintString String -- ^ Print a constant string to stdout, as it is ('%' isn't
+                         --   a format character).
                          -- TODO: add string values to the language.
     | PrintRegionCount   -- ^ Call print_global_region_count() defined in the RTS.
 
@@ -96,6 +96,40 @@ case clause is compilable.
 
 Evernote: https://www.evernote.com/l/AF-jUPTw2lZDS440RgWbgj9RMNkttTaKd3Y
 
+
+Relative offsets
+~~~~~~~~~~~~~~~~
+
+Absolute random access nodes are plain pointers, so a value that uses them
+cannot be written to a file and mmap'd back at a different address. With
+--reloffsets, every constructor that gets an absolute RAN variant `K^` also
+gets a relative variant `K*`:
+
+    K* size offset_1 ... offset_n fields...
+
+where `size` is the number of bytes in the node other than the size field
+itself (1 for the tag, 8 per offset, plus the fields), and each offset is the
+distance from the end of that offset field to the field it points to (see
+genRelOffsetsFunNameFn and Cursorize.unpackWithRelRAN). The offsets are
+8-byte Ints like the absolute ones, so a `K*` node is 8 bytes (the size
+field) larger than the `K^` node it replaces: the flag buys position
+independence, not smaller values. Three things happen under the flag:
+
+(1) withRANDDefs adds the `K*` constructors (tags 150 and above, see
+    Lower.getTagOfDataCon),
+
+(2) every case expression that gets a `K^` clause also gets a `K*` clause
+    that's unpacked with Cursorize.unpackWithRelRAN, and
+
+(3) a `_add_size_and_rel_offsets_` function is generated for every datatype
+    and WritePackedFile on a type with RANs writes its result instead of the
+    original value. ReadPackedFile then hands back `K*` nodes, which (2) can
+    consume without a dummy traversal.
+
+A `K*` value lives in a chunked region like any other, so the garbage
+collector doesn't copy it as a block. It evacuates it field by field and
+recomputes the offsets and the size (Note [Relative offsets] in gc.rs).
+
 -}
 
 --------------------------------------------------------------------------------
@@ -105,17 +139,25 @@ Evernote: https://www.evernote.com/l/AF-jUPTw2lZDS440RgWbgj9RMNkttTaKd3Y
 -- Previous analysis determines which data types require it (needsLRAN).
 addRAN :: S.Set TyCon -> Prog1 -> PassM Prog1
 addRAN needRANsTyCons prg@Prog{ddefs,fundefs,mainExp} = do
-  dump_op <- dopt Opt_D_Dump_Repair <$> getDynFlags
+  dflags <- getDynFlags
+  let dump_op = dopt Opt_D_Dump_Repair dflags
+      -- See Note [Relative offsets].
+      rel_offsets = gopt Opt_RelativeOffsets dflags && not (S.null needRANsTyCons)
   when dump_op $
     dbgTrace 2 ("Adding random access nodes: " ++ sdoc (S.toList needRANsTyCons)) (return ())
-  let iddefs = withRANDDefs needRANsTyCons ddefs
-  funs <- mapM (\(nm,f) -> (nm,) <$> addRANFun needRANsTyCons iddefs f) (M.toList fundefs)
-  -- new_fns <- mapM (genRelOffsetsFunNameFn needRANsTyCons ddefs) (M.elems ddefs)
-  let funs' = (M.fromList funs)
-              -- `M.union` (M.fromList $ L.map (\f -> (funName f, f)) new_fns)
+  let iddefs = withRANDDefs rel_offsets needRANsTyCons ddefs
+  -- The size-and-offsets functions are written against the original
+  -- constructors, and then go through addRANFun like everything else so
+  -- that they can also consume values built with random access nodes.
+  new_fns <- if rel_offsets
+             then mapM (genRelOffsetsFunNameFn needRANsTyCons ddefs) (M.elems ddefs)
+             else pure []
+  funs <- mapM (\f -> (funName f,) <$> addRANFun rel_offsets needRANsTyCons iddefs f)
+               (M.elems fundefs ++ new_fns)
+  let funs' = M.fromList funs
   mainExp' <-
     case mainExp of
-      Just (ex,ty) -> Just <$> (,ty) <$> addRANExp False needRANsTyCons iddefs ex
+      Just (ex,ty) -> Just <$> (,ty) <$> addRANExp rel_offsets False needRANsTyCons iddefs ex
       Nothing -> return Nothing
   let l1 = prg { ddefs = iddefs
                , fundefs = funs'
@@ -123,19 +165,19 @@ addRAN needRANsTyCons prg@Prog{ddefs,fundefs,mainExp} = do
                }
   pure l1
 
-addRANFun :: S.Set TyCon -> DDefs Ty1 -> FunDef1 -> PassM FunDef1
-addRANFun needRANsTyCons ddfs fd@FunDef{funName,funBody} = do
+addRANFun :: Bool -> S.Set TyCon -> DDefs Ty1 -> FunDef1 -> PassM FunDef1
+addRANFun rel_offsets needRANsTyCons ddfs fd@FunDef{funName,funBody} = do
   let dont_change_datacons = isCopySansPtrsFunName funName
-  bod <- addRANExp dont_change_datacons needRANsTyCons ddfs funBody
+  bod <- addRANExp rel_offsets dont_change_datacons needRANsTyCons ddfs funBody
   return $ fd{funBody = bod}
 
-addRANExp :: Bool -> S.Set TyCon -> DDefs Ty1 -> Exp1 -> PassM Exp1
-addRANExp dont_change_datacons needRANsTyCons ddfs ex =
+addRANExp :: Bool -> Bool -> S.Set TyCon -> DDefs Ty1 -> Exp1 -> PassM Exp1
+addRANExp rel_offsets dont_change_datacons needRANsTyCons ddfs ex =
   case ex of
     -- Update a data constructor to produce values with random access nodes.
-    -- N.B. It always uses absolute pointers for random access nodes. We
-    -- may not always want this. If we know that a region is BigInf, we should
-    -- use relative offsets as pointers. But that's not being done right now.
+    -- N.B. It always uses absolute pointers for random access nodes. The
+    -- relative form is only produced by the _add_size_and_rel_offsets_
+    -- functions. See Note [Relative offsets].
     DataConE loc dcon args
       | dont_change_datacons ->
         return ex
@@ -168,6 +210,14 @@ addRANExp dont_change_datacons needRANsTyCons ddfs ex =
     CharE{}   -> return ex
     FloatE{}  -> return ex
     LitSymE{} -> return ex
+    -- Values written out to a file get the position independent
+    -- representation. See Note [Relative offsets].
+    PrimAppE (WritePackedFile fp ty@(PackedTy tycon _)) [VarE packd]
+      | rel_offsets && tycon `S.member` needRANsTyCons -> do
+        packd' <- gensym packd
+        return $ LetE (packd',[],ty,AppE (mkRelOffsetsFunName tycon) [] [VarE packd])
+                      (PrimAppE (WritePackedFile fp ty) [VarE packd'])
+
     AppE f locs args -> AppE f locs <$> mapM go args
     PrimAppE f args  -> PrimAppE f <$> mapM go args
     LetE (v,loc,ty,rhs) bod -> do
@@ -189,7 +239,7 @@ addRANExp dont_change_datacons needRANsTyCons ddfs ex =
     FoldE{} -> error "addRANExp: TODO FoldE"
 
   where
-    go = addRANExp dont_change_datacons needRANsTyCons ddfs
+    go = addRANExp rel_offsets dont_change_datacons needRANsTyCons ddfs
 
     changeSpawnToApp :: Exp1 -> Exp1
     changeSpawnToApp ex1 =
@@ -221,7 +271,7 @@ addRANExp dont_change_datacons needRANsTyCons ddfs ex =
     doalt :: (DataCon, [(Var,())], Exp1) -> PassM [(DataCon, [(Var,())], Exp1)]
     doalt (dcon,vs,bod) = do
       -- Always process the body, because it might have another case expression.
-      bod0 <- addRANExp dont_change_datacons needRANsTyCons ddfs (changeSpawnToApp bod)
+      bod0 <- go (changeSpawnToApp bod)
       let old_pat = (dcon,vs,bod0)
       case numRANsDataCon ddfs dcon of
         0 -> pure [old_pat]
@@ -235,19 +285,17 @@ addRANExp dont_change_datacons needRANsTyCons ddfs ex =
             sizeVar <- gensym "size"
             relRanVars <- mapM (\_ -> gensym "relran") [1..n]
             let relRanVars' = sizeVar : relRanVars
-            bod' <- addRANExp dont_change_datacons needRANsTyCons ddfs bod
-            bod'' <- addRANExp dont_change_datacons needRANsTyCons ddfs bod
+            bod' <- go bod
+            bod'' <- go bod
             let abs_ran_clause = (toAbsRANDataCon dcon, (L.map (,()) absRanVars) ++ vs, bod')
-            let _rel_ran_clause = (toRelRANDataCon dcon, (L.map (,()) relRanVars') ++ vs, bod'')
-            {- dflags <- getDynFlags
-            if gopt Opt_RelativeOffsets dflags
+            let rel_ran_clause = (toRelRANDataCon dcon, (L.map (,()) relRanVars') ++ vs, bod'')
+            if rel_offsets
               then pure [abs_ran_clause,rel_ran_clause]
-              else pure [abs_ran_clause] -}
-            pure [abs_ran_clause]
+              else pure [abs_ran_clause]
 
 -- | Update data type definitions to include random access nodes.
-withRANDDefs :: Out a => S.Set TyCon -> DDefs (UrTy a) -> DDefs (UrTy a)
-withRANDDefs needRANsTyCons ddfs = M.map go ddfs
+withRANDDefs :: Out a => Bool -> S.Set TyCon -> DDefs (UrTy a) -> DDefs (UrTy a)
+withRANDDefs rel_offsets needRANsTyCons ddfs = M.map go ddfs
   where
     -- go :: DDef a -> DDef b
     go dd@DDef{dataCons} =
@@ -262,10 +310,12 @@ withRANDDefs needRANsTyCons ddfs = M.map go ddfs
                                            tys'   = [(False,ranTy) | _ <- [1..n]] ++ tys
                                            dcon'  = toAbsRANDataCon dcon
 
-                                           _tys''  = (False,IntTy) : [(False,IntTy) | _ <- [1..n]] ++ tys
-                                           -- dcon'' = toRelRANDataCon dcon
-                                       -- in [(dcon',tys'),(dcon'',tys'')] ++ acc)
-                                       in [(dcon',tys')] ++ acc)
+                                           -- A size field followed by one offset per RAN.
+                                           tys''  = (False,IntTy) : [(False,IntTy) | _ <- [1..n]] ++ tys
+                                           dcon'' = toRelRANDataCon dcon
+                                       in if rel_offsets
+                                          then [(dcon',tys'),(dcon'',tys'')] ++ acc
+                                          else [(dcon',tys')] ++ acc)
                    [] dataCons
       -- Add the new constructors after all the existing constructors.
       -- The order of constructors matters when these become numeric tags after codegen.
@@ -30,20 +30,19 @@ calculateBounds Prog { ddefs, fundefs, mainExp } = do
 
 calculateBoundsFun :: DDefs Old.Ty2 -> Env2 Var Old.Ty2 -> VarSizeMapping -> Old.FunDef2 -> PassM Old.FunDef2
 calculateBoundsFun ddefs env2 varSzEnv f@FunDef { funName, funBody, funTy, funArgs } = do
-  if "_" `L.isPrefixOf` fromVar funName
+  -- TODO: SoA regions.
+  if "_" `L.isPrefixOf` fromVar funName || any (isSoARegion . lrmReg) (locVars funTy)
     then return f
     else do
-      let locRegEnv = M.fromList $ map
-                        (
-                          \lv -> case (lrmReg lv) of
-                              SoAR _ _ -> error "TODO: calculateBoundsFn SoA region not implemented."
-                              _ -> (lrmLoc lv, regionToVar (lrmReg lv))
-                        ) (locVars funTy)
+      let locRegEnv = M.fromList $ map (\lv -> (lrmLoc lv, regionToVar (lrmReg lv))) (locVars funTy)
       let locTyEnv  = M.map (const $ BoundedSize 0) locRegEnv
       let argTys    = M.fromList $ zip funArgs (arrIns funTy)
       let env2'     = env2 { vEnv = argTys }
       funBody' <- fst3 <$> calculateBoundsExp ddefs env2' varSzEnv M.empty locRegEnv locTyEnv M.empty M.empty funBody
       return $ f { funBody = funBody' }
+  where
+    isSoARegion SoAR{} = True
+    isSoARegion _      = False
 
 {-
   * We recurse using three mappings (variable => size, location => region and region => size)
@@ -62,6 +61,10 @@ calculateBoundsFun ddefs env2 varSzEnv f@FunDef { funName, funBody, funTy, funAr
   *
   * NOTE: since input and output regions are not created inside the function,
   * we will not update the region size inside that function .
+  *
+  * The sizes are used to allocate regions of exactly the right size, so they have
+  * to be upper bounds: anything that writes an unknown amount of data (a function
+  * call, a value whose size isn't known) makes the region 'Undefined'.
 -}
 calculateBoundsExp
   :: DDefs Old.Ty2 -- ^ Data Definitions
@@ -76,40 +79,46 @@ calculateBoundsExp
   -> PassM (Old.Exp2, RegionSizeMapping, RegionTypeMapping)
 calculateBoundsExp ddefs env2 varSzEnv varLocEnv locRegEnv locOffEnv regSzEnv regTyEnv ex = case ex of
   Ext (BoundsCheck{}) -> return (ex, regSzEnv, regTyEnv)
-  Ext (IndirectionE _tycon _dcon (fromLoc, _fromvar) (toLoc, _tovar) _exp) -> do
-    let fromReg = locRegEnv # fromLoc
-    let fromOff = locOffEnv # fromLoc
-    let toOff   = locOffEnv # toLoc
-    let regTy = M.findWithDefault IndirectionFree fromReg regTyEnv <> if toOff >= fromOff then RightwardLocalIndirections else LocalIndirections
-    let regSz   = fromOff <> BoundedSize 9
-    return (ex, M.insert fromReg regSz regSzEnv, M.insert fromReg regTy regTyEnv)
+  Ext (IndirectionE _tycon _dcon (fromLoc, _fromvar) (toLoc, _tovar) _exp) ->
+    case M.lookup fromLoc locRegEnv of
+      Nothing -> return (ex, regSzEnv, regTyEnv)
+      Just fromReg -> do
+        let fromOff = offsetOf fromLoc
+        let toOff   = offsetOf toLoc
+        let regTy = M.findWithDefault IndirectionFree fromReg regTyEnv <> if toOff >= fromOff then RightwardLocalIndirections else LocalIndirections
+        let regSz   = fromOff <> BoundedSize 9
+        return (ex, M.insertWith max fromReg regSz regSzEnv, M.insert fromReg regTy regTyEnv)
   VarE _ -> return (ex, regSzEnv, regTyEnv)
   _ ->
-    let ty   = gRecoverType ddefs env2 ex
-        go   = calculateBoundsExp ddefs env2 varSzEnv varLocEnv locRegEnv locOffEnv regSzEnv regTyEnv
-        err  = error "Should have been covered by sizeOfTy"
+    -- N.B. Scalar-typed expressions are traversed too, since a let or a case
+    -- that returns a scalar can still write packed data in its body.
+    let go   = calculateBoundsExp ddefs env2 varSzEnv varLocEnv locRegEnv locOffEnv regSzEnv regTyEnv
         pass = return (ex, regSzEnv, regTyEnv)
-    in  case sizeOfTy ty of
-          Just _ -> return (ex, regSzEnv, regTyEnv)
-          _      -> case ex of
-            LitE    _           -> err
-            CharE   _           -> err
-            FloatE  _           -> err
-            LitSymE _           -> err
+    in  case ex of
+            LitE    _           -> pass
+            CharE   _           -> pass
+            FloatE  _           -> pass
+            LitSymE _           -> pass
             ProjE{}             -> pass
-            TimeIt{}            -> pass
+            TimeIt e ty1 b      -> do
+              (e', re, rt) <- go e
+              return (TimeIt e' ty1 b, re, rt)
             WithArenaE{}        -> pass
-            SpawnE{}            -> pass
+            -- The callee may write any amount of data into its output regions.
+            SpawnE f locs _args -> return (ex, unknownWrites f locs, regTyEnv)
             SyncE{}             -> pass
             MapE{}              -> pass
             FoldE{}             -> pass
-            AppE _v _locs _args -> do
-              -- TODO traversals
-              return (ex, regSzEnv, regTyEnv)
+            AppE f locs _args   -> return (ex, unknownWrites f locs, regTyEnv)
             PrimAppE{}             -> return (ex, regSzEnv, regTyEnv)
-            DataConE loc dcon args -> do
-              (_, res, rts) <- unzip3 <$> mapM go args
-              return (DataConE loc dcon args, mconcat res, mconcat rts)
+            -- The constructor writes its tag and all of its scalar fields,
+            -- including the ones after packed fields, which end up after the
+            -- packed fields' data. 'valueSize' counts all of them.
+            DataConE loc _dcon _args ->
+              let regSzEnv' = case M.lookup loc locRegEnv of
+                                Just reg -> M.insertWith max reg (atLeastChunk (offsetOf loc <> valueSize ex)) regSzEnv
+                                Nothing  -> regSzEnv
+              in return (ex, regSzEnv', regTyEnv)
             IfE cond bod1 bod2 -> do
               (bod1', regSzEnv1, regTyEnv1) <- go bod1
               (bod2', regSzEnv2, regTyEnv2) <- go bod2
@@ -123,19 +132,21 @@ calculateBoundsExp ddefs env2 varSzEnv varLocEnv locRegEnv locOffEnv regSzEnv re
               let vle = case ty0 of
                     PackedTy _tag loc -> M.insert v loc varLocEnv
                     _                 -> varLocEnv
-              (bod', regSzEnv'', regTyEnv'') <- calculateBoundsExp ddefs (env2 { vEnv = venv' }) varSzEnv vle locRegEnv locOffEnv regSzEnv regTyEnv bod
+              let vsz = case ty0 of
+                          PackedTy{} -> valueSize bind
+                          _          -> Undefined
+                  varSzEnv' = M.insert v vsz varSzEnv
+              (bod', regSzEnv'', regTyEnv'') <- calculateBoundsExp ddefs (env2 { vEnv = venv' }) varSzEnv' vle locRegEnv locOffEnv regSzEnv regTyEnv bod
               let regSzEnv3 = M.unionWith max regSzEnv' regSzEnv''
               let regSzEnv4 = case ty0 of
-                    -- TODO sizeofTy ty0 is incalculable? -> assume as 0 to give preference to analysis in other locations
-                    PackedTy _tag loc ->
-                      -- Make the chunk at least 32 bytes.
-                      let sz = case (locOffEnv # loc <> (maybe (BoundedSize 0) BoundedSize . sizeOfTy) ty0) of
-                                 BoundedSize i -> BoundedSize (max i 32)
-                                 Undefined -> Undefined
-                      in M.insertWith max (locRegEnv # loc) sz regSzEnv3
+                    PackedTy _tag loc | Just reg <- M.lookup loc locRegEnv ->
+                      M.insertWith max reg (atLeastChunk (offsetOf loc <> vsz)) regSzEnv3
                     _ -> regSzEnv3
               return (LetE (v, locs, ty0, bind') bod', regSzEnv4, M.union regTyEnv' regTyEnv'')
             CaseE ex2 cases -> do
+              let scrtReg = case ex2 of
+                              VarE x -> M.lookup x varLocEnv >>= \l -> M.lookup l locRegEnv
+                              _      -> Nothing
               (cases', res, rts) <-
                 unzip3
                   <$> mapM
@@ -153,7 +164,11 @@ calculateBoundsExp ddefs env2 varSzEnv varLocEnv locRegEnv locOffEnv regSzEnv re
                               varLocEnv' = M.fromList vlocs `M.union` varLocEnv
                               (_vars,locs) = unzip vlocs
                               locOffEnv' = (M.fromList (zip locs (repeat Undefined))) `M.union` locOffEnv
-                          (bod', re, rt) <- calculateBoundsExp ddefs (env2 { vEnv = venv'}) varSzEnv varLocEnv' locRegEnv locOffEnv' regSzEnv regTyEnv bod
+                              -- Fields live in the same region as the scrutinee.
+                              locRegEnv' = case scrtReg of
+                                             Just reg -> M.fromList (zip locs (repeat reg)) `M.union` locRegEnv
+                                             Nothing  -> locRegEnv
+                          (bod', re, rt) <- calculateBoundsExp ddefs (env2 { vEnv = venv'}) varSzEnv varLocEnv' locRegEnv' locOffEnv' regSzEnv regTyEnv bod
                           return ((dcon, vlocs, bod'), re, rt)
                         )
                         cases
@@ -162,14 +177,14 @@ calculateBoundsExp ddefs env2 varSzEnv varLocEnv locRegEnv locOffEnv regSzEnv re
               LetRegionE reg _ _ bod -> do
                 (bod', re, rt) <- go bod
                 let regVar = regionToVar reg
-                let regSz  = re # regVar
+                let regSz  = M.findWithDefault Undefined regVar re
                 let regTy = Just $ M.findWithDefault IndirectionFree regVar rt
                 when (dbgLvl >= 4) $ traceM $ ">> Region: " ++ show reg ++ " -> " ++ show regSz ++ " : " ++ show regTy
                 return (Ext $ LetRegionE reg regSz regTy bod', re, rt)
               LetParRegionE reg _ _ bod -> do
                 (bod', re, rt) <- go bod
                 let regVar = regionToVar reg
-                let regSz  = re # regVar
+                let regSz  = M.findWithDefault Undefined regVar re
                 let regTy = Just $ M.findWithDefault IndirectionFree regVar rt
                 when (dbgLvl >= 4) $ traceM $ ">> Region: " ++ show reg ++ " -> " ++ show regSz ++ " : " ++ show regTy
                 return (Ext $ LetParRegionE reg regSz regTy bod', re, rt)
@@ -181,23 +196,32 @@ calculateBoundsExp ddefs env2 varSzEnv varLocEnv locRegEnv locOffEnv regSzEnv re
                     return (Ext $ LetLocE loc locExp ex1', re', rt')
                   else do
                     let (re, off) = case locExp of
-                          (StartOfRegionLE r          ) -> (regionToVar r, BoundedSize 0)
+                          (StartOfRegionLE r          ) -> (Just (regionToVar r), BoundedSize 0)
                           -- [2024.12.04] VS: currently discarding offsets for SoA representation
-                          (AfterConstantLE n l  ) -> (locRegEnv # l, locOffEnv # l <> BoundedSize n)
-                          -- [2022.12.26] CSK: the lookup in varSzEnv always fails since the
-                          -- pass never inserts anything into it. Disabling it for now.
+                          (AfterConstantLE n l  ) -> (M.lookup l locRegEnv, offsetOf l <> BoundedSize n)
                           -- [2024.12.04] VS: currently discarding offsets for SoA representation
-                          (AfterVariableLE v l _) -> (locRegEnv # l, locOffEnv # (varLocEnv # v)) -- <> varSzEnv # v
-                          (InRegionLE r         ) -> (regionToVar r, Undefined)
-                          (FromEndLE  l         ) -> (locRegEnv # l, Undefined)
-                          FreeLE                  -> undefined
-                          GenSoALoc {}            -> error "calculateBoundsExp: GenSoALoc not handled"
-                          GetDataConLocSoA {}     -> error "calculateBoundsExp: GetDataConLocSoA not handled"
-                          GetFieldLocSoA {}       -> error "calculateBoundsExp: GetFieldLocSoA not handled"
-                          AssignLE {}             -> error "calculateBoundsExp: AssignLE not handled"
-                    let lre = M.insert loc re locRegEnv
+                          (AfterVariableLE v l _) -> (M.lookup l locRegEnv, maybe Undefined offsetOf (M.lookup v varLocEnv) <> M.findWithDefault Undefined v varSzEnv)
+                          (InRegionLE r         ) -> (Just (regionToVar r), Undefined)
+                          (FromEndLE  l         ) -> (M.lookup l locRegEnv, Undefined)
+                          (AssignLE   l         ) -> (M.lookup l locRegEnv, offsetOf l)
+                          FreeLE                  -> (Nothing, Undefined)
+                          GenSoALoc {}            -> (Nothing, Undefined)
+                          GetDataConLocSoA {}     -> (Nothing, Undefined)
+                          GetFieldLocSoA {}       -> (Nothing, Undefined)
+                    let lre = maybe locRegEnv (\r -> M.insert loc r locRegEnv) re
                     let loe = M.insert loc off locOffEnv
-                    (ex1', re', rt') <- calculateBoundsExp ddefs env2 varSzEnv varLocEnv lre loe regSzEnv regTyEnv ex1
+                    -- Nothing is known about these locations, writes to them
+                    -- could be in any region.
+                    let unknown = case locExp of
+                                    FreeLE              -> True
+                                    GenSoALoc{}         -> True
+                                    GetDataConLocSoA{}  -> True
+                                    GetFieldLocSoA{}    -> True
+                                    _                   -> False
+                    let regSzEnv' = if unknown
+                                    then L.foldr (\r acc -> M.insert r Undefined acc) regSzEnv (M.elems locRegEnv)
+                                    else regSzEnv
+                    (ex1', re', rt') <- calculateBoundsExp ddefs env2 varSzEnv varLocEnv lre loe regSzEnv' regTyEnv ex1
                     return (Ext $ LetLocE loc locExp ex1', re', rt')
               RetE _locs v -> do
                 (_, re, rt) <- go (VarE v)
@@ -208,11 +232,42 @@ calculateBoundsExp ddefs env2 varSzEnv varLocEnv locRegEnv locOffEnv regSzEnv re
               LetAvail vs e      -> do
                 (e', re', rt') <- go e
                 return (Ext $ LetAvail vs e', re', rt')
-              StartOfPkdCursor{}    -> error $ "todo: " ++ sdoc ex
-              TagCursor{}           -> error $ "todo: " ++ sdoc ex
-              AllocateTagHere{}     -> error $ "todo: " ++ sdoc ex
-              AllocateScalarsHere{} -> error $ "todo: " ++ sdoc ex
-              SSPush{}              -> error $ "todo: " ++ sdoc ex
-              SSPop{}               -> error $ "todo: " ++ sdoc ex
-              LetRegE {}            -> error "calculateBoundsExp: LetRegE not handled"
-              BoundsCheckVector {}  -> error "calculateBoundsExp: BoundsCheckVector not handled"
+              StartOfPkdCursor{}    -> pass
+              TagCursor{}           -> pass
+              AllocateTagHere{}     -> pass
+              AllocateScalarsHere{} -> pass
+              SSPush{}              -> pass
+              SSPop{}               -> pass
+              LetRegE reg rhs e     -> do
+                (e', re', rt') <- go e
+                return (Ext $ LetRegE reg rhs e', re', rt')
+              BoundsCheckVector {}  -> pass
+  where
+    offsetOf loc = M.findWithDefault Undefined loc locOffEnv
+
+    -- Make the chunk at least 32 bytes.
+    atLeastChunk sz = case sz of
+                        BoundedSize i -> BoundedSize (max i 32)
+                        Undefined     -> Undefined
+
+    -- Regions written by a call can't be sized statically.
+    unknownWrites f locs =
+      let outlocs = case M.lookup f (fEnv env2) of
+                      Just fty -> [ l | (l, LRM _ _ Output) <- zip locs (locVars fty) ]
+                      Nothing  -> locs
+      in L.foldr (\l acc -> maybe acc (\r -> M.insert r Undefined acc) (M.lookup l locRegEnv)) regSzEnv outlocs
+
+    -- Number of bytes a packed value occupies, if it's known.
+    valueSize bind =
+      case bind of
+        DataConE _ dcon args ->
+          let fieldSize (arg, fty) =
+                if isPackedTy fty
+                then case arg of
+                       VarE x -> M.findWithDefault Undefined x varSzEnv
+                       _      -> Undefined
+                else maybe Undefined BoundedSize (sizeOfTy fty)
+          in L.foldl' (<>) (BoundedSize 1) (map fieldSize (zip args (lookupDataCon ddefs dcon)))
+        Ext IndirectionE{} -> BoundedSize 9
+        VarE x -> M.findWithDefault Undefined x varSzEnv
+        _ -> Undefined
@@ -7,7 +7,8 @@
 -- | The final pass of the compiler: generate C code.
 
 module Gibbon.Passes.Codegen
-  ( codegenProg, harvestStructTys, makeName, rewriteReturns ) where
+  ( codegenProg, codegenUnits, CUnits(..), unitHeaderName
+  , harvestStructTys, makeName, rewriteReturns ) where
 
 import           Control.Monad
 import           Data.Bifunctor (first)
@@ -17,7 +18,7 @@ import qualified Data.Map as M
 import           Data.Maybe
 import qualified Data.List as L
 import qualified Data.Set as S
-import           Language.C.Quote.C (cdecl, cedecl, cexp, cfun, cparam, csdecl, cstm, cty)
+import           Language.C.Quote.C (cdecl, cedecl, cexp, cfun, cinit, cparam, csdecl, cstm, cty)
 import qualified Language.C.Quote.C as C
 import qualified Language.C.Syntax as C
 
@@ -31,6 +32,7 @@ import qualified Gibbon.Language as GL
 import           Gibbon.DynFlags
 import           Gibbon.L2.Syntax ( Multiplicity(..) )
 import           Gibbon.L4.Syntax
+import           Gibbon.Passes.Incremental ( callSCCs )
 
 --------------------------------------------------------------------------------
 
@@ -185,26 +187,156 @@ sortFns (Prog _ _ funs mtal) = foldl go S.empty allTails
         Goto{}         -> acc
         LetArenaT{bod} -> go acc bod
 
+-- | Datatypes that are read or written by the given file primitive.
+packedFileTyCons :: (Prim -> Maybe GL.TyCon) -> Prog -> S.Set GL.TyCon
+packedFileTyCons fileTyCon (Prog _ _ funs mtal) = foldl go S.empty allTails
+  where
+    allTails = (case mtal of
+                Just (PrintExp t) -> [t]
+                Nothing -> []) ++
+             map funBody funs
+
+    go acc tl =
+      case tl of
+        EndOfMain -> acc
+        RetValsT{} -> acc
+        AssnValsT _ mb_bod -> case mb_bod of
+                                Just bod -> go acc bod
+                                Nothing  -> acc
+        LetCallT{bod} -> go acc bod
+        LetPrimCallT{prim,bod} ->
+          case fileTyCon prim of
+            Just tyc -> go (S.insert tyc acc) bod
+            Nothing  -> go acc bod
+        LetTrivT{bod}   -> go acc bod
+        LetIfT{ife,bod} ->
+          let (_,a,b) = ife
+          in go (go (go acc a) b) bod
+        LetUnpackT{bod} -> go acc bod
+        LetAllocT{bod}  -> go acc bod
+        LetAvailT{bod}  -> go acc bod
+        IfT{con,els}    -> go (go acc con) els
+        ErrT{} -> acc
+        LetTimedT{timed,bod} -> go (go acc timed) bod
+        Switch _ _ alts mb_tl ->
+          let acc1 = case mb_tl of
+                       Nothing -> acc
+                       Just tl -> go acc tl
+          in case alts of
+               TagAlts ls -> foldr (\(_,b) ac -> go ac b) acc1 ls
+               IntAlts ls -> foldr (\(_,b) ac -> go ac b) acc1 ls
+        TailCall{}     -> acc
+        Goto{}         -> acc
+        LetArenaT{bod} -> go acc bod
+
 --------------------------------------------------------------------------------
 -- * C codegen
 
 -- | Compile a program to C code that has the side effect of the
 -- "gibbon_main" expression in that program.
 codegenProg :: Config -> Prog -> IO String
-codegenProg cfg prg@(Prog info_tbl sym_tbl funs mtal) =
-      return (hashIncludes ++ pretty 80 (stack (map ppr defs)))
+codegenProg cfg prg = return (fst (codegen cfg prg))
+
+-- | A program split into separately compiled translation units, for
+-- --incremental. Every unit includes 'unitHeaderName'.
+data CUnits = CUnits
+  { unitHeader :: String             -- ^ Structs, prototypes and the datatype enum.
+  , unitMain   :: String             -- ^ main, and the info and symbol tables.
+  , unitSCCs   :: [(String, String)] -- ^ One unit per strongly connected component of the
+                                     --   call graph, named after one of its functions.
+  }
+
+unitHeaderName :: FilePath
+unitHeaderName = "program.h"
+
+-- | Like 'codegenProg', but emit a unit per strongly connected component of
+-- the call graph. Every function is generated with a fresh gensym counter, so
+-- that its code doesn't depend on the functions generated before it.
+codegenUnits :: Config -> Prog -> IO CUnits
+codegenUnits cfg prg = return (snd (codegen cfg prg))
+
+codegen :: Config -> Prog -> (String, CUnits)
+codegen cfg prg@(Prog info_tbl sym_tbl funs mtal) =
+      (hashIncludes ++ renderDefs defs, units)
     where
+      renderDefs ds = pretty 80 (stack (map ppr ds))
+
       init_fun_env = foldr (\fn acc -> M.insert (funName fn) (map snd (funArgs fn), funRetTy fn) acc) M.empty funs
 
       sort_fns = sortFns prg
 
+      struct_decls = L.nub $ makeStructs $ uniqueDicts $ S.toList $ harvestStructTys prg
+
       defs = fst $ runPassM cfg 0 $ do
         (prots,funs') <- (unzip . concat) <$> mapM codegenFun funs
         main_expr' <- main_expr
-        let struct_tys = uniqueDicts $ S.toList $ harvestStructTys prg
-        return ((L.nub $ makeStructs struct_tys) ++ prots ++
+        return (struct_decls ++ prots ++
                 [gibTypesEnum, initInfoTable info_tbl, initSymTable sym_tbl] ++
-                funs' ++ [main_expr'])
+                layoutProfileDecls ++ packedFileProts ++ packedFileDefs ++ funs' ++ [main_expr'])
+
+      units =
+        let fun_defs = M.fromList [ (funName fd, fst (runPassM cfg 0 (codegenFun fd))) | fd <- funs ]
+            include = "#include \"" ++ unitHeaderName ++ "\"\n\n"
+            header = "#ifndef GIBBON_PROGRAM_H\n#define GIBBON_PROGRAM_H\n\n" ++ hashIncludes ++
+                     renderDefs (struct_decls ++ [ p | fd <- funs, (p,_) <- fun_defs M.! funName fd ] ++
+                             [gibTypesEnum] ++ layoutProfileExterns ++ packedFileProts) ++
+                     "\n\n#endif\n"
+            main_unit = include ++
+                        renderDefs ([initInfoTable info_tbl, initSymTable sym_tbl] ++ layoutProfileDefs ++
+                                packedFileDefs ++ [fst (runPassM cfg 0 main_expr)])
+            scc_unit fds = ( fromVar (funName (head fds))
+                           , include ++ renderDefs (concatMap (map snd . (fun_defs M.!) . funName) fds) )
+        in CUnits header main_unit (map scc_unit (callSCCs funs))
+
+      -- In packed mode, WritePackedFile streams values out with a
+      -- serializer generated from the info table, and ReadPackedFile can
+      -- pack S-expressions using a description of the datatypes. Both check
+      -- the layout of the datatype in the file header. The prototypes go in
+      -- the header and the definitions in the main unit.
+      (packedFileProts, packedFileDefs) =
+        genPackedFileLayouts info_tbl (packedFileTyCons isWrite prg `S.union` packedFileTyCons isRead prg) <>
+        if streamPackedFiles (dynflags cfg)
+        then genPackedFileWriters info_tbl (packedFileTyCons isWrite prg) <>
+             genSexpDatatypes info_tbl (packedFileTyCons isRead prg)
+        else ([], [])
+        where isWrite pr = case pr of
+                             WritePackedFile _ tyc -> Just tyc
+                             _ -> Nothing
+              isRead pr = case pr of
+                            ReadPackedFile _ tyc -> Just tyc
+                            _ -> Nothing
+
+      -- With --profile-layout, every function counts how often it's entered.
+      -- The counts are written out at exit and consumed by
+      -- Gibbon.Passes.ReorderFields. Under --parallel they are incremented
+      -- atomically.
+      profile_layout = gopt Opt_ProfileLayout (dynflags cfg) && not (null funs)
+      num_profiled = length funs
+      profile_idx = M.fromList (zip (map funName funs) [(0::Int)..])
+
+      layoutProfileDecls =
+        if profile_layout
+        then [ [cedecl| static typename uint64_t gib_layout_profile_counts[$int:num_profiled]; |]
+             , [cedecl| static const char *gib_layout_profile_names[$int:num_profiled] = { $inits:profile_names }; |]
+             ]
+        else []
+
+      -- Split into translation units, the counters are shared by all of them.
+      layoutProfileExterns =
+        if profile_layout
+        then [ [cedecl| extern typename uint64_t gib_layout_profile_counts[$int:num_profiled]; |]
+             , [cedecl| extern const char *gib_layout_profile_names[$int:num_profiled]; |]
+             ]
+        else []
+
+      layoutProfileDefs =
+        if profile_layout
+        then [ [cedecl| typename uint64_t gib_layout_profile_counts[$int:num_profiled]; |]
+             , [cedecl| const char *gib_layout_profile_names[$int:num_profiled] = { $inits:profile_names }; |]
+             ]
+        else []
+
+      profile_names = map (\fn -> [cinit| $string:(fromVar (funName fn)) |]) funs
 
       main_expr :: PassM C.Definition
       main_expr = do
@@ -219,7 +351,9 @@ codegenProg cfg prg@(Prog info_tbl sym_tbl funs mtal) =
         ret_exit <- gensym "exit"
         let init_gib = (if pointer then [ C.BlockStm [cstm| GC_INIT(); |] ] else []) ++
                        [ C.BlockDecl [cdecl| int $id:ret_init = gib_init(argc, argv); |] ]
-            exit_gib = [ C.BlockDecl [cdecl| int $id:ret_exit = gib_exit(); |]
+            exit_gib = [ C.BlockStm [cstm| gib_write_layout_profile($int:num_profiled, gib_layout_profile_names, gib_layout_profile_counts); |]
+                       | profile_layout ] ++
+                       [ C.BlockDecl [cdecl| int $id:ret_exit = gib_exit(); |]
                        , C.BlockStm [cstm| return $id:ret_exit; |]
                        ]
             init_info_table = [ C.BlockStm [cstm| info_table_initialize(); |] ]
@@ -240,7 +374,11 @@ codegenProg cfg prg@(Prog info_tbl sym_tbl funs mtal) =
                         then varAppend nam (toVar "_original")
                         else nam
              body <- codegenTail init_venv init_fun_env sort_fns tal ty []
-             let body' = (if gen_gc then ssDecls else []) ++ body
+             let count_entry = [ if gopt Opt_Parallel dflags
+                                 then C.BlockStm [cstm| __atomic_fetch_add(&gib_layout_profile_counts[$int:i], 1, __ATOMIC_RELAXED); |]
+                                 else C.BlockStm [cstm| gib_layout_profile_counts[$int:i]++; |]
+                               | profile_layout, Just i <- [M.lookup nam profile_idx] ]
+             let body' = (if gen_gc then ssDecls else []) ++ count_entry ++ body
              let fun = [cfun| $ty:retTy $id:nam' ($params:params) {
                               $items:body'
                               } |]
@@ -347,7 +485,7 @@ initSymTable sym_tbl =
           (\(k,v) -> case v of
                        -- Special symbols that get handled differently
                        "NEWLINE" -> C.BlockStm [cstm| gib_set_newline($k); |]
-                       "COMMA" -> C.BlockStm [cstm| set_comma($k); |]
+                       "COMMA" -> C.BlockStm [cstm| gib_set_comma($k); |]
                        "SPACE" -> C.BlockStm [cstm| gib_set_space($k); |]
                        "LEFTPAREN" -> C.BlockStm [cstm| gib_set_leftparen($k); |]
                        "RIGHTPAREN" -> C.BlockStm [cstm| gib_set_rightparen($k); |]
@@ -384,7 +522,7 @@ initInfoTable info_tbl =
 
     insert_dcon_info = M.foldrWithKey
                            (\tycon tyc_info acc ->
-                                M.foldrWithKey (\dcon (DataConInfo dcon_tag scalar_bytes num_shortcut num_scalars num_packed field_tys) acc2 ->
+                                M.foldrWithKey (\dcon (DataConInfo dcon_tag scalar_bytes num_shortcut num_scalars num_packed field_tys _) acc2 ->
                                                     if GL.isIndirectionTag dcon then acc2 else
                                                     let packed_field_tys = filter GL.isPackedTy field_tys
                                                         set_field_tys =
@@ -406,6 +544,235 @@ initInfoTable info_tbl =
                            info_tbl
 
 
+streamPackedFiles :: DynFlags -> Bool
+streamPackedFiles dflags = gopt Opt_Packed dflags && not (gopt Opt_Packed_SoA dflags)
+
+packedFileWriterName :: GL.TyCon -> String
+packedFileWriterName tycon = "_write_packed_file_" ++ tycon
+
+packedFileLayoutName :: GL.TyCon -> String
+packedFileLayoutName tycon = "gib_packed_file_layout_" ++ tycon
+
+-- | Describe how every datatype that's written to or read from a file is laid
+-- out in it: the tag and field types of each constructor that can occur in the
+-- file, for the datatype and every datatype reachable from it. The RTS stores
+-- a hash of the description in the file header, so a file is only read by a
+-- program that lays out the datatype the same way, e.g. with the same
+-- --layout-profile. Constructors with absolute random access nodes are
+-- written out as the plain constructors and are left out.
+genPackedFileLayouts :: InfoTable -> S.Set GL.TyCon -> ([C.Definition], [C.Definition])
+genPackedFileLayouts info_tbl roots = (map extern tycons, map layout tycons)
+  where
+    tycons = S.toList roots
+
+    extern tyc = [cedecl| extern const char $id:(packedFileLayoutName tyc)[]; |]
+
+    layout tyc = [cedecl| const char $id:(packedFileLayoutName tyc)[] = $string:(describe tyc); |]
+
+    describe tyc = tyc ++ ":" ++ concatMap describeTyCon (reachableTyCons info_tbl (S.singleton tyc))
+
+    describeTyCon tyc =
+      tyc ++ "{" ++
+      concat [ show dcon_tag ++ "(" ++ L.intercalate "," (map describeField field_tys) ++ ")"
+             | (dcon, DataConInfo{dcon_tag,field_tys}) <- M.toList (M.findWithDefault M.empty tyc info_tbl)
+             , not (GL.isAbsRANDataCon dcon) ] ++
+      "}"
+
+    describeField ty =
+      case ty of
+        GL.PackedTy tyc' _ -> tyc'
+        _ -> show ty
+
+-- | What a serializer does with one field of a constructor.
+data FieldWrite = CopyBytes Int   -- ^ Scalars, copied as they are.
+                | SkipBytes Int   -- ^ Absolute random access nodes.
+                | WritePacked GL.TyCon
+
+-- | A serializer for every datatype that's written to a file, and every
+-- datatype reachable from those. Each one takes a cursor to a value, writes
+-- it out and returns the cursor just past the value. Indirections are
+-- followed and written out in place, redirections to the next chunk are
+-- followed, and constructors with absolute random access nodes are written
+-- out as the plain constructors. Constructors with relative random access
+-- nodes are kept, with their size and offsets recomputed for the compacted
+-- value (see Note [Relative offsets] in AddRAN).
+-- The last packed field of a constructor is written in a loop if it has the
+-- same type, so that long spines don't use up the C stack.
+genPackedFileWriters :: InfoTable -> S.Set GL.TyCon -> ([C.Definition], [C.Definition])
+genPackedFileWriters info_tbl roots = (prots, map writer tycons)
+  where
+    tycons = reachableTyCons info_tbl roots
+
+    prots = [ [cedecl| typename GibCursor $id:(packedFileWriterName tyc)(typename GibPackedWriter *writer, typename GibCursor cur); |]
+            | tyc <- tycons ]
+
+    writer tyc =
+      let tyc_info = M.findWithDefault M.empty tyc info_tbl
+          fn_name = packedFileWriterName tyc
+          alts = [ genAlt tyc tyc_info dcon info | (dcon,info) <- M.toList tyc_info ]
+          unknown_tag = "Unknown tag in " ++ tyc ++ ": %d\n"
+          body = mkBlock $
+                   [ C.BlockStm [cstm| case GIB_INDIRECTION_TAG: {
+                                         $id:fn_name(writer, *(typename GibCursor *) (cur + 1));
+                                         return (cur + 1 + sizeof(typename GibCursor));
+                                       } |]
+                   , C.BlockStm [cstm| case GIB_REDIRECTION_TAG: {
+                                         cur = *(typename GibCursor *) (cur + 1);
+                                         continue;
+                                       } |]
+                   ] ++
+                   map C.BlockStm alts ++
+                   [ C.BlockStm [cstm| default: {
+                                         fprintf(stderr, $string:unknown_tag, tag);
+                                         exit(1);
+                                       } |] ]
+      in [cedecl| typename GibCursor $id:fn_name(typename GibPackedWriter *writer, typename GibCursor cur) {
+                    while (1) {
+                        typename GibPackedTag tag = *(typename GibPackedTag *) cur;
+                        switch (tag) $stm:body
+                    }
+                  } |]
+
+    genAlt :: GL.TyCon -> TyConInfo -> DataCon -> DataConInfo -> C.Stm
+    genAlt _ tyc_info dcon info | GL.isRelRANDataCon dcon = genRelAlt tyc_info dcon info
+    genAlt tyc tyc_info dcon DataConInfo{dcon_tag = tag,field_tys} =
+      let out_tag = if GL.isAbsRANDataCon dcon
+                    then dcon_tag (tyc_info M.! GL.fromRANDataCon dcon)
+                    else tag
+          writes = coalesce (map fieldWrite field_tys)
+          (init_writes, last_write) =
+            case reverse writes of
+              (WritePacked tyc' : rst) -> (reverse rst, Just tyc')
+              _ -> (writes, Nothing)
+          stms = [ C.BlockStm [cstm| gib_packed_writer_write_tag(writer, $int:out_tag); |]
+                 , C.BlockStm [cstm| cur += 1; |] ] ++
+                 concatMap doWrite init_writes ++
+                 (case last_write of
+                    Just tyc' | tyc' == tyc -> [ C.BlockStm [cstm| continue; |] ]
+                              | otherwise -> [ C.BlockStm [cstm| return $id:(packedFileWriterName tyc')(writer, cur); |] ]
+                    Nothing -> [ C.BlockStm [cstm| return cur; |] ])
+      in [cstm| case $int:tag: $stm:(mkBlock stms) |]
+
+    -- The fields of a K* node don't keep their sizes when they're compacted,
+    -- so its size and offsets are patched in once the fields they describe
+    -- have been written. The offsets point to every field after the first
+    -- packed one, and are measured from the end of the offset.
+    genRelAlt :: TyConInfo -> DataCon -> DataConInfo -> C.Stm
+    genRelAlt tyc_info dcon DataConInfo{dcon_tag = tag,field_tys} =
+      let DataConInfo{field_tys = orig_tys} = tyc_info M.! GL.fromRANDataCon dcon
+          num_offsets = length field_tys - 1 - length orig_tys
+          first_ran = length orig_tys - num_offsets
+          node = "rel_node" :: String
+          offsetAt j = 1 + 8 + 8 * j
+          patchOffset j =
+            C.BlockStm [cstm| gib_packed_writer_patch(writer, $id:node + $int:(offsetAt j),
+                                                      (typename GibInt) (writer->written - ($id:node + $int:(offsetAt j + 8)))); |]
+          fieldStms (i, ty) = [ patchOffset (i - first_ran) | i >= first_ran ] ++ doWrite (fieldWrite ty)
+          stms = [ C.BlockDecl [cdecl| typename uint64_t $id:node = writer->written; |]
+                 , C.BlockStm [cstm| gib_packed_writer_write_tag(writer, $int:tag); |]
+                 , C.BlockStm [cstm| cur += 1; |] ] ++
+                 doWrite (CopyBytes (8 * (1 + num_offsets))) ++
+                 concatMap fieldStms (zip [0..] orig_tys) ++
+                 [ C.BlockStm [cstm| gib_packed_writer_patch(writer, $id:node + 1, (typename GibInt) (writer->written - $id:node - 8)); |]
+                 , C.BlockStm [cstm| return cur; |] ]
+      in [cstm| case $int:tag: $stm:(mkBlock stms) |]
+
+    fieldWrite :: GL.UrTy () -> FieldWrite
+    fieldWrite ty =
+      case ty of
+        GL.PackedTy tyc' _ -> WritePacked tyc'
+        GL.CursorTy -> SkipBytes (fromJust (GL.sizeOfTy ty))
+        _ -> CopyBytes (fromJust (GL.sizeOfTy ty))
+
+    coalesce (CopyBytes a : CopyBytes b : rst) = coalesce (CopyBytes (a+b) : rst)
+    coalesce (SkipBytes a : SkipBytes b : rst) = coalesce (SkipBytes (a+b) : rst)
+    coalesce (x : rst) = x : coalesce rst
+    coalesce [] = []
+
+    doWrite w =
+      case w of
+        CopyBytes n -> [ C.BlockStm [cstm| gib_packed_writer_write(writer, cur, $int:n); |]
+                       , C.BlockStm [cstm| cur += $int:n; |] ]
+        SkipBytes n -> [ C.BlockStm [cstm| cur += $int:n; |] ]
+        WritePacked tyc' -> [ C.BlockStm [cstm| cur = $id:(packedFileWriterName tyc')(writer, cur); |] ]
+
+-- | The given datatypes and every datatype reachable from them.
+reachableTyCons :: InfoTable -> S.Set GL.TyCon -> [GL.TyCon]
+reachableTyCons info_tbl roots = S.toList (go S.empty (S.toList roots))
+  where
+    go acc [] = acc
+    go acc (tyc:rst)
+      | tyc `S.member` acc = go acc rst
+      | otherwise =
+          let tyc_info = M.findWithDefault M.empty tyc info_tbl
+              fields = [ tyc' | DataConInfo{field_tys} <- M.elems tyc_info
+                              , GL.PackedTy tyc' _ <- field_tys ]
+          in go (S.insert tyc acc) (fields ++ rst)
+
+-- | Describe the datatypes read with ReadPackedFile (and those reachable from
+-- them) for gib_read_sexp_file. Constructors with random access nodes are
+-- left out, the values it packs don't have any. Fields are listed in source
+-- order, the order they're written in, and constructors that --layout-profile
+-- reordered also get their layout. Returns the declaration of
+-- gib_sexp_datatypes and the definitions.
+genSexpDatatypes :: InfoTable -> S.Set GL.TyCon -> ([C.Definition], [C.Definition])
+genSexpDatatypes info_tbl roots
+  | S.null roots = ([], [])
+  | otherwise = ([datatypes_extern], concat field_arrs ++ layout_arrs ++ dcon_arrs ++ [datatypes_arr])
+  where
+    tycons = reachableTyCons info_tbl roots
+    tycon_idx = M.fromList (zip tycons [(0::Int)..])
+    num_datatypes = length tycons
+
+    dcons tyc = L.sortOn (dcon_tag . snd)
+                  [ (dcon,info) | (dcon,info) <- M.toList (M.findWithDefault M.empty tyc info_tbl)
+                                , not (GL.isAbsRANDataCon dcon || GL.isRelRANDataCon dcon) ]
+
+    fieldsName tyc tag = "gib_sexp_fields_" ++ tyc ++ "_" ++ show tag
+    layoutName tyc tag = "gib_sexp_layout_" ++ tyc ++ "_" ++ show tag
+    dconsName tyc = "gib_sexp_datacons_" ++ tyc
+
+    -- field_order has the source position of every field.
+    sourceFields DataConInfo{field_tys,field_order}
+      | null field_order = field_tys
+      | otherwise = map snd (L.sortOn fst (zip field_order field_tys))
+
+    field_arrs =
+      [ [ [cedecl| static const typename GibSexpField $id:(fieldsName tyc dcon_tag)[] = { $inits:(map fieldInit (sourceFields info)) }; |] ]
+      | tyc <- tycons, (_, info@DataConInfo{dcon_tag,field_tys}) <- dcons tyc, not (null field_tys) ]
+
+    layout_arrs =
+      [ [cedecl| static const typename uint32_t $id:(layoutName tyc dcon_tag)[] = { $inits:(map (\i -> [cinit| $int:i |]) field_order) }; |]
+      | tyc <- tycons, (_, DataConInfo{dcon_tag,field_order}) <- dcons tyc, not (null field_order) ]
+
+    dcon_arrs =
+      [ [cedecl| static const typename GibSexpDatacon $id:(dconsName tyc)[] = { $inits:(map (dconInit tyc) (dcons tyc)) }; |]
+      | tyc <- tycons ]
+
+    datatypes_arr =
+      let inits = [ [cinit| { $string:tyc, $int:(length (dcons tyc)), $id:(dconsName tyc) } |] | tyc <- tycons ]
+      in [cedecl| const typename GibSexpDatatype gib_sexp_datatypes[$int:num_datatypes] = { $inits:inits }; |]
+
+    datatypes_extern =
+      [cedecl| extern const typename GibSexpDatatype gib_sexp_datatypes[$int:num_datatypes]; |]
+
+    dconInit tyc (dcon, DataConInfo{dcon_tag,field_tys,field_order})
+      | null field_tys = [cinit| { $string:dcon, $int:dcon_tag, 0, NULL, NULL } |]
+      | null field_order = [cinit| { $string:dcon, $int:dcon_tag, $int:(length field_tys), $id:(fieldsName tyc dcon_tag), NULL } |]
+      | otherwise = [cinit| { $string:dcon, $int:dcon_tag, $int:(length field_tys), $id:(fieldsName tyc dcon_tag),
+                               $id:(layoutName tyc dcon_tag) } |]
+
+    fieldInit :: GL.UrTy () -> C.Initializer
+    fieldInit ty =
+      case ty of
+        GL.IntTy   -> [cinit| { GIB_SEXP_INT, 0 } |]
+        GL.FloatTy -> [cinit| { GIB_SEXP_FLOAT, 0 } |]
+        GL.BoolTy  -> [cinit| { GIB_SEXP_BOOL, 0 } |]
+        GL.CharTy  -> [cinit| { GIB_SEXP_CHAR, 0 } |]
+        GL.SymTy   -> [cinit| { GIB_SEXP_SYM, 0 } |]
+        GL.PackedTy tyc' _ -> [cinit| { GIB_SEXP_PACKED, $int:(tycon_idx M.! tyc') } |]
+        _ -> [cinit| { GIB_SEXP_UNSUPPORTED, 0 } |]
+
 makeStructs :: [[Ty]] -> [C.Definition]
 makeStructs [] = []
 makeStructs (ts : ts') =
@@ -550,7 +917,8 @@ codegenTail venv fenv sort_fns (IfT e0 e1 e2) ty sync_deps = do
     e2' <- codegenTail venv fenv sort_fns e2 ty sync_deps
     return $ [ C.BlockStm [cstm| if ($(codegenTriv venv e0)) { $items:e1' } else { $items:e2' } |] ]
 
-codegenTail _ _ _ (ErrT s) _ty _ = return $ [ C.BlockStm [cstm| printf("%s\n", $s); |]
+codegenTail _ _ _ (ErrT s) _ty _ = return $ [ C.BlockStm [cstm| gib_flush_stdout(); |]
+                                            , C.BlockStm [cstm| printf("%s\n", $s); |]
                                             , C.BlockStm [cstm| exit(1); |] ]
 
 
@@ -628,66 +996,55 @@ codegenTail venv fenv sort_fns (LetTimedT flg bnds rhs body) ty sync_deps =
                    | (vr0,ty0) <- bnds ]
        let rhs' = rewriteReturns rhs bnds
        rhs'' <- codegenTail venv fenv sort_fns rhs' ty sync_deps
-       itertime  <- gensym "itertime"
-       batchtime <- gensym "batchtime"
-       selftimed <- gensym "selftimed"
-       times <- gensym "times"
-       tmp <- gensym "tmp"
+       bench <- gensym "bench"
        let ident = case bnds of
                      ((v,_):_) -> v
                      _ -> (toVar "")
            begn  = "begin_" ++ (fromVar ident)
            end   = "end_" ++ (fromVar ident)
-           iters = "iters_"++ (fromVar ident)
-           vec_ty = codegenTy (VectorTy FloatTy)
 
-           timebod = [ C.BlockDecl [cdecl| $ty:vec_ty ($id:times) = gib_vector_alloc(gib_get_iters_param(), sizeof(double)); |]
-                     , C.BlockDecl [cdecl| struct timespec $id:begn; |]
+           timebod = [ C.BlockDecl [cdecl| struct timespec $id:begn; |]
                      , C.BlockDecl [cdecl| struct timespec $id:end; |] ] ++
 
                      (if flg
+                         -- The RTS decides how many iterations to run (see gib_bench_continue).
                          -- Save and restore EXCEPT on the last iteration.  This "cancels out" the effect of intermediate allocations.
-                      then (let body = [ C.BlockStm [cstm| if ( $id:iters != gib_get_iters_param()-1) {
+                      then (let body = [ C.BlockStm [cstm| if (! gib_bench_is_last(&$id:bench)) {
                                                          gib_list_bumpalloc_save_state();
                                                          gib_ptr_bumpalloc_save_state();
                                                          } |]
+                                       , C.BlockStm [cstm| gib_perf_counters_start(); |]
                                        , C.BlockStm [cstm| clock_gettime(CLOCK_MONOTONIC_RAW, & $id:begn );  |]
                                        ] ++
                                        rhs''++
                                        [ C.BlockStm [cstm| clock_gettime(CLOCK_MONOTONIC_RAW, &$(cid (toVar end))); |]
-                                       , C.BlockStm [cstm| if ( $id:iters != gib_get_iters_param()-1) {
+                                       , C.BlockStm [cstm| gib_perf_counters_stop(); |]
+                                       , C.BlockStm [cstm| if (! gib_bench_is_last(&$id:bench)) {
                                                          gib_list_bumpalloc_restore_state();
                                                          gib_ptr_bumpalloc_restore_state();
                                                          } |]
-                                       , C.BlockDecl [cdecl| double $id:itertime = gib_difftimespecs(&$(cid (toVar begn)), &$(cid (toVar end))); |]
-                                       , C.BlockStm [cstm| printf("itertime: %lf\n", $id:itertime); |]
-                                       , C.BlockStm [cstm| gib_vector_inplace_update($id:times, $id:iters, &($id:itertime)); |]
+                                       , C.BlockStm [cstm| gib_bench_record(&$id:bench, gib_difftimespecs(&$(cid (toVar begn)), &$(cid (toVar end)))); |]
                                        ]
-                            in [ C.BlockStm [cstm| for (long long $id:iters = 0; $id:iters < gib_get_iters_param(); $id:iters ++) { $items:body } |]
-                               , C.BlockStm [cstm| gib_vector_inplace_sort($id:times, gib_compare_doubles); |]
-                               , C.BlockDecl [cdecl| double *$id:tmp = (double*) gib_vector_nth($id:times, (gib_get_iters_param() / 2)); |]
-                               , C.BlockDecl [cdecl| double $id:selftimed = *($id:tmp); |]
-                               , C.BlockDecl [cdecl| double $id:batchtime = gib_sum_timing_array($id:times); |]
-                               , C.BlockStm [cstm| gib_print_timing_array($id:times); |]
-                               , C.BlockStm [cstm| gib_vector_free($id:times); |]
+                            in [ C.BlockDecl [cdecl| typename GibBench $id:bench; |]
+                               , C.BlockStm [cstm| gib_bench_init(&$id:bench, $string:(fromVar ident)); |]
+                               , C.BlockStm [cstm| while (gib_bench_continue(&$id:bench)) { $items:body } |]
                                ])
 
                          -- else
-                      else [ C.BlockStm [cstm| clock_gettime(CLOCK_MONOTONIC_RAW, & $id:begn );  |]
+                      else [ C.BlockStm [cstm| gib_perf_counters_start(); |]
+                           , C.BlockStm [cstm| clock_gettime(CLOCK_MONOTONIC_RAW, & $id:begn );  |]
                            , C.BlockStm [cstm| { $items:rhs'' } |]
                            , C.BlockStm [cstm| clock_gettime(CLOCK_MONOTONIC_RAW, &$(cid (toVar end))); |]
-                           , C.BlockDecl [cdecl| double $id:selftimed = gib_difftimespecs(&$(cid (toVar begn)), &$(cid (toVar end))); |]
-                           , C.BlockStm [cstm| gib_vector_free($id:times); |]
+                           , C.BlockStm [cstm| gib_perf_counters_stop(); |]
                            ])
            withPrnt = timebod ++
                       (if flg
-                       then [ C.BlockStm [cstm| printf("ITERS: %ld\n", gib_get_iters_param()); |]
+                       then [ C.BlockStm [cstm| gib_bench_report(&$id:bench); |] ]
+                       else [ C.BlockStm [cstm| gib_flush_stdout(); |]
                             , C.BlockStm [cstm| printf("SIZE: %ld\n", gib_get_size_param()); |]
-                            , C.BlockStm [cstm| printf("BATCHTIME: %e\n", $id:batchtime); |]
-                            , C.BlockStm [cstm| printf("SELFTIMED: %e\n", $id:selftimed); |]
-                            ]
-                       else [ C.BlockStm [cstm| printf("SIZE: %ld\n", gib_get_size_param()); |]
-                            , C.BlockStm [cstm| printf("SELFTIMED: %e\n", gib_difftimespecs(&$(cid (toVar begn)), &$(cid (toVar end)))); |] ])
+                            , C.BlockStm [cstm| printf("SELFTIMED: %e\n", gib_difftimespecs(&$(cid (toVar begn)), &$(cid (toVar end)))); |]
+                            , C.BlockStm [cstm| gib_perf_counters_print(); |]
+                            , C.BlockStm [cstm| gib_print_max_rss(); |] ])
        let venv' = (M.fromList bnds) `M.union` venv
        tal <- codegenTail venv' fenv sort_fns body ty sync_deps
        return $ decls ++ withPrnt ++ tal
@@ -781,6 +1138,7 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
        let isPacked = gopt Opt_Packed dflags
            noGC = gopt Opt_DisableGC dflags
            genGC = gopt Opt_GenGc dflags
+           prefetch = gopt Opt_Prefetch dflags
 
        pre <- case prm of
                  AddP -> let [(outV,outT)] = bnds
@@ -802,10 +1160,9 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
                              [pleft,pright] = rnds in pure
                          [ C.BlockDecl [cdecl| $ty:(codegenTy outT) $id:outV = gib_expll($(codegenTriv venv pleft), $(codegenTriv venv pright)); |]]
                  RandP -> let [(outV,outT)] = bnds in pure
-                          [ C.BlockDecl [cdecl| $ty:(codegenTy outT) $id:outV = rand(); |]]
-                 FRandP-> let [(outV,outT)] = bnds
-                              fty = codegenTy FloatTy in pure
-                          [ C.BlockDecl [cdecl| $ty:(codegenTy outT) $id:outV = ($ty:fty) rand() / ($ty:fty) (RAND_MAX); |]]
+                          [ C.BlockDecl [cdecl| $ty:(codegenTy outT) $id:outV = gib_rand(); |]]
+                 FRandP-> let [(outV,outT)] = bnds in pure
+                          [ C.BlockDecl [cdecl| $ty:(codegenTy outT) $id:outV = gib_frand(); |]]
                  FSqrtP -> let [(outV,outT)] = bnds
                                [arg] = rnds in pure
                            [ C.BlockDecl [cdecl| $ty:(codegenTy outT) $id:outV = sqrt($(codegenTriv venv arg)) ; |]]
@@ -994,12 +1351,15 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
                                    [(VarTriv cur)] = rnds
                                    tagged_t = [cty| typename uintptr_t |]
                                    tag_t = [cty| typename uint16_t |]
-                               pure
+                               pure $
                                  [ C.BlockDecl [cdecl| $ty:tagged_t $id:tagged = *($ty:tagged_t *) ($id:cur); |]
                                  , C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) $id:next = GIB_UNTAG($id:tagged); |]
                                  , C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) $id:afternext = ($id:cur) + 8; |]
                                  , C.BlockDecl [cdecl| $ty:tag_t $id:tag = GIB_GET_TAG($id:tagged); |]
-                                 ]
+                                 ] ++
+                                 -- The pointee is an indirection/redirection target or the
+                                 -- end of a skipped field; start fetching it right away.
+                                 [ C.BlockStm [cstm| gib_prefetch($id:next); |] | prefetch ]
 
                  WriteTaggedCursor ->
                                 let [(outV,CursorTy)] = bnds
@@ -1010,9 +1370,10 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
 
                  ReadCursor -> let [(next,CursorTy),(afternext,CursorTy)] = bnds
                                    [(VarTriv cur)] = rnds in pure
-                               [ C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) $id:next = *($ty:(codegenTy CursorTy) *) ($id:cur); |]
-                               , C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) $id:afternext = ($id:cur) + 8; |]
-                               ]
+                               ([ C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) $id:next = *($ty:(codegenTy CursorTy) *) ($id:cur); |]
+                                , C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) $id:afternext = ($id:cur) + 8; |]
+                                ] ++
+                                [ C.BlockStm [cstm| gib_prefetch($id:next); |] | prefetch ])
 
                  WriteCursor -> let [(outV,CursorTy)] = bnds
                                     [val,(VarTriv cur)] = rnds in pure
@@ -1107,29 +1468,29 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
                  PrintInt ->
                      let [arg] = rnds in
                      case bnds of
-                       [(outV,ty)] -> pure [ C.BlockDecl [cdecl| $ty:(codegenTy ty) $id:outV = printf("%ld", $(codegenTriv venv arg)); |] ]
-                       [] -> pure [ C.BlockStm [cstm| printf("%ld", $(codegenTriv venv arg)); |] ]
+                       [(outV,ty)] -> pure [ C.BlockDecl [cdecl| $ty:(codegenTy ty) $id:outV = gib_print_int($(codegenTriv venv arg)); |] ]
+                       [] -> pure [ C.BlockStm [cstm| gib_print_int($(codegenTriv venv arg)); |] ]
                        _ -> error $ "wrong number of return bindings from PrintInt: "++show bnds
 
                  PrintChar ->
                      let [arg] = rnds in
                      case bnds of
-                       [(outV,ty)] -> pure [ C.BlockDecl [cdecl| $ty:(codegenTy ty) $id:outV = printf("%c", $(codegenTriv venv arg)); |] ]
-                       [] -> pure [ C.BlockStm [cstm| printf("%c", $(codegenTriv venv arg)); |] ]
+                       [(outV,ty)] -> pure [ C.BlockDecl [cdecl| $ty:(codegenTy ty) $id:outV = gib_print_char($(codegenTriv venv arg)); |] ]
+                       [] -> pure [ C.BlockStm [cstm| gib_print_char($(codegenTriv venv arg)); |] ]
                        _ -> error $ "wrong number of return bindings from PrintInt: "++show bnds
 
                  PrintFloat ->
                      let [arg] = rnds in
                      case bnds of
-                       [(outV,ty)] -> pure [ C.BlockDecl [cdecl| $ty:(codegenTy ty) $id:outV = printf("%.2f", $(codegenTriv venv arg)); |] ]
-                       [] -> pure [ C.BlockStm [cstm| printf("%.2f", $(codegenTriv venv arg)); |] ]
+                       [(outV,ty)] -> pure [ C.BlockDecl [cdecl| $ty:(codegenTy ty) $id:outV = gib_print_float($(codegenTriv venv arg)); |] ]
+                       [] -> pure [ C.BlockStm [cstm| gib_print_float($(codegenTriv venv arg)); |] ]
                        _ -> error $ "wrong number of return bindings from PrintInt: "++show bnds
 
                  PrintBool ->
                      let [arg] = rnds in
                      case bnds of
-                       [(outV,ty)] -> pure [ C.BlockDecl [cdecl| $ty:(codegenTy ty) $id:outV = printf("%d", $(codegenTriv venv arg)); |] ]
-                       [] -> pure [ C.BlockStm [cstm| printf("%d", $(codegenTriv venv arg)); |] ]
+                       [(outV,ty)] -> pure [ C.BlockDecl [cdecl| $ty:(codegenTy ty) $id:outV = gib_print_bool($(codegenTriv venv arg)); |] ]
+                       [] -> pure [ C.BlockStm [cstm| gib_print_bool($(codegenTriv venv arg)); |] ]
                        _ -> error $ "wrong number of return bindings from PrintInt: "++show bnds
 
                  PrintSym ->
@@ -1140,10 +1501,18 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
                        _ -> error $ "wrong number of return bindings from PrintSym: "++show bnds
 
                  PrintString str
-                     | [] <- bnds, [] <- rnds -> pure [ C.BlockStm [cstm| printf( $string:str ); |] ]
+                     | [] <- bnds, [] <- rnds -> pure [ C.BlockStm [cstm| gib_print_string($string:str); |] ]
                      | otherwise -> error$ "wrong number of args/return values expected from PrintString prim: "++show (rnds,bnds)
 
                  WritePackedFile fp tyc
+                    | [inV] <- rnds, streamPackedFiles dflags -> do
+                        out_hdl <- gensym "out_hdl"
+                        pure [ C.BlockDecl [cdecl| typename GibPackedWriter *$id:out_hdl = gib_packed_writer_open($string:fp, $id:(packedFileLayoutName tyc)); |]
+                             , C.BlockStm [cstm| $id:(packedFileWriterName tyc)($id:out_hdl, $(codegenTriv venv inV)); |]
+                             , C.BlockStm [cstm| gib_packed_writer_close($id:out_hdl); |]
+                             , C.BlockStm [cstm| gib_flush_stdout(); |]
+                             , C.BlockStm [cstm| printf("Wrote: %s\n", $string:fp); |]
+                             ]
                     | [inV] <- rnds -> do
                         -- Inputs to the copy function.
                         outreg <- gensym "outreg"
@@ -1159,10 +1528,8 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
                         let rnds2 = [VarTriv end_inreg, VarTriv end_outreg, VarTriv start_outreg, inV]
                             bnds2 = [(end_outreg2,CursorTy),(end_inreg2,CursorTy),(copy_start,CursorTy),(copy_end,CursorTy)]
                         call_copyfn <- codegenTail venv fenv sort_fns (LetCallT False bnds2 (GL.mkCopySansPtrsFunName tyc) rnds2 (AssnValsT [] Nothing)) (ProdTy []) sync_deps
-                        let tyfile = [cty| typename FILE |]
-                            tysize = [cty| typename size_t |]
+                        let tysize = [cty| typename size_t |]
                         out_hdl <- gensym "out_hdl"
-                        wrote <- gensym "wrote"
                         pure $
                            (if genGC
                             then [ C.BlockDecl [cdecl| $ty:(codegenTy RegionTy) $id:outreg = gib_alloc_region_on_heap(gib_get_biginf_init_chunk_size()); |] ]
@@ -1177,12 +1544,11 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
                                  -- Sticking with the hacky and less invasive approach for now.
                                , C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) $id:end_inreg = NULL; |]
                                ] ++ call_copyfn ++
-                               [ C.BlockDecl [cdecl| $ty:tyfile *$id:out_hdl = fopen($string:fp, "wb"); |]
-                               -- , _todo
-                               -- , _todo
+                               [ C.BlockDecl [cdecl| typename GibPackedWriter *$id:out_hdl = gib_packed_writer_open($string:fp, $id:(packedFileLayoutName tyc)); |]
                                , C.BlockDecl [cdecl| $ty:tysize $id:copy_size = ($ty:(codegenTy IntTy)) ($id:copy_end - $id:copy_start); |]
-                               , C.BlockDecl [cdecl| $ty:tysize $id:wrote = fwrite($id:copy_start, $id:copy_size, 1, $id:out_hdl); |]
-                               , C.BlockStm [cstm| fclose($id:out_hdl); |]
+                               , C.BlockStm [cstm| gib_packed_writer_write($id:out_hdl, $id:copy_start, $id:copy_size); |]
+                               , C.BlockStm [cstm| gib_packed_writer_close($id:out_hdl); |]
+                               , C.BlockStm [cstm| gib_flush_stdout(); |]
                                , C.BlockStm [cstm| printf("Wrote: %s\n", $string:fp); |]
                                , C.BlockStm [cstm| gib_free_region($id:end_outreg); |]
                                , C.BlockStm [cstm| free($id:outreg); |]
@@ -1201,18 +1567,20 @@ codegenTail venv fenv sort_fns (LetPrimCallT bnds prm rnds body) ty sync_deps =
 
                                  mmap_size = varAppend outV "_size"
 
+                                 -- Checks the header written by WritePackedFile, if there is one.
+                                 -- In packed mode, S-expressions are packed as they're read.
+                                 read_packed = [cexp| gib_read_packed_file(packed_file, $string:tyc, $id:(packedFileLayoutName tyc), &$id:mmap_size) |]
+                                 read_sexp = [cexp| gib_read_sexp_file(packed_file, gib_sexp_datatypes, sizeof(gib_sexp_datatypes) / sizeof(gib_sexp_datatypes[0]), $string:tyc, &$id:mmap_size) |]
                                  mmapCode =
-                                  [ C.BlockDecl[cdecl| int fd = open( $filename, O_RDONLY); |]
-                                  , C.BlockStm[cstm| { if(fd == -1) { fprintf(stderr,"fopen failed\n"); abort(); }} |]
-                                  , C.BlockDecl[cdecl| struct stat st; |]
-                                  , C.BlockStm  [cstm| fstat(fd, &st); |]
-                                  , C.BlockDecl [cdecl| $ty:(codegenTy IntTy) $id:mmap_size = st.st_size;|]
-                                  , C.BlockDecl[cdecl| $ty:(codegenTy CursorTy) ptr = ($ty:(codegenTy CursorTy)) mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0); |]
-                                  , C.BlockStm[cstm| { if(ptr==MAP_FAILED) { fprintf(stderr,"mmap failed\n"); abort(); }} |]
+                                  [ C.BlockDecl [cdecl| $ty:(codegenTy IntTy) $id:mmap_size; |]
+                                  , C.BlockDecl [cdecl| char *packed_file = $filename; |]
+                                  , if streamPackedFiles dflags
+                                    then C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) ptr = gib_is_sexp_file(packed_file) ? $exp:read_sexp : $exp:read_packed; |]
+                                    else C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) ptr = $exp:read_packed; |]
                                   ]
                              docall <- if isPacked
                                        -- In packed mode we eagerly FORCE the IO to happen before we start benchmarking:
-                                       then pure [ C.BlockStm [cstm| { int sum=0; for(int i=0; i < st.st_size; i++) sum += ptr[i]; } |]
+                                       then pure [ C.BlockStm [cstm| { int sum=0; for(int i=0; i < $id:mmap_size; i++) sum += ptr[i]; } |]
                                                  , C.BlockDecl [cdecl| $ty:(codegenTy CursorTy) $id:outV = ptr; |]]
                                        else codegenTail venv fenv sort_fns unpackcall voidTy sync_deps
                              return $ mmapCode ++ docall
@@ -1659,7 +2027,7 @@ codegenTy ChunkTy = [cty|typename GibChunk|]
 codegenTy (ProdTy []) = [cty|unsigned char|]
 codegenTy (ProdTy ts) = C.Type (C.DeclSpec [] [] (C.Tnamed (C.Id nam noLoc) [] noLoc) noLoc) (C.DeclRoot noLoc) noLoc
     where nam = makeName ts
-codegenTy (SymDictTy _ _t) = [cty|typename GibSymDict|]
+codegenTy (SymDictTy _ _t) = [cty|typename GibSymDict* |]
 codegenTy SymSetTy = [cty|typename GibSymSet*|]
 codegenTy SymHashTy = [cty|typename GibSymHash*|]
 codegenTy IntHashTy = [cty|typename GibIntHash*|]
@@ -120,7 +120,7 @@ cursorize :: Prog2 -> PassM Prog3
 cursorize Prog{ddefs,fundefs,mainExp} = do
   dflags <- getDynFlags
   let useSoA = gopt Opt_Packed_SoA dflags
-  fns' <- mapM (cursorizeFunDef useSoA ddefs fundefs . snd) (M.toList fundefs)
+  fns' <- parMapM (cursorizeFunDef useSoA ddefs fundefs . snd) (M.toList fundefs)
   let fundefs' = M.fromList $ L.map (\f -> (funName f, f)) fns'
       ddefs'   = M.map eraseLocMarkers ddefs
 
@@ -1,4 +1,4 @@
-module Gibbon.Passes.HoistBoundsCheck (hoistBoundsCheckProg, hoistBoundsCheck) where
+module Gibbon.Passes.HoistBoundsCheck (hoistBoundsCheckProg, hoistBoundsCheck, dropStaticBoundsChecksProg) where
 
 import Data.Foldable (foldlM)
 import qualified Data.Map as M
@@ -344,3 +344,43 @@ hoistBoundsCheck inexp benv = do
   (exp', m) <- collectBoundsCheckExprs [] benv inexp
   (exp'', _) <- hoistBoundsCheckHelper S.empty m exp'
   pure exp''
+
+---------------------------------------------------------------------------
+-- Drop the bounds checks that can never fail
+
+-- | Regions with a 'BoundedSize' are allocated with room for everything that's
+-- written to them (see CalculateBounds), so checks against their end are
+-- redundant.
+dropStaticBoundsChecksProg :: NewL2.Prog2 -> PassM NewL2.Prog2
+dropStaticBoundsChecksProg prg@Prog {fundefs, mainExp} = do
+  let fundefs' = M.map (\f@FunDef {funBody} -> f {funBody = dropStaticBoundsChecks S.empty funBody}) fundefs
+      mainExp' = fmap (\(mn, ty) -> (dropStaticBoundsChecks S.empty mn, ty)) mainExp
+  return $ prg {fundefs = fundefs', mainExp = mainExp'}
+
+dropStaticBoundsChecks :: S.Set RegVar -> NewL2.Exp2 -> NewL2.Exp2
+dropStaticBoundsChecks sized ex =
+  case ex of
+    LetE (_, _, _, Ext (BoundsCheck _ (EndOfReg r _ _) _)) bod
+      | S.member r sized -> go bod
+    LetE (v, locs, ty, rhs) bod -> LetE (v, locs, ty, go rhs) (go bod)
+    IfE a b c -> IfE (go a) (go b) (go c)
+    CaseE scrt mp -> CaseE scrt (map (\(c, args, ae) -> (c, args, go ae)) mp)
+    MkProdE ls -> MkProdE (map go ls)
+    ProjE i e -> ProjE i (go e)
+    TimeIt e ty b -> TimeIt (go e) ty b
+    WithArenaE v e -> WithArenaE v (go e)
+    Ext ext ->
+      case ext of
+        LetRegionE r sz ty bod -> Ext $ LetRegionE r sz ty (dropStaticBoundsChecks (withSized r sz) bod)
+        LetParRegionE r sz ty bod -> Ext $ LetParRegionE r sz ty (dropStaticBoundsChecks (withSized r sz) bod)
+        LetLocE loc rhs bod -> Ext $ LetLocE loc rhs (go bod)
+        LetRegE reg rhs bod -> Ext $ LetRegE reg rhs (go bod)
+        LetAvail vs bod -> Ext $ LetAvail vs (go bod)
+        _ -> ex
+    _ -> ex
+  where
+    go = dropStaticBoundsChecks sized
+
+    -- A 'BoundedSize' of 0 means that nothing useful was inferred.
+    withSized r (BoundedSize n) | n > 0 = S.insert (regionToVar r) sized
+    withSized _ _ = sized
@@ -0,0 +1,238 @@
+{-# OPTIONS_GHC -fno-warn-name-shadowing #-}
+
+-- | Support for --incremental builds.
+--
+-- Almost every pass looks at the whole program (location inference,
+-- specialization, inlining, ...), so the output of a pass for one function
+-- can't be reused soundly once some other function has changed. Two things
+-- are cached instead:
+--
+--   * The generated C, keyed by the parsed program, the configuration and the
+--     compiler binary. Rebuilding an unchanged program skips the pipeline.
+--
+--   * Object files, keyed by the text of a translation unit and the C
+--     compiler command. Codegen emits one unit for every strongly connected
+--     component of the call graph, and 'canonicalizeNames' makes the local
+--     names of a function independent of the gensym counter, i.e. of every
+--     other function. Editing the body of one function only recompiles the
+--     units whose text actually changed, usually just its own.
+--
+-- Entries are touched whenever they are reused, and 'trimCache' evicts the
+-- least recently used ones once the cache outgrows $GIBBON_CACHE_SIZE.
+module Gibbon.Passes.Incremental
+  ( canonicalizeNames, callSCCs, hashString, getCacheDir, touchCacheEntry, trimCache ) where
+
+import           Control.Monad ( filterM, forM )
+import           Data.Bits ( xor )
+import           Data.Char ( isDigit, ord )
+import qualified Data.Graph as G
+import qualified Data.List as L
+import qualified Data.Map as M
+import           Data.Maybe ( fromMaybe )
+import qualified Data.Set as S
+import           Data.Time.Clock ( getCurrentTime )
+import           Data.Word ( Word64 )
+import           System.Directory
+import           System.Environment ( lookupEnv )
+import           System.FilePath ( (</>), takeExtension )
+import           Text.Printf ( printf )
+import           Text.Read ( readMaybe )
+
+import           Gibbon.Common
+import           Gibbon.L4.Syntax
+
+--------------------------------------------------------------------------------
+
+-- | Rename the variables and labels bound in every function, and in the main
+-- expression, to names numbered from zero in the order they are bound.
+-- A gensym'd x_1234 becomes x__0, x__1, ...
+canonicalizeNames :: Prog -> Prog
+canonicalizeNames (Prog info_tbl sym_tbl funs mtal) =
+  Prog info_tbl sym_tbl (map canonFun funs) (canonMain <$> mtal)
+  where
+    canonFun fn@FunDecl{funArgs,funBody} =
+      let env = canonEnv (map fst funArgs ++ binders funBody)
+      in fn { funArgs = [ (M.findWithDefault v v env, ty) | (v,ty) <- funArgs ]
+            , funBody = renameTail env funBody }
+
+    canonMain (PrintExp tl) = PrintExp (renameTail (canonEnv (binders tl)) tl)
+
+canonEnv :: [Var] -> M.Map Var Var
+canonEnv = snd . L.foldl' step (0 :: Int, M.empty)
+  where
+    step (i,env) v
+      | M.member v env = (i,env)
+      | otherwise      = (i+1, M.insert v (toVar (stem (fromVar v) ++ "__" ++ show i)) env)
+
+    -- Drop the gensym suffix, but keep the name readable.
+    stem s = case span isDigit (reverse s) of
+               (_:_, '_':rest@(_:_)) -> reverse rest
+               _ -> s
+
+-- | Every variable and label bound in a tail, in order.
+binders :: Tail -> [Var]
+binders tl =
+  case tl of
+    RetValsT{}  -> []
+    EndOfMain   -> []
+    AssnValsT upd mb_bod -> [ v | (v,_,_) <- upd ] ++ maybe [] binders mb_bod
+    LetCallT{binds,bod}     -> map fst binds ++ binders bod
+    LetPrimCallT{binds,bod} -> map fst binds ++ binders bod
+    LetTrivT (v,_,_) bod    -> v : binders bod
+    LetIfT binds (_,a,b) bod -> map fst binds ++ binders a ++ binders b ++ binders bod
+    LetUnpackT{binds,bod}   -> map fst binds ++ binders bod
+    LetAllocT{lhs,bod}      -> lhs : binders bod
+    LetAvailT{bod}          -> binders bod
+    IfT _ a b   -> binders a ++ binders b
+    ErrT{}      -> []
+    LetTimedT{binds,timed,bod} -> map fst binds ++ binders timed ++ binders bod
+    Switch lbl _ alts mb_tl -> lbl : concatMap binders (altTails alts) ++ maybe [] binders mb_tl
+    TailCall{}  -> []
+    Goto{}      -> []
+    LetArenaT{lhs,bod} -> lhs : binders bod
+
+renameTail :: M.Map Var Var -> Tail -> Tail
+renameTail env = go
+  where
+    r v = M.findWithDefault v v env
+
+    rt trv = case trv of
+               VarTriv v     -> VarTriv (r v)
+               ProdTriv ts   -> ProdTriv (map rt ts)
+               ProjTriv i t  -> ProjTriv i (rt t)
+               _             -> trv
+
+    rb = map (\(v,ty) -> (r v, ty))
+
+    rp pr = case pr of
+              MMapFileSize v -> MMapFileSize (r v)
+              _ -> pr
+
+    go tl =
+      case tl of
+        RetValsT ts -> RetValsT (map rt ts)
+        EndOfMain   -> tl
+        AssnValsT upd mb_bod -> AssnValsT [ (r v, ty, rt t) | (v,ty,t) <- upd ] (go <$> mb_bod)
+        LetCallT async binds rator rands bod -> LetCallT async (rb binds) (r rator) (map rt rands) (go bod)
+        LetPrimCallT binds prim rands bod    -> LetPrimCallT (rb binds) (rp prim) (map rt rands) (go bod)
+        LetTrivT (v,ty,t) bod     -> LetTrivT (r v, ty, rt t) (go bod)
+        LetIfT binds (t,a,b) bod  -> LetIfT (rb binds) (rt t, go a, go b) (go bod)
+        LetUnpackT binds ptr bod  -> LetUnpackT (rb binds) (r ptr) (go bod)
+        LetAllocT lhs vals bod    -> LetAllocT (r lhs) [ (ty, rt t) | (ty,t) <- vals ] (go bod)
+        LetAvailT vars bod        -> LetAvailT (map r vars) (go bod)
+        IfT tst con els           -> IfT (rt tst) (go con) (go els)
+        ErrT{}                    -> tl
+        LetTimedT isIter binds timed bod -> LetTimedT isIter (rb binds) (go timed) (go bod)
+        Switch lbl trv alts mb_tl -> Switch (r lbl) (rt trv) (goAlts alts) (go <$> mb_tl)
+        TailCall f ts             -> TailCall (r f) (map rt ts)
+        Goto lbl                  -> Goto (r lbl)
+        LetArenaT lhs bod         -> LetArenaT (r lhs) (go bod)
+
+    goAlts (TagAlts ls) = TagAlts [ (tg, go tl) | (tg,tl) <- ls ]
+    goAlts (IntAlts ls) = IntAlts [ (n, go tl) | (n,tl) <- ls ]
+
+altTails :: Alts -> [Tail]
+altTails (TagAlts ls) = map snd ls
+altTails (IntAlts ls) = map snd ls
+
+--------------------------------------------------------------------------------
+
+-- | Strongly connected components of the call graph, callees first. Besides
+-- calls, a function referenced as a value (e.g. the comparison passed to a
+-- sort) counts as an edge.
+callSCCs :: [FunDecl] -> [[FunDecl]]
+callSCCs funs =
+  map G.flattenSCC $ G.stronglyConnComp
+    [ (fn, funName fn, S.toList (S.intersection names (refs (funBody fn)))) | fn <- funs ]
+  where
+    names = S.fromList (map funName funs)
+
+    refs :: Tail -> S.Set Var
+    refs tl =
+      case tl of
+        RetValsT ts -> trivs ts
+        EndOfMain   -> S.empty
+        AssnValsT upd mb_bod -> trivs [ t | (_,_,t) <- upd ] <> maybe S.empty refs mb_bod
+        LetCallT{rator,rands,bod} -> S.insert rator (trivs rands) <> refs bod
+        LetPrimCallT{rands,bod}   -> trivs rands <> refs bod
+        LetTrivT (_,_,t) bod      -> trivs [t] <> refs bod
+        LetIfT _ (t,a,b) bod      -> trivs [t] <> refs a <> refs b <> refs bod
+        LetUnpackT{bod}           -> refs bod
+        LetAllocT{vals,bod}       -> trivs (map snd vals) <> refs bod
+        LetAvailT{bod}            -> refs bod
+        IfT tst con els           -> trivs [tst] <> refs con <> refs els
+        ErrT{}                    -> S.empty
+        LetTimedT{timed,bod}      -> refs timed <> refs bod
+        Switch _ trv alts mb_tl   -> trivs [trv] <> S.unions (map refs (altTails alts)) <> maybe S.empty refs mb_tl
+        TailCall f ts             -> S.insert f (trivs ts)
+        Goto{}                    -> S.empty
+        LetArenaT{bod}            -> refs bod
+
+    trivs :: [Triv] -> S.Set Var
+    trivs = S.unions . map triv
+
+    triv trv = case trv of
+                 VarTriv v    -> S.singleton v
+                 ProdTriv ts  -> trivs ts
+                 ProjTriv _ t -> triv t
+                 _            -> S.empty
+
+--------------------------------------------------------------------------------
+
+-- | 64-bit FNV-1a, in hex. Only used to name cache entries, so it has to be
+-- stable across runs, not cryptographically strong.
+hashString :: String -> String
+hashString = printf "%016x" . L.foldl' step (0xcbf29ce484222325 :: Word64)
+  where step h c = (h `xor` fromIntegral (ord c)) * 0x100000001b3
+
+-- | $GIBBON_CACHE_DIR, or ~/.cache/gibbon.
+getCacheDir :: IO FilePath
+getCacheDir = do
+  env <- lookupEnv "GIBBON_CACHE_DIR"
+  dir <- maybe (getXdgDirectory XdgCache "gibbon") pure env
+  createDirectoryIfMissing True dir
+  pure dir
+
+-- | Mark a cache entry (a file or a directory) as recently used.
+touchCacheEntry :: FilePath -> IO ()
+touchCacheEntry path = getCurrentTime >>= setModificationTime path
+
+-- | Evict the least recently used entries until the cache is no larger than
+-- $GIBBON_CACHE_SIZE megabytes (default 1024). An entry is a directory of
+-- generated C under c/, or an object file under o/. The given entries, the
+-- ones the current build uses, are never evicted.
+trimCache :: FilePath -> [FilePath] -> IO ()
+trimCache cache_dir keep = do
+  limit_mb <- fromMaybe defaultCacheSizeMB . (>>= readMaybe) <$> lookupEnv "GIBBON_CACHE_SIZE"
+  c_entries <- listEntries (cache_dir </> "c")
+  o_entries <- listEntries (cache_dir </> "o")
+  -- .tmp objects are still being written by some other build.
+  let evictable path = path `notElem` keep && takeExtension path /= ".tmp"
+  entries <- forM (filter evictable (c_entries ++ o_entries)) $ \path -> do
+               size  <- entrySize path
+               mtime <- getModificationTime path
+               pure (mtime, path, size)
+  kept <- mapM entrySize =<< filterM doesPathExist keep
+  let limit = limit_mb * 1024 * 1024
+      total = sum kept + sum [ size | (_,_,size) <- entries ]
+      evict _ [] = pure ()
+      evict sz ((_,path,size):rst)
+        | sz <= limit = pure ()
+        | otherwise = removePathForcibly path >> evict (sz - size) rst
+  evict total (L.sortOn (\(mtime,_,_) -> mtime) entries)
+  where
+    defaultCacheSizeMB :: Integer
+    defaultCacheSizeMB = 1024
+
+    listEntries dir = do
+      exists <- doesDirectoryExist dir
+      if exists
+      then map (dir </>) <$> listDirectory dir
+      else pure []
+
+    entrySize path = do
+      is_dir <- doesDirectoryExist path
+      if is_dir
+      then do files <- filterM doesFileExist . map (path </>) =<< listDirectory path
+              sum <$> mapM getFileSize files
+      else getFileSize path
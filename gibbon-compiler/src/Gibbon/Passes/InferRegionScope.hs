@@ -67,14 +67,10 @@ In fnB, there's no path from `rb` to 1.
 mkScopedRegion :: Region -> Multiplicity -> Region 
 mkScopedRegion r m = 
   case r of 
-    SoAR dcr fieldRegs -> let scopedDcr = case dcr of 
-                                                VarR dcrVar -> GlobR dcrVar m
-                                                _ -> error "Did not handle SoAR in inferRegScopeExp."
-                              scopedFieldRegs = map (\(t, r') -> case r of
-                                                                    _ -> (t, mkScopedRegion r' m)
-                                                                
-                                                    ) fieldRegs
-                           in SoAR scopedDcr scopedFieldRegs
+    -- Both the data constructor region and the field regions may themselves
+    -- be factored.
+    SoAR dcr fieldRegs -> SoAR (mkScopedRegion dcr m)
+                               (map (\(t, r') -> (t, mkScopedRegion r' m)) fieldRegs)
     VarR reg -> GlobR reg m
     _ -> error "Did not handle region in inferRegScopeExp (mkScopedRegion)."
 
@@ -351,10 +351,11 @@ getTagOfDataCon dds dcon =
 -- The only substantitive conversion here is of tupled arguments to
 -- multiple argument functions.
 --
--- First argument indicates (1) whether we're inpacked mode, and (2)
--- the pre-cursorize type of the mainExp, if there is a mainExp.
-lower :: Prog3 -> PassM T.Prog
-lower Prog{fundefs,ddefs,mainExp} = do
+-- The first argument has the constructors whose fields were reordered by
+-- --layout-profile, with the new order of their fields as indices into the
+-- source order. It ends up in the info table.
+lower :: M.Map DataCon [Int] -> Prog3 -> PassM T.Prog
+lower field_orders Prog{fundefs,ddefs,mainExp} = do
   -- In Lower, we want to replace LitSymE's with the corresponding index into
   -- the symbol table. That's why we build a map from String's to Int64's.
   -- However, all the subsequent lookup's will be on the index, to get to the
@@ -372,7 +373,7 @@ lower Prog{fundefs,ddefs,mainExp} = do
           Nothing    -> return Nothing
           Just (x,mty) -> (Just . T.PrintExp) <$>
                             (addPrintToTail mty =<< tail True inv_sym_tbl x)
-  funs       <- mapM (fund inv_sym_tbl) (M.elems fundefs)
+  funs       <- parMapM (fund inv_sym_tbl) (M.elems fundefs)
   dflags     <- getDynFlags
   unpackers  <- if gopt Opt_Pointer dflags
                 then mapM genUnpacker (L.filter (not . isVoidDDef) (M.elems ddefs))
@@ -424,7 +425,8 @@ lower Prog{fundefs,ddefs,mainExp} = do
                                             _ -> (acc1+fromJust (sizeOfTy ty), acc2))
                                      (0,0) field_tys
                 dcon_tag = getTagOfDataCon ddefs dcon
-            in (T.DataConInfo dcon_tag scalar_bytes num_shortcut num_scalars num_packed field_tys)
+                field_order = M.findWithDefault [] dcon field_orders
+            in (T.DataConInfo dcon_tag scalar_bytes num_shortcut num_scalars num_packed field_tys field_order)
 
 
   hasCursorTy :: Ty3 -> Bool
@@ -0,0 +1,239 @@
+-- | Profile-guided field reordering for packed datatypes.
+--
+-- A program compiled with --profile-layout counts how often every function is
+-- entered and writes the counts out at exit (see gib_write_layout_profile in
+-- the RTS). Passing that file back with --layout-profile runs this pass,
+-- which picks a serialization order for the fields of every constructor.
+--
+-- For every case expression we record the order in which the fields bound by
+-- each alternative are first used, weighted by how often the enclosing
+-- function ran. In the packed representation, a field can be reached without
+-- a random access node only if every packed field before it has already been
+-- traversed. So the cost of a layout at a site is the number of packed fields
+-- that have to be skipped over: fields that sit before a used field but are
+-- used after it, or not at all. Scalars are fixed size and never have to be
+-- skipped, which is why they always go first.
+--
+-- The new order is applied to the datatype and to every DataConE and CaseE
+-- in the program. The printer, copy and traversal functions are ordinary L1
+-- functions generated from the datatypes, so they are rewritten along with
+-- everything else: they keep printing fields in source order, and the info
+-- table and GC metadata generated later see the new layout. Packed files
+-- written by a differently compiled program won't be readable anymore.
+-- The new orders are also passed on to Lower ('fieldOrders'), so that
+-- S-expression inputs, which are written in source order, can be packed.
+module Gibbon.Passes.ReorderFields
+  ( reorderFields, fieldOrders, readLayoutProfile, LayoutProfile, Perms ) where
+
+import qualified Data.List as L
+import qualified Data.Map as M
+import qualified Data.Set as S
+import           Data.Maybe ( fromMaybe )
+import           Text.Read ( readMaybe )
+
+import           Gibbon.Common
+import           Gibbon.L1.Syntax
+
+--------------------------------------------------------------------------------
+
+-- | Number of times every function was entered.
+type LayoutProfile = M.Map Var Int
+
+-- | Read a profile written by a program compiled with --profile-layout.
+readLayoutProfile :: FilePath -> IO LayoutProfile
+readLayoutProfile fp = do
+  str <- readFile fp
+  M.fromListWith (+) <$> mapM parseLine [ (i,ln) | (i,ln) <- zip [(1::Int)..] (lines str)
+                                                 , not (null (words ln)) ]
+  where
+    parseLine (i,ln) =
+      case words ln of
+        [f,n] | Just cnt <- readMaybe n -> pure (toVar f, cnt)
+        _ -> error $ fp ++ ":" ++ show i ++ ": expected a function name and a count, got: " ++ ln
+
+-- | A case alternative: the fields it uses, in the order of their first use,
+-- and how often it ran (an upper bound, it's the count of the function).
+data Site = Site { siteUses :: [Int], siteWeight :: Int }
+
+-- | New order of every constructor's fields, as indices into the old one.
+type Perms = M.Map DataCon [Int]
+
+-- | Apply the orders picked by 'fieldOrders'.
+reorderFields :: Perms -> Prog1 -> PassM Prog1
+reorderFields perms prg@Prog{ddefs,fundefs,mainExp} =
+  if M.null perms
+  then pure prg
+  else pure $ Prog ddefs' fundefs' mainExp'
+  where
+    ddefs' = M.map (\dd@DDef{dataCons} ->
+                      dd { dataCons = [ (dcon, permute perms dcon tys) | (dcon,tys) <- dataCons ] })
+                   ddefs
+    fundefs' = M.map (\fn@FunDef{funBody} -> fn { funBody = reorderExp perms funBody }) fundefs
+    mainExp' = fmap (\(e,ty) -> (reorderExp perms e, ty)) mainExp
+
+-- | The constructors whose fields should be reordered, with the new order
+-- of their fields as indices into the source order.
+fieldOrders :: LayoutProfile -> Prog1 -> Perms
+fieldOrders profile Prog{ddefs,fundefs,mainExp} = perms
+  where
+    sites :: M.Map DataCon [Site]
+    sites = M.unionsWith (++) $
+              [ collectSites (M.findWithDefault 0 funName profile) funBody
+              | FunDef{funName,funBody} <- M.elems fundefs ] ++
+              [ collectSites 1 e | Just (e,_) <- [mainExp] ]
+
+    perms :: Perms
+    perms = M.fromList
+              [ (dcon, order)
+              | DDef{dataCons} <- M.elems ddefs
+              , (dcon, tys) <- dataCons
+              , Just ss <- [M.lookup dcon sites]
+              , let packed = S.fromList [ i | (i,(_,ty)) <- zip [0..] tys, isPackedTy ty ]
+                    orig   = [0 .. length tys - 1]
+                    order  = chooseOrder packed orig ss
+                    before = totalSkips packed orig ss
+                    after  = totalSkips packed order ss
+              , after < before
+              , dbgTrace minChatLvl ("reorderFields: " ++ dcon ++ " " ++ show orig ++ " -> " ++
+                                     show order ++ ", skipped fields " ++ show before ++
+                                     " -> " ++ show after) True
+              ]
+
+permute :: Perms -> DataCon -> [a] -> [a]
+permute perms dcon xs =
+  case M.lookup dcon perms of
+    Nothing    -> xs
+    Just order -> map (xs !!) order
+
+-- | Scalars first, in their original order. Then the packed fields, greedily
+-- picking the one that is used before the other remaining fields most often.
+chooseOrder :: S.Set Int -> [Int] -> [Site] -> [Int]
+chooseOrder packed orig ss = scalars ++ go (filter (`S.member` packed) orig)
+  where
+    scalars = filter (not . (`S.member` packed)) orig
+
+    -- Weight of the sites that use a before b.
+    pref :: Int -> Int -> Int
+    pref a b = sum [ siteWeight s | s <- ss, rank s a < rank s b ]
+
+    go [] = []
+    go remaining =
+      let score f = sum [ pref f b - pref b f | b <- remaining, b /= f ]
+          -- Ties go to the field that came first.
+          best = snd $ L.maximum [ ((score f, negate i), f) | (i,f) <- zip [(0::Int)..] remaining ]
+      in best : go (L.delete best remaining)
+
+-- | Position of a field's first use at a site; unused fields come last.
+rank :: Site -> Int -> Int
+rank s f = fromMaybe maxBound (L.elemIndex f (siteUses s))
+
+-- | Weighted number of packed fields that have to be skipped over.
+totalSkips :: S.Set Int -> [Int] -> [Site] -> Int
+totalSkips packed order ss = sum [ siteWeight s * skips s | s <- ss ]
+  where
+    skips s = length
+      [ f | (j,f) <- zip [(0::Int)..] order
+          , f `S.member` packed
+          , any (\g -> rank s g < rank s f) (drop (j+1) order) ]
+
+--------------------------------------------------------------------------------
+
+collectSites :: Int -> Exp1 -> M.Map DataCon [Site]
+collectSites w ex =
+  case ex of
+    VarE{}    -> M.empty
+    LitE{}    -> M.empty
+    CharE{}   -> M.empty
+    FloatE{}  -> M.empty
+    LitSymE{} -> M.empty
+    AppE _ _ args   -> M.unionsWith (++) (map go args)
+    PrimAppE _ args -> M.unionsWith (++) (map go args)
+    LetE (_,_,_,rhs) bod -> M.unionWith (++) (go rhs) (go bod)
+    IfE a b c   -> M.unionsWith (++) [go a, go b, go c]
+    MkProdE ls  -> M.unionsWith (++) (map go ls)
+    ProjE _ e   -> go e
+    CaseE scrt brs ->
+      M.unionsWith (++) $
+        go scrt :
+        [ M.insertWith (++) dcon [Site (firstUses (map fst vlocs) rhs) w] (go rhs)
+        | (dcon,vlocs,rhs) <- brs ]
+    DataConE _ _ args -> M.unionsWith (++) (map go args)
+    TimeIt e _ _ -> go e
+    WithArenaE _ e -> go e
+    SpawnE _ _ args -> M.unionsWith (++) (map go args)
+    SyncE -> M.empty
+    MapE{}  -> M.empty
+    FoldE{} -> M.empty
+    Ext ext ->
+      case ext of
+        BenchE _ _ args _ -> M.unionsWith (++) (map go args)
+        _ -> M.empty
+  where
+    go = collectSites w
+
+-- | Indices of the given variables, in the order of their first occurrence.
+firstUses :: [Var] -> Exp1 -> [Int]
+firstUses vs ex =
+  L.nub [ i | v <- occs ex, Just i <- [L.elemIndex v vs] ]
+  where
+    -- Variable occurrences, roughly in evaluation order.
+    occs :: Exp1 -> [Var]
+    occs e0 =
+      case e0 of
+        VarE v    -> [v]
+        LitE{}    -> []
+        CharE{}   -> []
+        FloatE{}  -> []
+        LitSymE{} -> []
+        AppE _ _ args   -> concatMap occs args
+        PrimAppE _ args -> concatMap occs args
+        LetE (_,_,_,rhs) bod -> occs rhs ++ occs bod
+        IfE a b c   -> occs a ++ occs b ++ occs c
+        MkProdE ls  -> concatMap occs ls
+        ProjE _ e   -> occs e
+        CaseE scrt brs -> occs scrt ++ concatMap (\(_,_,rhs) -> occs rhs) brs
+        DataConE _ _ args -> concatMap occs args
+        TimeIt e _ _ -> occs e
+        WithArenaE _ e -> occs e
+        SpawnE _ _ args -> concatMap occs args
+        SyncE -> []
+        MapE (_,_,a) b -> occs a ++ occs b
+        FoldE (_,_,a) (_,_,b) c -> occs a ++ occs b ++ occs c
+        Ext ext ->
+          case ext of
+            BenchE _ _ args _ -> concatMap occs args
+            AddFixed v _ -> [v]
+            StartOfPkdCursor v -> [v]
+
+--------------------------------------------------------------------------------
+
+reorderExp :: Perms -> Exp1 -> Exp1
+reorderExp perms = go
+  where
+    go :: Exp1 -> Exp1
+    go ex =
+      case ex of
+        VarE{}    -> ex
+        LitE{}    -> ex
+        CharE{}   -> ex
+        FloatE{}  -> ex
+        LitSymE{} -> ex
+        AppE f locs args -> AppE f locs (map go args)
+        PrimAppE p args  -> PrimAppE p (map go args)
+        LetE (v,locs,ty,rhs) bod -> LetE (v,locs,ty,go rhs) (go bod)
+        IfE a b c   -> IfE (go a) (go b) (go c)
+        MkProdE ls  -> MkProdE (map go ls)
+        ProjE i e   -> ProjE i (go e)
+        CaseE scrt brs ->
+          CaseE (go scrt) [ (dcon, permute perms dcon vlocs, go rhs) | (dcon,vlocs,rhs) <- brs ]
+        DataConE loc dcon args -> DataConE loc dcon (permute perms dcon (map go args))
+        TimeIt e ty b -> TimeIt (go e) ty b
+        WithArenaE v e -> WithArenaE v (go e)
+        SpawnE f locs args -> SpawnE f locs (map go args)
+        SyncE -> SyncE
+        MapE (v,ty,a) b -> MapE (v,ty,go a) (go b)
+        FoldE (v1,t1,a) (v2,t2,b) c -> FoldE (v1,t1,go a) (v2,t2,go b) (go c)
+        Ext ext ->
+          case ext of
+            BenchE f locs args b -> Ext (BenchE f locs (map go args) b)
+            _ -> ex
@@ -87,7 +87,7 @@ type RanEnv = M.Map LocVar Var
 
 threadRegions2 :: NewL2.Prog2 -> PassM NewL2.Prog2
 threadRegions2 Prog {ddefs, fundefs, mainExp} = do
-  fds' <- mapM (threadRegionsFn ddefs fundefs) $ M.elems fundefs
+  fds' <- parMapM (threadRegionsFn ddefs fundefs) $ M.elems fundefs
   let fundefs' = M.fromList $ map (\f -> (funName f, f)) fds'
       env2 = Env2 M.empty (initFunEnv' fundefs)
   mainExp' <- case mainExp of
@@ -277,7 +277,10 @@ threadRegionsFn ddefs fundefs f@FunDef {funName, funArgs, funTy, funMeta, funBod
                                 let rv = regionToVar reg
                                     end_rv = toEndVRegVar rv
                                     -- rv = end_reg
-                                    bc = boundsCheck ddefs (locs_tycons M.! loc)
+                                    -- One check covers every write this function makes
+                                    -- at a known offset from loc.
+                                    bc = max (boundsCheck ddefs (locs_tycons M.! loc))
+                                             (fst (straightLineWrites ddefs loc funBody) + 9)
                                     locarg = NewL2.Loc (LREM loc rv end_rv mode)
                                     regarg = NewL2.EndOfReg rv mode end_rv
                                  in -- dbgTrace (minChatLvl) ("boundscheck" ++ sdoc ((locs_tycons M.! loc), bc)) $
@@ -288,14 +291,22 @@ threadRegionsFn ddefs fundefs f@FunDef {funName, funArgs, funTy, funMeta, funBod
                     (locVars funTy)
                 boundschecks = concatMap fst results
                 regInsts = concatMap snd results
+                -- The checks of indirections written at a known offset from
+                -- an output location are subsumed by the entry check above.
+                covered = S.unions [ snd (straightLineWrites ddefs loc funBody)
+                                   | LRM loc reg Output <- locVars funTy
+                                   , case reg of
+                                       SoAR _ _ -> False
+                                       _ -> True ]
+                bod_unchecked = dropBoundsChecks covered bod'
              in -- If eager promotion is disabled, growing a region can also trigger a GC.
                 if no_eager_promote && funCanTriggerGC funMeta
                   then
-                    let lets = mkLets (rpush ++ wpush ++ boundschecks ++ wpop ++ rpop) bod'
+                    let lets = mkLets (rpush ++ wpush ++ boundschecks ++ wpop ++ rpop) bod_unchecked
                         bod'' = L.foldr (\i acc -> Ext $ i acc) lets regInsts
                      in bod''
                   else
-                    let lets = mkLets boundschecks bod'
+                    let lets = mkLets boundschecks bod_unchecked
                         bod'' = L.foldr (\i acc -> Ext $ i acc) lets regInsts
                      in bod''
 
@@ -393,13 +404,7 @@ threadRegionsExp ddefs fundefs fnLocArgs renv env2 lfenv rlocs_env wlocs_env pkd
       let outretlocs = if hasPacked (unTy2 ty) then NewL2.locsInTy ty else []
           out_regvars = map (renv #) outretlocs
       out_regvars' <-
-        mapM
-          ( \r -> case r of
-              SingleR rv -> SingleR <$> gensym rv
-              SoARv (SingleR drv) frvs -> SoARv <$> (SingleR <$> gensym drv) <*> mapM (\(k, (frv)) -> (,) k <$> (genSymRegVar frv)) frvs
-              _ -> error "threadRegionsExp: SoARv not implemented yet."
-          )
-          out_regvars
+        mapM genSymRegVar out_regvars
       let out_regargs = map (\r -> NewL2.EndOfReg r Output (toEndVRegVar r)) out_regvars
       let out_regargs' = map (\r -> NewL2.EndOfReg r Output (toEndVRegVar r)) out_regvars'
 
@@ -407,13 +412,7 @@ threadRegionsExp ddefs fundefs fnLocArgs renv env2 lfenv rlocs_env wlocs_env pkd
       -- where they're written, and not of their target.
       let in_regvars = map (renv #) argtylocs
       in_regvars' <-
-        mapM
-          ( \r -> case r of
-              SingleR rv -> SingleR <$> gensym rv
-              SoARv (SingleR drv) frvs -> SoARv <$> (SingleR <$> gensym drv) <*> mapM (\(k, (frv)) -> (,) k <$> (genSymRegVar frv)) frvs
-              _ -> error "threadRegionsExp: SoARv not implemented yet."
-          )
-          in_regvars
+        mapM genSymRegVar in_regvars
       let in_regargs' = map (\r -> NewL2.EndOfReg r Input (toEndVRegVar r)) in_regvars'
       --------------------
       let ran_endofregs =
@@ -1172,25 +1171,127 @@ findRetLocs e0 = go e0 []
 boundsCheck :: NewL2.DDefs2 -> TyCon -> Int
 boundsCheck ddefs tycon =
   let dcons = getConOrdering ddefs tycon
-      spaceReqd tys =
-        foldl
-          ( \(bytes, seen_packed) ty ->
-              if seen_packed
-                then (bytes, seen_packed)
-                else
-                  if hasPacked (unTy2 ty)
-                    then (bytes, True)
-                    else (bytes + (fromJust $ sizeOfTy (unTy2 ty)), False)
-          )
-          (0, False)
-          tys
       tyss = map (lookupDataCon ddefs) dcons
-      vals = map (fst . spaceReqd) tyss
+      vals = map headScalarBytes tyss
       -- Add a byte for the tag.
       num_bytes = (1 + maximum vals)
    in -- Reserve additional space for a redirection node or a forwarding pointer.
       dbgTrace (minChatLvl) "Print boundsCheck: " dbgTrace (minChatLvl) (sdoc (dcons, vals, tyss)) dbgTrace (minChatLvl) "End boundsCheck.\n" num_bytes + 9
 
+-- | Bytes taken by the fields that are written along with the tag, i.e. the
+-- scalars and random access nodes that occur before the first packed field.
+headScalarBytes :: [NewL2.Ty2] -> Int
+headScalarBytes tys =
+  fst $
+    foldl
+      ( \(bytes, seen_packed) ty ->
+          if seen_packed
+            then (bytes, seen_packed)
+            else
+              if hasPacked (unTy2 ty)
+                then (bytes, True)
+                else (bytes + (fromJust $ sizeOfTy (unTy2 ty)), False)
+      )
+      (0, False)
+      tys
+
+-- | The number of bytes a function writes at fixed offsets from the output
+-- location 'loc0': the tags, head scalars and random access nodes of
+-- constructors it builds directly, and indirections. These are counted
+-- wherever they are written, including after a call, since a constructor's
+-- tag is written after the calls that fill its fields. Writes at offsets that
+-- depend on a call's result aren't counted; callees check bounds on their own.
+-- A single bounds check for this many bytes at function entry reserves space
+-- for all of the counted writes. Also returns the locations of the
+-- indirections counted, which don't need a check of their own.
+straightLineWrites :: NewL2.DDefs2 -> LocVar -> NewL2.Exp2 -> (Int, S.Set LocVar)
+straightLineWrites ddefs loc0 bod0 = go (M.singleton loc0 0) M.empty bod0
+  where
+    go :: M.Map LocVar Int -> M.Map Var Int -> NewL2.Exp2 -> (Int, S.Set LocVar)
+    go offs szs ex =
+      case ex of
+        LetE (v, _, _, rhs) bod ->
+          let szs' = case valueSize szs rhs of
+                       Just n -> M.insert v n szs
+                       Nothing -> szs
+           in combine [go offs szs rhs, go offs szs' bod]
+        DataConE locarg dcon _ ->
+          case M.lookup (NewL2.toLocVar locarg) offs of
+            Just off -> (off + 1 + headScalarBytes (lookupDataCon ddefs dcon), S.empty)
+            Nothing -> none
+        IfE _ b c -> combine [go offs szs b, go offs szs c]
+        CaseE _ brs -> combine (map (\(_, _, bod) -> go offs szs bod) brs)
+        TimeIt e _ _ -> go offs szs e
+        WithArenaE _ e -> go offs szs e
+        Ext ext ->
+          case ext of
+            LetLocE loc rhs bod ->
+              let mb_off = case rhs of
+                             AfterConstantLE n base -> (+ n) <$> M.lookup (NewL2.toLocVar base) offs
+                             AfterVariableLE v base _ -> (+) <$> M.lookup (NewL2.toLocVar base) offs <*> M.lookup v szs
+                             _ -> Nothing
+                  offs' = maybe offs (\off -> M.insert loc off offs) mb_off
+               in go offs' szs bod
+            LetRegionE _ _ _ bod -> go offs szs bod
+            LetParRegionE _ _ _ bod -> go offs szs bod
+            LetRegE _ _ bod -> go offs szs bod
+            LetAvail _ bod -> go offs szs bod
+            IndirectionE _ _ (from, _) _ _ ->
+              case M.lookup (NewL2.toLocVar from) offs of
+                Just off -> (off + 9, S.singleton (NewL2.toLocVar from))
+                Nothing -> none
+            _ -> none
+        _ -> none
+
+    none = (0, S.empty)
+
+    combine :: [(Int, S.Set LocVar)] -> (Int, S.Set LocVar)
+    combine = foldr (\(a, s1) (b, s2) -> (max a b, S.union s1 s2)) none
+
+    -- Size of a value built directly by this function.
+    valueSize :: M.Map Var Int -> NewL2.Exp2 -> Maybe Int
+    valueSize szs rhs =
+      case rhs of
+        DataConE _ dcon args ->
+          let fieldSize (arg, ty) =
+                if isPackedTy (unTy2 ty)
+                  then case arg of
+                         VarE x -> M.lookup x szs
+                         _ -> Nothing
+                  else sizeOfTy (unTy2 ty)
+           in (1 +) . sum <$> mapM fieldSize (zip args (lookupDataCon ddefs dcon))
+        Ext IndirectionE {} -> Just 9
+        _ -> Nothing
+
+-- | Remove the bounds checks of the given write cursors.
+dropBoundsChecks :: S.Set LocVar -> NewL2.Exp2 -> NewL2.Exp2
+dropBoundsChecks covered ex =
+  case ex of
+    LetE (_, _, _, Ext (BoundsCheck _ _ cur)) bod
+      | S.member (NewL2.toLocVar cur) covered -> go bod
+    AppE f locs args -> AppE f locs (map go args)
+    PrimAppE pr args -> PrimAppE pr (map go args)
+    LetE (v, locs, ty, rhs) bod -> LetE (v, locs, ty, go rhs) (go bod)
+    IfE a b c -> IfE (go a) (go b) (go c)
+    MkProdE args -> MkProdE (map go args)
+    ProjE i bod -> ProjE i (go bod)
+    CaseE scrt brs -> CaseE (go scrt) (map (\(dcon, vlocs, c) -> (dcon, vlocs, go c)) brs)
+    DataConE loc dcon args -> DataConE loc dcon (map go args)
+    TimeIt e ty b -> TimeIt (go e) ty b
+    WithArenaE v e -> WithArenaE v (go e)
+    SpawnE f locs args -> SpawnE f locs (map go args)
+    Ext ext ->
+      case ext of
+        LetRegionE r sz ty bod -> Ext $ LetRegionE r sz ty (go bod)
+        LetParRegionE r sz ty bod -> Ext $ LetParRegionE r sz ty (go bod)
+        LetLocE loc locexp bod -> Ext $ LetLocE loc locexp (go bod)
+        LetRegE reg regexp bod -> Ext $ LetRegE reg regexp (go bod)
+        LetAvail vs bod -> Ext $ LetAvail vs (go bod)
+        _ -> ex
+    _ -> ex
+  where
+    go = dropBoundsChecks covered
+
 -- Not making a seperate function for bounds checking an SoA location at the moment.
 -- For a data constructor region -- it is 1 byte
 -- For a field region, it is size of field.
@@ -1,16 +1,30 @@
 {-# LANGUAGE CPP #-}
+{-# LANGUAGE TupleSections #-}
 -- | Aims to minimize the work done by bench_gibbon.sh.
+--
+-- Every run is also appended to a store of JSON lines (benchStore), tagged
+-- with the commit it was built from. After a run, or with --bench-report
+-- alone, the latest results are compared with those of a baseline commit,
+-- per benchmark and per configuration, and the run fails if anything got
+-- significantly slower.
 module BenchRunner
     (main) where
 
+import           Control.Monad
 import           Data.List
+import           Data.Maybe ( mapMaybe )
+import           Data.Time.LocalTime ( getZonedTime )
 import           Data.Yaml as Y
+import           System.Directory ( doesFileExist )
 import           System.Environment ( lookupEnv )
+import           System.Exit
 import           System.FilePath
 import           System.Process
+import           Text.Read ( readMaybe )
 import           Text.Printf
 import           Options.Applicative as OA hiding (empty, str)
 import qualified Data.ByteString.Char8 as BS
+import qualified Data.Map as M
 
 #if !MIN_VERSION_base(4,11,0)
 import           Data.Monoid
@@ -44,7 +58,7 @@ main = do
             -- Respect ENV overrides.
             tests' <- envOverrides tests
 
-            if (recordBenchmarks tc)
+            if (recordBenchmarks tc || benchReport tc)
             then bench_main tc tests'
             else test_main tc tests'
 
@@ -72,31 +86,351 @@ envOverrides tests = do
 getHostname :: IO String
 getHostname = init <$> readCreateProcess (shell "hostname") ""
 
+-- | The commit the compiler was built from, marked if the tree has local
+-- changes. Results are grouped by it in the store.
+getCommit :: IO String
+getCommit = do
+    compiler_dir <- getCompilerDir
+    let git args = readCreateProcessWithExitCode (proc "git" args) { cwd = Just (compiler_dir </> ".") } ""
+    (code, out, _) <- git ["rev-parse", "--short", "HEAD"]
+    case code of
+        ExitFailure _ -> pure "unknown"
+        ExitSuccess -> do
+            (_, changes, _) <- git ["status", "--porcelain", "--untracked-files=no"]
+            pure (concat (lines out) ++ (if null changes then "" else "+dirty"))
+
+--------------------------------------------------------------------------------
+-- Configurations
+
+-- | A way of compiling the benchmarks: a mode and some extra flags.
+data BenchConfig = BenchConfig
+    { configName  :: String
+    , configMode  :: Mode
+    , configFlags :: [String]
+    }
+
+benchConfigs :: TestConfig -> [BenchConfig]
+benchConfigs tc = sequential ++ (if benchParallel tc then parallel else [])
+  where
+    sequential =
+        [ BenchConfig "gibbon1"      Gibbon1 []
+        , BenchConfig "packed"       Gibbon2 []
+        , BenchConfig "packed-gengc" Gibbon3 []
+        , BenchConfig "pointer"      Pointer []
+        , BenchConfig "colobus"      Colobus [] -- Omit MPL for now
+        ]
+    parallel =
+        [ c { configName = configName c ++ "-par", configFlags = configFlags c ++ ["--parallel"] }
+        | c <- sequential, configMode c `elem` [Gibbon2, Gibbon3, Pointer] ]
+
+--------------------------------------------------------------------------------
+-- The results store
+
+-- | One benchmark in one configuration, i.e. one line in the store.
+data BenchRecord = BenchRecord
+    { recCommit  :: String
+    , recDate    :: String
+    , recHost    :: String
+    , recBench   :: String
+    , recConfig  :: String
+    , recSize    :: Int
+    , recIters   :: Int
+    , recTimes   :: [Double]        -- ^ SELFTIMED of every trial.
+    , recMaxRSS  :: Maybe Integer   -- ^ Peak RSS in KB.
+    , recGcStats :: M.Map String Double -- ^ See 'gcStatLines'. Empty in pointer mode.
+    }
+  deriving (Show, Eq)
+
+instance FromJSON BenchRecord where
+    parseJSON = withObject "BenchRecord" $ \o ->
+        BenchRecord <$> o .: "commit" <*> o .: "date" <*> o .: "host" <*>
+                        o .: "bench"  <*> o .: "config" <*> o .: "size" <*>
+                        o .: "iters"  <*> o .: "times" <*>
+                        o .:? "maxrss_kb" <*> o .:? "gc" .!= M.empty
+
+-- | One line of JSON.
+renderRecord :: BenchRecord -> String
+renderRecord r =
+    "{" ++ intercalate ", "
+             [ field "commit" (show (recCommit r))
+             , field "date"   (show (recDate r))
+             , field "host"   (show (recHost r))
+             , field "bench"  (show (recBench r))
+             , field "config" (show (recConfig r))
+             , field "size"   (show (recSize r))
+             , field "iters"  (show (recIters r))
+             , field "times"  ("[" ++ intercalate ", " (map show (recTimes r)) ++ "]")
+             , field "maxrss_kb" (maybe "null" show (recMaxRSS r))
+             , field "gc" ("{" ++ intercalate ", " [ field k (show v) | (k,v) <- M.toList (recGcStats r) ] ++ "}")
+             ] ++ "}"
+  where
+    field :: String -> String -> String
+    field k v = show k ++ ": " ++ v
+
+readBenchStore :: FilePath -> IO [BenchRecord]
+readBenchStore fp = do
+    exists <- doesFileExist fp
+    if not exists
+    then pure []
+    else do
+        str <- readFile fp
+        forM (filter (not . all (== ' ')) (lines str)) $ \ln ->
+            case Y.decodeEither' (BS.pack ln) of
+                Right r  -> pure r
+                Left err -> error ("Couldn't parse a benchmark record in " ++ fp ++ ". " ++ show err)
+
+--------------------------------------------------------------------------------
+-- Running the benchmarks
+
 bench_main :: TestConfig -> Tests -> IO ()
 bench_main tc (Tests tests) = do
-    putStrLn "Executing BenchRunner...\n"
-    let benchmarks = filter (not . skip) $ filter isBenchmark tests
-        modesToBench = [Gibbon1, Gibbon2, Pointer,Colobus] -- Omit MPL for now
-    results <- mapM (go modesToBench) benchmarks
-    mc <- getHostname
-    let csvs = map (\arg -> intercalate "," (mc:arg)) (concat results)
-    appendFile (benchSummaryFile tc) (unlines csvs)
-    putStrLn $ "Wrote results to " ++ (benchSummaryFile tc) ++ "."
+    unless (benchReport tc) $ do
+        putStrLn "Executing BenchRunner...\n"
+        mc <- getHostname
+        commit <- getCommit
+        date <- show <$> getZonedTime
+        let benchmarks = filter (not . skip) $ filter isBenchmark tests
+        results <- concat <$> mapM (go mc commit date) benchmarks
+        let csvs = map (\(arg,_) -> intercalate "," (mc:arg)) results
+        appendFile (benchSummaryFile tc) (unlines csvs)
+        appendFile (benchStore tc) (unlines (map renderRecord (mapMaybe snd results)))
+        putStrLn $ "Wrote results to " ++ (benchSummaryFile tc) ++ " and " ++ (benchStore tc) ++ "."
+    records <- readBenchStore (benchStore tc)
+    regressions <- report tc records
+    unless (regressions == 0) exitFailure
   where
-    go :: [Mode] -> Test -> IO [[String]]
-    go modes t@Test{name,sizeParam,moreIters,numTrials} = do
+    go :: String -> String -> String -> Test -> IO [([String], Maybe BenchRecord)]
+    go mc commit date t@Test{name,sizeParam,moreIters,numTrials} = do
         putStrLn $ "Benchmarking " ++ show name
-        results <- mapM (\mode ->
-                  do trials <- doNTrials tc mode t
-                     let res = case trials of
-                                   Left err -> err
-                                   Right bench_results ->
-                                       let (BenchResult median_res) =
-                                               medianBenchResult numTrials bench_results
-                                       in printf "%e" median_res
-                         iters :: Int
-                         iters = if mode `elem` moreIters then 10000000 else 1
-                     return [takeBaseName name, show mode, show sizeParam, show numTrials, show iters, res])
-             modes
-        putStrLn (show results)
+        results <- forM (benchConfigs tc) $ \BenchConfig{configName,configMode,configFlags} -> do
+            let t' = t { test_flags = test_flags t ++ configFlags }
+                iters :: Int
+                iters = if configMode `elem` moreIters then 10000000 else 1
+                row res extra = [takeBaseName name, show configMode, show sizeParam, show numTrials, show iters, res, configName] ++ extra
+            trials <- doNTrials tc configMode t'
+            case trials of
+                Left err -> return (row err [], Nothing)
+                Right bench_results -> do
+                    let (BenchResult median_res) = medianBenchResult numTrials bench_results
+                    -- Measured separately so that neither disturbs the timings.
+                    maxrss <- readMaxRSS <$> runOnce tc configMode t'
+                    gc <- if configMode == Pointer
+                          then pure M.empty
+                          else gcStats configMode t'
+                    let rec = BenchRecord { recCommit  = commit
+                                          , recDate    = date
+                                          , recHost    = mc
+                                          , recBench   = takeBaseName name
+                                          , recConfig  = configName
+                                          , recSize    = sizeParam
+                                          , recIters   = iters
+                                          , recTimes   = [ x | BenchResult x <- bench_results ]
+                                          , recMaxRSS  = maxrss
+                                          , recGcStats = gc
+                                          }
+                        extra = [ maybe "" show maxrss ] ++
+                                [ maybe "" show (M.lookup k gc) | (_,k) <- gcStatLines ]
+                    return (row (printf "%e" median_res) extra, Just rec)
+        putStrLn (show (map fst results))
         return results
+
+    -- GC statistics are only printed by an instrumented build, from a
+    -- single iteration.
+    gcStats :: Mode -> Test -> IO (M.Map String Double)
+    gcStats mode t = do
+        let t' = t { test_flags = test_flags t ++ ["--print-gc-stats"], numTrials = 0, moreIters = [] }
+        res <- doNTrials tc mode t'
+        case res of
+            Left _  -> pure M.empty
+            Right _ -> readGcStats <$> runOnce tc mode t'
+
+-- | Run the executable left behind by 'doNTrials' once more, and return what
+-- it printed.
+runOnce :: TestConfig -> Mode -> Test -> IO String
+runOnce tc mode t@Test{sizeParam,isMegaBench,benchInput} = do
+    compiler_dir <- getCompilerDir
+    let (_, exepath) = buildPaths compiler_dir tc mode t
+        cmd_options = "--print-max-rss" :
+                      if isMegaBench
+                      then ["--bench-input", benchInput]
+                      else [show sizeParam, "1"]
+    (exitCode, out, _) <-
+        readCreateProcessWithExitCode (proc exepath cmd_options)
+            { cwd = if isMegaBench then Just compiler_dir else Nothing } ""
+    case exitCode of
+        ExitSuccess   -> pure out
+        ExitFailure _ -> pure ""
+
+readMaxRSS :: String -> Maybe Integer
+readMaxRSS out =
+    case mapMaybe (stripPrefix "MAXRSS: ") (lines out) of
+        [] -> Nothing
+        ls -> readMaybe (last ls)
+
+-- | The lines of gib_gc_stats_print that we keep, and their names in the store.
+gcStatLines :: [(String, String)]
+gcStatLines =
+    [ ("Major collections:", "major_collections")
+    , ("Minor collections:", "minor_collections")
+    , ("Mem copied (nursery->oldgen):", "mem_copied")
+    , ("GC elapsed time:", "gc_elapsed_time")
+    ]
+
+readGcStats :: String -> M.Map String Double
+readGcStats out =
+    M.fromList [ (key, val)
+               | ln <- lines out
+               , (prefix, key) <- gcStatLines
+               , Just rest <- [stripPrefix prefix ln]
+               , w:_ <- [reverse (words rest)]
+               , Just val <- [readMaybe w] ]
+
+--------------------------------------------------------------------------------
+-- Comparing against a baseline
+
+-- | Compare the latest commit in the store with the baseline, print a table,
+-- and return the number of regressions.
+report :: TestConfig -> [BenchRecord] -> IO Int
+report _ [] = do
+    putStrLn "No benchmark results to compare."
+    pure 0
+report tc records = do
+    let latest   = last records
+        current  = recCommit latest
+        host     = recHost latest
+        -- Timings from different machines aren't comparable.
+        on_host  = filter (\r -> recHost r == host) records
+        baseline = if null (benchBaseline tc)
+                   then lastMaybe [ recCommit r | r <- on_host, recCommit r /= current ]
+                   else Just (benchBaseline tc)
+    case baseline of
+        Nothing -> do
+            putStrLn $ "No baseline to compare " ++ current ++ " against on " ++ host ++ "."
+            pure 0
+        Just base -> do
+            let group_of c = M.fromListWith (flip (++))
+                               [ ((recBench r, recConfig r, recSize r), [r]) | r <- on_host, recCommit r == c ]
+                new = group_of current
+                old = group_of base
+                rows = [ (k, compareRecords rs (M.lookup k old)) | (k, rs) <- M.toList new ]
+                num_regressions = length [ () | (_, Just cmp) <- rows, verdict cmp == Slower ]
+            printf "Comparing %s against %s on %s.\n\n" current base host
+            printf "%-30s %-16s %12s %12s %8s %7s %8s %8s  %s\n"
+                   ("benchmark" :: String) ("config" :: String) ("base" :: String) ("new" :: String)
+                   ("change" :: String) ("p" :: String) ("maxrss" :: String) ("gc time" :: String) ("" :: String)
+            forM_ rows $ \((bench, config, _), mb_cmp) ->
+                case mb_cmp of
+                    Nothing  -> printf "%-30s %-16s %12s\n" bench config ("no baseline" :: String)
+                    Just cmp -> printf "%-30s %-16s %12.4e %12.4e %+7.1f%% %7.3f %8s %8s  %s\n"
+                                       bench config (baseMedian cmp) (newMedian cmp)
+                                       (100 * (newMedian cmp / baseMedian cmp - 1)) (pValue cmp)
+                                       (showChange (rssChange cmp)) (showChange (gcChange cmp))
+                                       (showVerdict (verdict cmp))
+            printf "\n%d regression(s).\n" num_regressions
+            pure num_regressions
+  where
+    lastMaybe [] = Nothing
+    lastMaybe ls = Just (last ls)
+
+    showChange :: Maybe Double -> String
+    showChange = maybe "-" (printf "%+.1f%%" . (* 100))
+
+    showVerdict :: Verdict -> String
+    showVerdict v = case v of
+                      Slower    -> "REGRESSION"
+                      Faster    -> "improvement"
+                      Unchanged -> ""
+
+data Verdict = Slower | Faster | Unchanged
+  deriving (Show, Eq)
+
+data Comparison = Comparison
+    { baseMedian :: Double
+    , newMedian  :: Double
+    , pValue     :: Double -- ^ Of the one-sided test in the direction of the change.
+    , rssChange  :: Maybe Double
+    , gcChange   :: Maybe Double
+    , verdict    :: Verdict
+    }
+
+-- | A change counts if it's larger than 'acceptableTimeDelta' and
+-- significant at this level.
+significanceLevel :: Double
+significanceLevel = 0.05
+
+-- | Compare every trial of a benchmark at the current commit with every
+-- trial at the baseline, runs of the same commit are pooled.
+compareRecords :: [BenchRecord] -> Maybe [BenchRecord] -> Maybe Comparison
+compareRecords _ Nothing = Nothing
+compareRecords new (Just old)
+    | null new_times || null old_times = Nothing
+    | otherwise = Just Comparison
+        { baseMedian = old_med
+        , newMedian  = new_med
+        , pValue     = p
+        , rssChange  = relChange <$> avg (mapMaybe recMaxRSS old) <*> avg (mapMaybe recMaxRSS new)
+        , gcChange   = relChange <$> avg (gcTimes old) <*> avg (gcTimes new)
+        , verdict    = if abs (relChange old_med new_med) > acceptableTimeDelta && p < significanceLevel
+                       then (if new_med > old_med then Slower else Faster)
+                       else Unchanged
+        }
+  where
+    new_times = concatMap recTimes new
+    old_times = concatMap recTimes old
+    new_med   = medianOf new_times
+    old_med   = medianOf old_times
+    p = if new_med > old_med
+        then mannWhitneyGreater new_times old_times
+        else mannWhitneyGreater old_times new_times
+
+    gcTimes = mapMaybe (M.lookup "gc_elapsed_time" . recGcStats)
+
+    relChange :: Double -> Double -> Double
+    relChange a b = (b - a) / a
+
+    avg :: Real a => [a] -> Maybe Double
+    avg [] = Nothing
+    avg ls = Just (realToFrac (sum ls) / fromIntegral (length ls))
+
+medianOf :: [Double] -> Double
+medianOf ls = sort ls !! (length ls `quot` 2)
+
+-- | One-sided Mann-Whitney U test: the probability of xs being this much
+-- larger than ys if both came from the same distribution. It doesn't assume
+-- the timings are normally distributed, they usually aren't. Uses the normal
+-- approximation of U with a correction for ties, which is good enough for
+-- the 10 or so trials that we run.
+mannWhitneyGreater :: [Double] -> [Double] -> Double
+mannWhitneyGreater xs ys
+    | sigma == 0 = 1
+    | otherwise  = 1 - normalCdf ((u - mu - 0.5) / sigma)
+  where
+    n1 = fromIntegral (length xs) :: Double
+    n2 = fromIntegral (length ys) :: Double
+    n  = n1 + n2
+    ranked = averageRanks (map (,True) xs ++ map (,False) ys)
+    u  = sum [ r | (r, True) <- ranked ] - n1 * (n1 + 1) / 2
+    mu = n1 * n2 / 2
+    ties = sum [ t ** 3 - t | grp <- group (sort (xs ++ ys)), let t = fromIntegral (length grp) ]
+    sigma = sqrt (n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1))))
+
+-- | Rank the samples from 1, equal samples get the average of their ranks.
+averageRanks :: [(Double, a)] -> [(Double, a)]
+averageRanks samples = go 1 (groupBy (\a b -> fst a == fst b) (sortOn fst samples))
+  where
+    go :: Double -> [[(Double, a)]] -> [(Double, a)]
+    go _ [] = []
+    go r (grp:rest) =
+        let k = fromIntegral (length grp)
+            avg_rank = r + (k - 1) / 2
+        in [ (avg_rank, x) | (_, x) <- grp ] ++ go (r + k) rest
+
+normalCdf :: Double -> Double
+normalCdf x = 0.5 * (1 + erf (x / sqrt 2))
+
+-- | Abramowitz and Stegun 7.1.26, accurate to 1.5e-7.
+erf :: Double -> Double
+erf x = signum x * (1 - poly * exp (- x * x))
+  where
+    t    = 1 / (1 + 0.3275911 * abs x)
+    poly = t * (0.254829592 + t * (-0.284496736 + t * (1.421413741 + t * (-1.453152027 + t * 1.061405429))))
@@ -0,0 +1,66 @@
+{-# LANGUAGE TemplateHaskell #-}
+
+-- | Tests for CalculateBounds
+module CalculateBounds where
+
+import Data.Map as M
+import Test.Tasty
+import Test.Tasty.HUnit
+import Test.Tasty.TH
+
+import Gibbon.Common
+import Gibbon.L2.Syntax
+import Gibbon.Passes.CalculateBounds
+
+ddfoo :: DDefs Ty2
+ddfoo = fromListDD [DDef (toVar "Foo") []
+                     [ ("Leaf",[(False,IntTy),(False,IntTy),(False,IntTy),(False,IntTy)])
+                     , ("Node",[(False,PackedTy "Foo" (Single "l")), (False,IntTy)])
+                     ] Linear]
+
+-- | The size inferred for the region bound at the top of the main expression.
+mainRegionSize :: Exp2 -> RegionSize
+mainRegionSize ex =
+  case mainExp (fst $ defaultPackedRunPassM $ inferRegSize (Prog ddfoo M.empty (Just (ex, ProdTy [])))) of
+    Just (Ext (LetRegionE _ sz _ _), _) -> sz
+    oth -> error $ "mainRegionSize: " ++ show oth
+
+-- | Node (Leaf 1 2 3 4) 5, with the Node written in tail position. Its scalar
+-- comes after the Leaf: 1 + (1 + 4*8) + 8 bytes.
+case_tail_datacon :: Assertion
+case_tail_datacon = BoundedSize 42 @=? mainRegionSize ex
+  where
+    ex = Ext $ LetRegionE (VarR "r1") Undefined Nothing $
+         Ext $ LetLocE (Single "l0") (StartOfRegionLE (VarR "r1")) $
+         Ext $ LetLocE (Single "l1") (AfterConstantLE 1 (Single "l0")) $
+         LetE ("x",[],PackedTy "Foo" (Single "l1"),
+                 DataConE (Single "l1") "Leaf" [LitE 1, LitE 2, LitE 3, LitE 4]) $
+         DataConE (Single "l0") "Node" [VarE "x", LitE 5]
+
+-- | The same, with the Node bound by a let.
+case_let_datacon :: Assertion
+case_let_datacon = BoundedSize 42 @=? mainRegionSize ex
+  where
+    ex = Ext $ LetRegionE (VarR "r1") Undefined Nothing $
+         Ext $ LetLocE (Single "l0") (StartOfRegionLE (VarR "r1")) $
+         Ext $ LetLocE (Single "l1") (AfterConstantLE 1 (Single "l0")) $
+         LetE ("x",[],PackedTy "Foo" (Single "l1"),
+                 DataConE (Single "l1") "Leaf" [LitE 1, LitE 2, LitE 3, LitE 4]) $
+         LetE ("y",[],PackedTy "Foo" (Single "l0"),
+                 DataConE (Single "l0") "Node" [VarE "x", LitE 5]) $
+         MkProdE []
+
+-- | A location that isn't derived from a region could point into any of
+-- them, so the region can't be sized.
+case_free_location :: Assertion
+case_free_location = Undefined @=? mainRegionSize ex
+  where
+    ex = Ext $ LetRegionE (VarR "r1") Undefined Nothing $
+         Ext $ LetLocE (Single "l0") (StartOfRegionLE (VarR "r1")) $
+         Ext $ LetLocE (Single "l1") FreeLE $
+         LetE ("x",[],PackedTy "Foo" (Single "l1"),
+                 DataConE (Single "l1") "Leaf" [LitE 1, LitE 2, LitE 3, LitE 4]) $
+         MkProdE []
+
+calculateBoundsTests :: TestTree
+calculateBoundsTests = $(testGroupGenerator)
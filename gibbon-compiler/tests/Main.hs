@@ -31,6 +31,9 @@ import L2.Interp
 -- import L0.Specialize
 import InferLocations
 import HoistBoundsCheck
+import ThreadRegions
+import CalculateBounds
+import ReorderFields
 
 main :: IO ()
 main = defaultMain allTests
@@ -48,6 +51,9 @@ main = defaultMain allTests
                    , l2InterpTests
                    -- , specializeTests
                    , hoistBoundsCheckTests
+                   , threadRegionsTests
+                   , calculateBoundsTests
+                   , reorderFieldsTests
                    ]
 
 tests :: TestTree
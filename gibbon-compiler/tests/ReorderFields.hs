@@ -0,0 +1,75 @@
+{-# LANGUAGE TemplateHaskell #-}
+
+-- | Tests for ReorderFields
+module ReorderFields where
+
+import Data.Map as M
+import Test.Tasty
+import Test.Tasty.HUnit
+import Test.Tasty.TH
+
+import Gibbon.Common
+import Gibbon.L1.Syntax
+import Gibbon.Passes.ReorderFields
+
+-- | The program in examples/ReorderFields.hs, without the main expression.
+ddtree :: DDefs Ty1
+ddtree = fromListDD [DDef (toVar "Tree") []
+                      [ ("Leaf",[(False,IntTy)])
+                      , ("Node",[(False,PackedTy "Tree" ()), (False,IntTy), (False,PackedTy "Tree" ())])
+                      ] Linear]
+
+-- | sumR reads the right subtree first, sumL the left one.
+sumFun :: Var -> Bool -> FunDef1
+sumFun f right =
+  FunDef f ["tr"] ([PackedTy "Tree" ()], IntTy) bod (FunMeta Rec NoInline False)
+  where
+    (first,second) = if right then ("r","l") else ("l","r")
+    bod = CaseE (VarE "tr")
+            [ ("Leaf", [("x",())], VarE "x")
+            , ("Node", [("l",()),("k",()),("r",())],
+               PrimAppE AddP [ PrimAppE AddP [AppE f [] [VarE first], VarE "k"]
+                             , PrimAppE MulP [LitE 2, AppE f [] [VarE second]]])
+            ]
+
+prog :: Prog1
+prog = Prog ddtree (fromListFD [sumFun "sumR" True, sumFun "sumL" False]) Nothing
+
+-- | sumR runs most often, so r moves in front of l. The scalar goes first.
+case_field_order :: Assertion
+case_field_order =
+  M.fromList [("Node",[1,2,0])] @=? fieldOrders (M.fromList [("sumR",100),("sumL",1)]) prog
+
+-- | If sumL runs most often, the source order is already the best one.
+case_source_order :: Assertion
+case_source_order =
+  M.empty @=? fieldOrders (M.fromList [("sumR",1),("sumL",100)]) prog
+
+-- | Without a profile nothing runs, and nothing is reordered.
+case_empty_profile :: Assertion
+case_empty_profile = M.empty @=? fieldOrders M.empty prog
+
+-- | The datatype and the binders of every case alternative are permuted.
+case_reorder :: Assertion
+case_reorder = do
+  let Prog{ddefs,fundefs} = fst $ defaultPackedRunPassM $
+                              reorderFields (M.fromList [("Node",[1,2,0])]) prog
+  [IntTy, PackedTy "Tree" (), PackedTy "Tree" ()] @=? lookupDataCon ddefs "Node"
+  [IntTy] @=? lookupDataCon ddefs "Leaf"
+  case funBody (fundefs M.! "sumR") of
+    CaseE _ [_, (_,vlocs,_)] -> [("k",()),("r",()),("l",())] @=? vlocs
+    oth -> assertFailure $ "case_reorder: " ++ show oth
+
+-- | Constructor applications are permuted the same way.
+case_reorder_datacon :: Assertion
+case_reorder_datacon =
+  case mainExp (fst $ defaultPackedRunPassM $ reorderFields perms prog') of
+    Just (ex, _) -> DataConE () "Node" [LitE 5, leaf 2, leaf 1] @=? ex
+    Nothing -> assertFailure "case_reorder_datacon: no main expression"
+  where
+    perms = M.fromList [("Node",[1,2,0])]
+    leaf n = DataConE () "Leaf" [LitE n]
+    prog' = prog { mainExp = Just (DataConE () "Node" [leaf 1, LitE 5, leaf 2], PackedTy "Tree" ()) }
+
+reorderFieldsTests :: TestTree
+reorderFieldsTests = $(testGroupGenerator)
@@ -339,6 +339,10 @@ data TestConfig = TestConfig
     , onlyPerf    :: Bool     -- ^ If true, only run the benchmarks.
     , recordBenchmarks :: Bool -- ^ If true, record the results of running fresh benchmarks. Used via BenchRunner.
     , benchSummaryFile :: FilePath -- ^ A CSV file in which to store the benchmarks.
+    , benchStore  :: FilePath -- ^ JSON lines with every benchmark run, compared across commits.
+    , benchBaseline :: String -- ^ Commit to compare against. If empty, the last other one in benchStore.
+    , benchReport :: Bool     -- ^ Don't run the benchmarks, only compare the stored results.
+    , benchParallel :: Bool   -- ^ Also benchmark with --parallel.
     }
   deriving (Show, Eq, Read, Ord)
 
@@ -353,6 +357,10 @@ defaultTestConfig = TestConfig
     , onlyPerf    = False
     , recordBenchmarks = False
     , benchSummaryFile = "gibbon-benchmarks-summary.csv"
+    , benchStore  = "gibbon-benchmarks.jsonl"
+    , benchBaseline = ""
+    , benchReport = False
+    , benchParallel = False
     }
 
 instance FromJSON TestConfig where
@@ -365,7 +373,11 @@ instance FromJSON TestConfig where
                                  o .:? "check-perf"   .!= (checkPerf defaultTestConfig)   <*>
                                  o .:? "only-perf"    .!= (onlyPerf defaultTestConfig)    <*>
                                  o .:? "run-benchmarks"   .!= (recordBenchmarks defaultTestConfig) <*>
-                                 o .:? "bench-summary-file" .!= (benchSummaryFile defaultTestConfig)
+                                 o .:? "bench-summary-file" .!= (benchSummaryFile defaultTestConfig) <*>
+                                 o .:? "bench-store"  .!= (benchStore defaultTestConfig)  <*>
+                                 o .:? "bench-baseline" .!= (benchBaseline defaultTestConfig) <*>
+                                 o .:? "bench-report" .!= (benchReport defaultTestConfig) <*>
+                                 o .:? "bench-parallel" .!= (benchParallel defaultTestConfig)
     parseJSON oth = error $ "Cannot parse TestConfig: " ++ show oth
 
 -- Accept a default test config as a fallback, either 'DefaultTestConfig',
@@ -403,6 +415,19 @@ configParser dtc = TestConfig
                                   help "A CSV file in which to store the benchmarks." <>
                                   showDefault <>
                                   value (benchSummaryFile dtc))
+                   <*> strOption (long "bench-store" <>
+                                  help "JSON lines file in which every benchmark run is recorded." <>
+                                  showDefault <>
+                                  value (benchStore dtc))
+                   <*> strOption (long "bench-baseline" <>
+                                  help "Commit to compare the benchmarks against (default: the previous one in the store)." <>
+                                  value (benchBaseline dtc))
+                   <*> switch (long "bench-report" <>
+                               help "Only compare the latest benchmark results in the store against the baseline." <>
+                               showDefault)
+                   <*> switch (long "bench-parallel" <>
+                               help "Also run the benchmarks with --parallel." <>
+                               showDefault)
 
 --------------------------------------------------------------------------------
 
@@ -579,14 +604,17 @@ runBenchmark tc t@Test{name,dir,expectedResults,runModes,numTrials} = do
                 Fail -> return (mode, EF err)
                 Pass -> return (mode, UF err)
 
---
+-- | Where a test is compiled to in a mode: the C file and the executable.
+buildPaths :: FilePath -> TestConfig -> Mode -> Test -> (FilePath, FilePath)
+buildPaths compiler_dir tc mode Test{name} = (replaceExtension basename ".c", replaceExtension basename ".exe")
+  where
+    tmppath  = compiler_dir </> tempdir tc </> name
+    basename = compiler_dir </> replaceBaseName tmppath (takeBaseName tmppath ++ modeFileSuffix mode)
+
 doNTrials :: TestConfig -> Mode -> Test -> IO (Either String [BenchResult])
 doNTrials tc mode t@Test{name,dir,numTrials,sizeParam,moreIters,isMegaBench,benchFun,test_flags} = do
     compiler_dir <- getCompilerDir
-    let tmppath  = compiler_dir </> tempdir tc </> name
-        basename = compiler_dir </> replaceBaseName tmppath (takeBaseName tmppath ++ modeFileSuffix mode)
-        cpath    = replaceExtension basename ".c"
-        exepath  = replaceExtension basename ".exe"
+    let (cpath, exepath) = buildPaths compiler_dir tc mode t
 
 
         -- The order of (++) is important. The PATH to the test file must always be at the end.
@@ -0,0 +1,73 @@
+{-# LANGUAGE TemplateHaskell #-}
+
+-- | Tests for ThreadRegions2
+module ThreadRegions where
+
+import Data.Map as M
+import Data.Set as S
+import Gibbon.Common hiding (FunDef)
+import Gibbon.NewL2.Syntax as L2
+import Gibbon.Passes.ThreadRegions2
+import Test.Tasty
+import Test.Tasty.HUnit
+import Test.Tasty.TH
+
+lrem :: Var -> Modality -> LREM
+lrem l mode = LREM (singleLocVar l) (SingleR "r1") (SingleR "end_r1") mode
+
+endOfReg :: LocArg
+endOfReg = EndOfReg (SingleR "r1") Output (SingleR "end_r1")
+
+check :: Var -> L2.Exp2 -> L2.Exp2
+check l = LetE ("_", [], MkTy2 IntTy, Ext $ BoundsCheck 18 endOfReg (Loc (lrem l Output)))
+
+countChecks :: L2.Exp2 -> Int
+countChecks ex =
+  case ex of
+    LetE (_, _, _, Ext BoundsCheck{}) bod -> 1 + countChecks bod
+    LetE (_, _, _, rhs) bod -> countChecks rhs + countChecks bod
+    IfE a b c -> countChecks a + countChecks b + countChecks c
+    Ext (LetLocE _ _ bod) -> countChecks bod
+    _ -> 0
+
+-- An indirection written right after a tag at the output location l0, and
+-- one written after the end of a value returned by a call.
+body :: L2.Exp2
+body =
+  Ext $ LetLocE (singleLocVar "l1") (AfterConstantLE 1 (Loc (lrem "l0" Output))) $
+    LetE ("x", [], MkTy2 (PackedTy "Foo" (singleLocVar "l1")),
+          Ext $ IndirectionE "Foo" "INDIRECTION"
+                  (Loc (lrem "l1" Output), endOfReg)
+                  (Loc (lrem "l9" Input), endOfReg)
+                  (VarE "y")) $
+    Ext $ LetLocE (singleLocVar "l2") (AfterVariableLE "z" (Loc (lrem "l1" Output)) True) $
+    LetE ("w", [], MkTy2 (PackedTy "Foo" (singleLocVar "l2")),
+          Ext $ IndirectionE "Foo" "INDIRECTION"
+                  (Loc (lrem "l2" Output), endOfReg)
+                  (Loc (lrem "l9" Input), endOfReg)
+                  (VarE "y")) $
+    VarE "w"
+
+-- What threadRegionsExp makes of it, with a check before every indirection.
+threaded :: L2.Exp2
+threaded =
+  Ext $ LetLocE (singleLocVar "l1") (AfterConstantLE 1 (Loc (lrem "l0" Output))) $
+    check "l1" $
+    LetE ("x", [], MkTy2 (PackedTy "Foo" (singleLocVar "l1")), VarE "y") $
+    Ext $ LetLocE (singleLocVar "l2") (AfterVariableLE "z" (Loc (lrem "l1" Output)) True) $
+    check "l2" $
+    LetE ("w", [], MkTy2 (PackedTy "Foo" (singleLocVar "l2")), VarE "y") $
+    VarE "w"
+
+-- Only the first indirection is at a known offset from l0.
+case_straight_line_writes :: Assertion
+case_straight_line_writes =
+  (10, S.singleton (singleLocVar "l1")) @=? straightLineWrites M.empty (singleLocVar "l0") body
+
+case_drop_covered_checks :: Assertion
+case_drop_covered_checks = do
+  2 @=? countChecks threaded
+  1 @=? countChecks (dropBoundsChecks (snd (straightLineWrites M.empty (singleLocVar "l0") body)) threaded)
+
+threadRegionsTests :: TestTree
+threadRegionsTests = $(testGroupGenerator)
@@ -1,6 +1,11 @@
 // The imports here must be kept in sync with
 // 'hashIncludes' in Gibbon.Passes.Codegen.
 
+// For sched_setaffinity.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "gibbon_rts.h"
 
 #include <assert.h>
@@ -22,6 +27,13 @@
 #include <errno.h>
 #include <uthash.h>
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 #ifdef _WIN64
 #include <windows.h>
 #endif
@@ -33,6 +45,7 @@
 #ifdef _GIBBON_PARALLEL
 #include <cilk/cilk.h>
 #include <cilk/cilk_api.h>
+#include <cilk/reducer.h>
 #endif
 
 
@@ -54,6 +67,15 @@ static char *gib_global_bench_prog_param = (char *) NULL;
 static char *gib_global_benchfile_param = (char *) NULL;
 static char *gib_global_arrayfile_param = (char *) NULL;
 static uint64_t gib_global_arrayfile_length_param = 0;
+static uint64_t gib_global_seed_param = 1;
+static char *gib_global_layout_profile_param = (char *) "gibbon_layout_profile.txt";
+static GibInt gib_global_warmup_param = 0;
+static double gib_global_bench_time_param = 0.0;
+static char *gib_global_bench_json_param = (char *) NULL;
+static GibInt gib_global_pin_core_param = -1;
+static bool gib_global_drop_caches_param = false;
+static char *gib_global_perf_counters_param = (char *) NULL;
+static bool gib_global_print_max_rss_param = false;
 
 // Number of regions allocated.
 static int64_t gib_global_region_count = 0;
@@ -118,6 +140,16 @@ uint64_t gib_read_arrayfile_length_param(void)
     return gib_global_arrayfile_length_param;
 }
 
+uint64_t gib_get_seed_param(void)
+{
+    return gib_global_seed_param;
+}
+
+char *gib_read_layout_profile_param(void)
+{
+    return gib_global_layout_profile_param;
+}
+
 int64_t gib_read_region_count(void)
 {
     return gib_global_region_count;
@@ -136,10 +168,160 @@ GibSym gib_read_gensym_counter(void)
 
 
 /*
- * If parallelism is enabled, we always use a nursery/malloc based allocator
- * since Boehm GC is not thread-safe in its default configuration. It can be
- * made thread-safe by building it with appropriate flags, but we don't do that.
- * Presently, all parallel pointer-based programs will leak memory.
+ * Chunked bump allocator, used by _GIBBON_BUMPALLOC_HEAP and
+ * _GIBBON_BUMPALLOC_LISTS. An arena is a linked list of mmap'd chunks; when
+ * the current chunk fills up, the next one is twice as big (up to
+ * GIB_BUMPALLOC_MAX_CHUNK_SIZE), or big enough for the request. Save points
+ * remember the current chunk and position, and nest without limit. Restoring
+ * one unlinks every chunk allocated since, releases its pages with
+ * madvise(MADV_DONTNEED), and keeps it around to be reused by later
+ * allocations.
+ */
+
+#if (defined _GIBBON_POINTER && defined _GIBBON_BUMPALLOC_HEAP) || defined _GIBBON_BUMPALLOC_LISTS
+
+#define GIB_BUMPALLOC_INIT_CHUNK_SIZE (1 * MB)
+#define GIB_BUMPALLOC_MAX_CHUNK_SIZE (64 * MB)
+
+typedef struct gib_bumpalloc_chunk {
+    struct gib_bumpalloc_chunk *prev;
+    size_t size;
+} GibBumpallocChunk;
+
+// Objects are 16 byte aligned, like malloc'd memory. Chunks are page
+// aligned, so it's enough to round the header and every request up.
+#define GIB_BUMPALLOC_ALIGN 16
+#define GIB_BUMPALLOC_CHUNK_HEADER_SIZE \
+    ((sizeof(GibBumpallocChunk) + GIB_BUMPALLOC_ALIGN - 1) & ~((size_t) GIB_BUMPALLOC_ALIGN - 1))
+
+typedef struct gib_bumpalloc_save_point {
+    GibBumpallocChunk *chunk;
+    char *ptr;
+} GibBumpallocSavePoint;
+
+typedef struct gib_bumpalloc_arena {
+    char *ptr;
+    char *end;
+    GibBumpallocChunk *chunk;
+    // Chunks released by a restore, linked through prev.
+    GibBumpallocChunk *spare;
+    GibBumpallocSavePoint *saved;
+    size_t num_saved;
+    size_t max_saved;
+} GibBumpallocArena;
+
+static GibBumpallocChunk *gib_bumpalloc_new_chunk(GibBumpallocArena *arena, size_t n)
+{
+    size_t need = GIB_BUMPALLOC_CHUNK_HEADER_SIZE + n;
+
+    // Reuse a spare chunk if one is big enough.
+    GibBumpallocChunk **link = &(arena->spare);
+    while (*link != NULL) {
+        GibBumpallocChunk *chunk = *link;
+        if (chunk->size >= need) {
+            *link = chunk->prev;
+            return chunk;
+        }
+        link = &(chunk->prev);
+    }
+
+    size_t size = GIB_BUMPALLOC_INIT_CHUNK_SIZE;
+    if (arena->chunk != NULL) {
+        size = arena->chunk->size * 2;
+        if (size > GIB_BUMPALLOC_MAX_CHUNK_SIZE) {
+            size = GIB_BUMPALLOC_MAX_CHUNK_SIZE;
+        }
+    }
+    if (size < need) {
+        size = (need + MB - 1) & ~((size_t) MB - 1);
+    }
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "gib_bumpalloc_new_chunk: mmap failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    GibBumpallocChunk *chunk = (GibBumpallocChunk *) mem;
+    chunk->size = size;
+#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
+    printf("gib_bumpalloc_new_chunk: %p, %zu bytes\n", mem, size);
+#endif
+    return chunk;
+}
+
+// Slow path of gib_bumpalloc, switch to a new chunk.
+static void *gib_bumpalloc_refill(GibBumpallocArena *arena, size_t n)
+{
+    GibBumpallocChunk *chunk = gib_bumpalloc_new_chunk(arena, n);
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    char *start = (char *) chunk + GIB_BUMPALLOC_CHUNK_HEADER_SIZE;
+    arena->ptr = start + n;
+    arena->end = (char *) chunk + chunk->size;
+    return start;
+}
+
+STATIC_INLINE void *gib_bumpalloc(GibBumpallocArena *arena, size_t n)
+{
+    n = (n + GIB_BUMPALLOC_ALIGN - 1) & ~((size_t) GIB_BUMPALLOC_ALIGN - 1);
+    if (LIKELY((size_t) (arena->end - arena->ptr) >= n)) {
+        char *old = arena->ptr;
+        arena->ptr += n;
+        return old;
+    }
+    return gib_bumpalloc_refill(arena, n);
+}
+
+static void gib_bumpalloc_save(GibBumpallocArena *arena)
+{
+    if (arena->num_saved == arena->max_saved) {
+        arena->max_saved = (arena->max_saved == 0) ? 16 : arena->max_saved * 2;
+        arena->saved = realloc(arena->saved,
+                               arena->max_saved * sizeof(GibBumpallocSavePoint));
+        if (arena->saved == NULL) {
+            fprintf(stderr, "gib_bumpalloc_save: realloc failed.\n");
+            exit(1);
+        }
+    }
+    arena->saved[arena->num_saved].chunk = arena->chunk;
+    arena->saved[arena->num_saved].ptr = arena->ptr;
+    arena->num_saved++;
+}
+
+// Returns false if there's no save point to restore.
+static bool gib_bumpalloc_restore(GibBumpallocArena *arena)
+{
+    if (arena->num_saved == 0) {
+        return false;
+    }
+    arena->num_saved--;
+    GibBumpallocSavePoint *sp = &(arena->saved[arena->num_saved]);
+    while (arena->chunk != sp->chunk) {
+        GibBumpallocChunk *chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        // Keep the header, it's needed to reuse the chunk.
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        madvise((char *) chunk + page, chunk->size - page, MADV_DONTNEED);
+        chunk->prev = arena->spare;
+        arena->spare = chunk;
+    }
+    if (arena->chunk == NULL) {
+        arena->ptr = NULL;
+        arena->end = NULL;
+    } else {
+        arena->ptr = sp->ptr;
+        arena->end = (char *) arena->chunk + arena->chunk->size;
+    }
+    return true;
+}
+
+#endif // _GIBBON_BUMPALLOC_HEAP || _GIBBON_BUMPALLOC_LISTS
+
+
+/*
+ * Pointer mode doesn't use Boehm GC, which isn't thread-safe in its default
+ * configuration. Boxed values are instead allocated from slabs (see below),
+ * and reclaimed in bulk between benchmark iterations.
  */
 
 #ifdef _GIBBON_POINTER
@@ -147,89 +329,331 @@ GibSym gib_read_gensym_counter(void)
 #ifdef _GIBBON_BUMPALLOC_HEAP
 #pragma message "Using bump allocator."
 
-static __thread char *gib_global_ptr_bumpalloc_heap_ptr = (char *) NULL;
-static __thread char *gib_global_ptr_bumpalloc_heap_ptr_end = (char *) NULL;
-static char *gib_global_ptr_saved_heap_ptr_stack[100];
-static int gib_global_ptr_num_saved_heap_ptr = 0;
+static __thread GibBumpallocArena gib_global_ptr_bumpalloc_arena;
+
+void *gib_alloc(size_t n)
+{
+    return gib_bumpalloc(&gib_global_ptr_bumpalloc_arena, n);
+}
+
+void gib_free(void *ptr) { (void) ptr; }
 
-// For simplicity just use a single large slab:
-static inline void gib_init_ptr_bumpalloc(void)
+// Snapshot the current thread's heap pointer.
+void gib_ptr_bumpalloc_save_state(void)
 {
-    gib_global_ptr_bumpalloc_heap_ptr =
-        (char*) malloc(gib_global_biginf_init_chunk_size);
-    gib_global_ptr_bumpalloc_heap_ptr_end =
-        gib_global_ptr_bumpalloc_heap_ptr + gib_global_biginf_init_chunk_size;
 #if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
-    printf("Arena size for bump alloc: %zu\n", gib_global_biginf_init_chunk_size);
-    printf("gib_init_ptr_bumpalloc DONE: heap_ptr = %p\n",
-           gib_global_ptr_bumpalloc_heap_ptr);
+    printf("Saving(%p): pos %zu\n", gib_global_ptr_bumpalloc_arena.ptr,
+           gib_global_ptr_bumpalloc_arena.num_saved);
 #endif
+    gib_bumpalloc_save(&gib_global_ptr_bumpalloc_arena);
 }
 
-static inline void *gib_ptr_bumpalloc(size_t n)
+void gib_ptr_bumpalloc_restore_state(void)
 {
-    if (! gib_global_ptr_bumpalloc_heap_ptr) {
-        gib_init_ptr_bumpalloc();
-    }
-    if (gib_global_ptr_bumpalloc_heap_ptr + n <
-        gib_global_ptr_bumpalloc_heap_ptr_end) {
-        char* old= gib_global_ptr_bumpalloc_heap_ptr;
-        gib_global_ptr_bumpalloc_heap_ptr += n;
-        return old;
-    } else {
-        fprintf(stderr, "Warning: bump allocator ran out of memory.");
+#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
+    printf("Restoring: pos %zu, discarding %p\n",
+           gib_global_ptr_bumpalloc_arena.num_saved,
+           gib_global_ptr_bumpalloc_arena.ptr);
+#endif
+    if (! gib_bumpalloc_restore(&gib_global_ptr_bumpalloc_arena)) {
+        fprintf(stderr, "Bad call to gib_ptr_bumpalloc_restore_state!  Saved stack empty!\n");
         exit(1);
     }
 }
 
-// Snapshot the current heap pointer value across all threads.
-void gib_ptr_bumpalloc_save_state(void)
+#else // ifdef _GIBBON_BUMPALLOC_HEAP
+
+/*
+ * Boxed values are allocated from per-thread, size-segregated slabs. Every
+ * size class (multiples of 16 bytes, up to GIB_PTR_MAX_SMALL) has its own
+ * chain of slabs that it bump allocates from, and a free list that gib_free
+ * pushes onto. Bigger objects go to malloc.
+ *
+ * Slabs are carved out of a single range of address space that's reserved
+ * up front, and are aligned to their size. Every slab starts with a header
+ * that records its size class and the heap that owns it. So gib_free tells
+ * slab objects from malloc'd ones with a range check, and finds the header
+ * by masking the address, without taking a lock. An object freed by a thread
+ * other than its owner goes back to the owner: it's pushed onto a list of
+ * remote frees, which the owner takes over once its own free list is empty.
+ *
+ * Slabs are never returned to the system. Instead, gib_ptr_bumpalloc_save_state
+ * and gib_ptr_bumpalloc_restore_state rewind every thread's size classes to
+ * an earlier position in their chains, which frees everything allocated in
+ * between at once. The benchmark loop does that after every iteration. The
+ * RTS allocates its own data structures (arenas, sets, GC snapshots etc.)
+ * with malloc, so that they survive a rewind.
+ */
+
+#define GIB_PTR_SLAB_SIZE (256 * KB)
+#define GIB_PTR_SIZE_CLASS_BYTES 16
+#define GIB_PTR_NUM_SIZE_CLASSES 16
+#define GIB_PTR_MAX_SMALL (GIB_PTR_NUM_SIZE_CLASSES * GIB_PTR_SIZE_CLASS_BYTES)
+// Address space reserved for slabs. Pages are only backed once they're used.
+#define GIB_PTR_SLAB_SPACE (64 * GB)
+#define GIB_PTR_MIN_SLAB_SPACE (1 * GB)
+
+struct gib_ptr_heap;
+
+typedef struct gib_ptr_slab {
+    struct gib_ptr_slab *next;
+    struct gib_ptr_heap *owner;
+    uint32_t size_class;
+} GibPtrSlab;
+
+// Objects start after the header, and stay aligned to the size classes.
+#define GIB_PTR_SLAB_HEADER_SIZE \
+    (((sizeof(GibPtrSlab) + GIB_PTR_SIZE_CLASS_BYTES - 1) / GIB_PTR_SIZE_CLASS_BYTES) * \
+     GIB_PTR_SIZE_CLASS_BYTES)
+
+typedef struct gib_ptr_size_class {
+    // Slabs in the order they were first used.
+    GibPtrSlab *first;
+    GibPtrSlab *last;
+    GibPtrSlab *current;
+    char *bump;
+    char *end;
+    void *free_list;
+    // Objects freed by other threads, pushed atomically.
+    void *remote_free_list;
+} GibPtrSizeClass;
+
+typedef struct gib_ptr_saved_class {
+    GibPtrSlab *current;
+    char *bump;
+} GibPtrSavedClass;
+
+typedef struct gib_ptr_heap {
+    GibPtrSizeClass classes[GIB_PTR_NUM_SIZE_CLASSES];
+    GibPtrSavedClass *saved;
+    size_t num_saved;
+    size_t max_saved;
+    struct gib_ptr_heap *next;
+} GibPtrHeap;
+
+static __thread GibPtrHeap *gib_global_ptr_heap = (GibPtrHeap *) NULL;
+// Every thread's heap.
+static GibPtrHeap *gib_global_ptr_heaps = (GibPtrHeap *) NULL;
+static size_t gib_global_ptr_num_saved = 0;
+// The address space for slabs, and the start of the next new slab in it.
+static char *gib_global_ptr_slab_space_start = (char *) NULL;
+static char *gib_global_ptr_slab_space_end = (char *) NULL;
+static char *gib_global_ptr_slab_space_next = (char *) NULL;
+#ifdef _GIBBON_PARALLEL
+static bool gib_global_ptr_heaps_lock = false;
+#endif
+
+STATIC_INLINE void gib_ptr_heaps_lock(void)
 {
-#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
-    printf("Saving(%p): pos %d", heap_ptr, gib_global_ptr_num_saved_heap_ptr);
+#ifdef _GIBBON_PARALLEL
+    while (__atomic_test_and_set(&gib_global_ptr_heaps_lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&gib_global_ptr_heaps_lock, __ATOMIC_RELAXED)) ;
+    }
 #endif
-    char *heap_ptr = gib_global_ptr_bumpalloc_heap_ptr;
-    gib_global_ptr_saved_heap_ptr_stack[gib_global_ptr_num_saved_heap_ptr] = heap_ptr;
-    gib_global_ptr_num_saved_heap_ptr++;
-#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
-    printf("\n");
+}
+
+STATIC_INLINE void gib_ptr_heaps_unlock(void)
+{
+#ifdef _GIBBON_PARALLEL
+    __atomic_clear(&gib_global_ptr_heaps_lock, __ATOMIC_RELEASE);
 #endif
 }
 
-void gib_ptr_bumpalloc_restore_state(void)
+// Reserve the address space for slabs, less of it if the system won't give
+// us that much. Called with the heaps lock held.
+static void gib_ptr_reserve_slab_space(void)
 {
-    if(gib_global_ptr_num_saved_heap_ptr <= 0) {
-        fprintf(stderr, "Bad call to gib_ptr_bumpalloc_restore_state!  Saved stack empty!\ne");
+    size_t size = GIB_PTR_SLAB_SPACE;
+    void *mem = MAP_FAILED;
+    while (mem == MAP_FAILED && size >= GIB_PTR_MIN_SLAB_SPACE) {
+        mem = mmap(NULL, size + GIB_PTR_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) {
+            size /= 2;
+        }
+    }
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "gib_ptr_reserve_slab_space: mmap failed: %s\n", strerror(errno));
         exit(1);
     }
-    gib_global_ptr_num_saved_heap_ptr--;
-#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
-    printf("Restoring(%p): pos %d, discarding %p",
-           gib_global_ptr_saved_heap_ptr_stack[gib_global_ptr_num_saved_heap_ptr],
-           gib_global_ptr_num_saved_heap_ptr,
-           gib_global_ptr_bumpalloc_heap_ptr);
-#endif
-    gib_global_ptr_bumpalloc_heap_ptr =
-        gib_global_ptr_saved_heap_ptr_stack[gib_global_ptr_num_saved_heap_ptr];
+    char *start = (char *) (((uintptr_t) mem + GIB_PTR_SLAB_SIZE - 1) &
+                            ~((uintptr_t) GIB_PTR_SLAB_SIZE - 1));
+    gib_global_ptr_slab_space_next = start;
+    gib_global_ptr_slab_space_end = start + size;
+    __atomic_store_n(&gib_global_ptr_slab_space_start, start, __ATOMIC_RELEASE);
 }
 
-void *gib_alloc(size_t n) { return gib_ptr_bumpalloc(n); }
-void gib_free(void *ptr) {}
+static GibPtrHeap *gib_ptr_init_heap(void)
+{
+    GibPtrHeap *heap = (GibPtrHeap *) calloc(1, sizeof(GibPtrHeap));
+    if (heap == NULL) {
+        fprintf(stderr, "gib_ptr_init_heap: calloc failed: %zu", sizeof(GibPtrHeap));
+        exit(1);
+    }
+    gib_ptr_heaps_lock();
+    if (gib_global_ptr_slab_space_start == NULL) {
+        gib_ptr_reserve_slab_space();
+    }
+    heap->next = gib_global_ptr_heaps;
+    gib_global_ptr_heaps = heap;
+    gib_ptr_heaps_unlock();
+    gib_global_ptr_heap = heap;
+    return heap;
+}
 
-#else // ifdef _GIBBON_BUMPALLOC_HEAP
+// Move on to the next slab in the chain, carving out a new one if there's none.
+static void gib_ptr_next_slab(GibPtrHeap *heap, GibPtrSizeClass *cls, uint32_t size_class)
+{
+    GibPtrSlab *next = (cls->current == NULL) ? cls->first : cls->current->next;
+    if (next == NULL) {
+        gib_ptr_heaps_lock();
+        char *start = gib_global_ptr_slab_space_next;
+        if (start + GIB_PTR_SLAB_SIZE > gib_global_ptr_slab_space_end) {
+            fprintf(stderr, "gib_ptr_next_slab: out of memory.\n");
+            exit(1);
+        }
+        gib_global_ptr_slab_space_next = start + GIB_PTR_SLAB_SIZE;
+        gib_ptr_heaps_unlock();
+        next = (GibPtrSlab *) start;
+        next->next = NULL;
+        next->owner = heap;
+        next->size_class = size_class;
+        if (cls->last == NULL) {
+            cls->first = next;
+        } else {
+            cls->last->next = next;
+        }
+        cls->last = next;
+    }
+    cls->current = next;
+    cls->bump = (char *) next + GIB_PTR_SLAB_HEADER_SIZE;
+    cls->end = (char *) next + GIB_PTR_SLAB_SIZE;
+}
 
-void gib_ptr_bumpalloc_save_state(void) {}
-void gib_ptr_bumpalloc_restore_state(void) {}
+void *gib_alloc(size_t n)
+{
+    if (UNLIKELY(n > GIB_PTR_MAX_SMALL)) {
+        return malloc(n);
+    }
+    GibPtrHeap *heap = gib_global_ptr_heap;
+    if (UNLIKELY(heap == NULL)) {
+        heap = gib_ptr_init_heap();
+    }
+    uint32_t size_class = (n == 0) ? 0 : (n - 1) / GIB_PTR_SIZE_CLASS_BYTES;
+    GibPtrSizeClass *cls = &(heap->classes[size_class]);
+    if (UNLIKELY(cls->free_list == NULL &&
+                 __atomic_load_n(&(cls->remote_free_list), __ATOMIC_RELAXED) != NULL)) {
+        cls->free_list = __atomic_exchange_n(&(cls->remote_free_list), NULL, __ATOMIC_ACQUIRE);
+    }
+    if (cls->free_list != NULL) {
+        void *obj = cls->free_list;
+        cls->free_list = *(void **) obj;
+        return obj;
+    }
+    size_t size = (size_class + 1) * GIB_PTR_SIZE_CLASS_BYTES;
+    if (UNLIKELY(cls->bump + size > cls->end)) {
+        gib_ptr_next_slab(heap, cls, size_class);
+    }
+    void *obj = cls->bump;
+    cls->bump += size;
+    return obj;
+}
 
-#ifndef _GIBBON_PARALLEL
-// void *gib_alloc(size_t n) { return GC_MALLOC(n); }
-// void gib_free(void *ptr) { GC_FREE(ptr); }
-void *gib_alloc(size_t n) { return malloc(n); }
-void gib_free(void *ptr) { free(ptr); }
-#else // ifndef _GIBBON_PARALLEL
-void *gib_alloc(size_t n) { return malloc(n); }
-void gib_free(void *ptr) { free(ptr); }
-#endif // ifndef _GIBBON_PARALLEL
+void gib_free(void *ptr)
+{
+    char *space_start = __atomic_load_n(&gib_global_ptr_slab_space_start, __ATOMIC_ACQUIRE);
+    if ((char *) ptr < space_start || (char *) ptr >= gib_global_ptr_slab_space_end) {
+        // Also covers NULL.
+        free(ptr);
+        return;
+    }
+    GibPtrSlab *slab = (GibPtrSlab *) ((uintptr_t) ptr & ~((uintptr_t) GIB_PTR_SLAB_SIZE - 1));
+    GibPtrSizeClass *cls = &(slab->owner->classes[slab->size_class]);
+    if (LIKELY(slab->owner == gib_global_ptr_heap)) {
+        *(void **) ptr = cls->free_list;
+        cls->free_list = ptr;
+        return;
+    }
+    void *head = __atomic_load_n(&(cls->remote_free_list), __ATOMIC_RELAXED);
+    do {
+        *(void **) ptr = head;
+    } while (!__atomic_compare_exchange_n(&(cls->remote_free_list), &head, ptr, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void gib_ptr_push_saved(GibPtrHeap *heap, GibPtrSlab *current, char *bump, size_t i)
+{
+    if (heap->num_saved == heap->max_saved) {
+        heap->max_saved = (heap->max_saved == 0) ? 8 : (heap->max_saved * 2);
+        heap->saved = (GibPtrSavedClass *)
+            realloc(heap->saved, heap->max_saved * GIB_PTR_NUM_SIZE_CLASSES * sizeof(GibPtrSavedClass));
+        if (heap->saved == NULL) {
+            fprintf(stderr, "gib_ptr_bumpalloc_save_state: realloc failed.\n");
+            exit(1);
+        }
+    }
+    GibPtrSavedClass *saved = &(heap->saved[heap->num_saved * GIB_PTR_NUM_SIZE_CLASSES + i]);
+    saved->current = current;
+    saved->bump = bump;
+}
+
+// Snapshot the position of every thread's heap. Must not be called while
+// other threads are allocating.
+void gib_ptr_bumpalloc_save_state(void)
+{
+    gib_ptr_heaps_lock();
+    for (GibPtrHeap *heap = gib_global_ptr_heaps; heap != NULL; heap = heap->next) {
+        // Heaps that were created after earlier snapshots start out empty.
+        while (heap->num_saved <= gib_global_ptr_num_saved) {
+            bool is_current = (heap->num_saved == gib_global_ptr_num_saved);
+            for (size_t i = 0; i < GIB_PTR_NUM_SIZE_CLASSES; i++) {
+                GibPtrSizeClass *cls = &(heap->classes[i]);
+                gib_ptr_push_saved(heap,
+                                   is_current ? cls->current : NULL,
+                                   is_current ? cls->bump : NULL,
+                                   i);
+            }
+            heap->num_saved++;
+        }
+    }
+    gib_global_ptr_num_saved++;
+    gib_ptr_heaps_unlock();
+}
+
+// Free everything allocated since the last snapshot.
+void gib_ptr_bumpalloc_restore_state(void)
+{
+    if (gib_global_ptr_num_saved == 0) {
+        fprintf(stderr, "Bad call to gib_ptr_bumpalloc_restore_state!  Saved stack empty!\n");
+        exit(1);
+    }
+    gib_ptr_heaps_lock();
+    gib_global_ptr_num_saved--;
+    for (GibPtrHeap *heap = gib_global_ptr_heaps; heap != NULL; heap = heap->next) {
+        bool has_saved = (heap->num_saved > gib_global_ptr_num_saved);
+        if (has_saved) {
+            heap->num_saved = gib_global_ptr_num_saved;
+        }
+        for (size_t i = 0; i < GIB_PTR_NUM_SIZE_CLASSES; i++) {
+            GibPtrSizeClass *cls = &(heap->classes[i]);
+            if (has_saved) {
+                GibPtrSavedClass *saved =
+                    &(heap->saved[gib_global_ptr_num_saved * GIB_PTR_NUM_SIZE_CLASSES + i]);
+                cls->current = saved->current;
+                cls->bump = saved->bump;
+            } else {
+                cls->current = NULL;
+                cls->bump = NULL;
+            }
+            cls->end = (cls->current == NULL) ? NULL : ((char *) cls->current + GIB_PTR_SLAB_SIZE);
+            // Objects on the free lists may have been allocated since the
+            // snapshot, so the lists can't be trusted anymore.
+            cls->free_list = NULL;
+            cls->remote_free_list = NULL;
+        }
+    }
+    gib_ptr_heaps_unlock();
+}
 
 #endif // ifdef _GIBBON_BUMPALLOC_HEAP
 
@@ -262,58 +686,248 @@ void *gib_scoped_alloc(size_t n) { return alloca(n); }
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  */
 
+STATIC_INLINE char *gib_arena_chunk_start(GibArenaChunk *chunk)
+{
+    return (char *) (chunk + 1);
+}
+
+static GibArenaChunk *gib_arena_alloc_chunk(GibArenaChunk *prev, size_t size)
+{
+    GibArenaChunk *chunk = (GibArenaChunk *) malloc(sizeof(GibArenaChunk) + size);
+    if (chunk == NULL) {
+        fprintf(stderr, "gib_arena_alloc_chunk: malloc failed: %zu", size);
+        exit(1);
+    }
+    chunk->prev = prev;
+    chunk->size = size;
+    return chunk;
+}
+
 GibArena *gib_alloc_arena(void)
 {
-    GibArena *ar = gib_alloc(sizeof(GibArena));
+    GibArena *ar = (GibArena *) malloc(sizeof(GibArena));
+    ar->chunk = gib_arena_alloc_chunk(NULL, GIB_ARENA_INIT_CHUNK_SIZE);
     ar->ind = 0;
-    ar->mem = (char *) gib_alloc(GIB_MAX_CHUNK_SIZE);
-    ar->reflist = 0;
+    ar->reflist = NULL;
     return ar;
 }
 
+// Free everything allocated after the mark, most recent first. Ref cells
+// live inside the chunks, so they have to be processed before the chunks go.
+static void gib_arena_release(GibArena *ar, GibArenaChunk *chunk, GibArenaRef *reflist)
+{
+    GibArenaRef *ref = ar->reflist;
+    while (ref != reflist) {
+        gib_free(ref->ptr);
+        ref = ref->next;
+    }
+    ar->reflist = reflist;
+    GibArenaChunk *cur = ar->chunk;
+    while (cur != chunk) {
+        GibArenaChunk *prev = cur->prev;
+        free(cur);
+        cur = prev;
+    }
+    ar->chunk = chunk;
+}
+
 void gib_free_arena(GibArena *ar)
 {
-    gib_free(ar->mem);
-    // TODO(vollmerm): free everything in ar->reflist
-    gib_free(ar);
+    gib_arena_release(ar, NULL, NULL);
+    free(ar);
     return;
 }
 
 GibCursor gib_extend_arena(GibArena *ar, int size)
 {
-    GibCursor ret = ar->mem + ar->ind;
-    ar->ind += size;
+    if (UNLIKELY(size < 0)) {
+        fprintf(stderr, "gib_extend_arena: invalid size %d\n", size);
+        exit(1);
+    }
+    size_t bytes = ((size_t) size + (GIB_ARENA_ALIGN - 1)) & ~((size_t) GIB_ARENA_ALIGN - 1);
+    if (UNLIKELY((ar->ind + bytes) > ar->chunk->size)) {
+        size_t chunk_size = ar->chunk->size * 2;
+        if (chunk_size > GIB_ARENA_MAX_CHUNK_SIZE) {
+            chunk_size = GIB_ARENA_MAX_CHUNK_SIZE;
+        }
+        if (chunk_size < bytes) {
+            chunk_size = bytes;
+        }
+#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
+        printf("Growing arena %p: new chunk of %zu bytes.\n", (void *) ar, chunk_size);
+#endif
+        ar->chunk = gib_arena_alloc_chunk(ar->chunk, chunk_size);
+        ar->ind = 0;
+    }
+    GibCursor ret = gib_arena_chunk_start(ar->chunk) + ar->ind;
+    ar->ind += bytes;
     return ret;
 }
 
+void gib_arena_add_ref(GibArena *ar, void *ptr)
+{
+    GibArenaRef *ref = (GibArenaRef *) gib_extend_arena(ar, sizeof(GibArenaRef));
+    ref->ptr = ptr;
+    ref->next = ar->reflist;
+    ar->reflist = ref;
+}
+
+GibArenaMark gib_arena_mark(GibArena *ar)
+{
+    GibArenaMark mark = { ar->chunk, ar->ind, ar->reflist };
+    return mark;
+}
+
+// Roll the arena back to a mark, freeing all chunks and references which
+// were added after it. Anything allocated after the mark becomes invalid.
+void gib_arena_reset(GibArena *ar, GibArenaMark mark)
+{
+    gib_arena_release(ar, mark.chunk, mark.reflist);
+    ar->ind = mark.ind;
+}
+
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * Arena-based dictionaries
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  */
 
+// Symbols are handed out sequentially by gensym, so spread them over all
+// 64 bits before indexing. This is the splitmix64 finalizer, which is a
+// bijection: distinct keys always have distinct hashes and the trie never
+// needs collision nodes.
+STATIC_INLINE uint64_t gib_dict_hash(GibSym key)
+{
+    uint64_t h = key;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
 
-GibSymDict *gib_dict_alloc(GibArena *ar)
+STATIC_INLINE uint32_t gib_dict_frag(uint64_t hash, int shift)
 {
-    return (GibSymDict *) gib_extend_arena(ar, sizeof(GibSymDict));
+    return (uint32_t) ((hash >> shift) & GIB_DICT_MASK);
 }
 
-GibSymDict *gib_dict_insert_ptr(GibArena *ar, GibSymDict *ptr, GibSym key, GibPtr val)
+STATIC_INLINE int gib_dict_index(uint32_t bitmap, uint32_t bit)
+{
+    return __builtin_popcount(bitmap & (bit - 1));
+}
+
+GibSymDict *gib_dict_alloc(GibArena *ar, int num_slots)
+{
+    return (GibSymDict *) gib_extend_arena(ar, sizeof(GibSymDict) +
+                                               num_slots * sizeof(GibSymDictSlot));
+}
+
+// Build the smallest subtrie holding two distinct keys.
+static GibSymDict *gib_dict_pair(GibArena *ar, int shift,
+                                 GibSym key1, uint64_t hash1, void *val1,
+                                 GibSym key2, uint64_t hash2, void *val2)
+{
+    uint32_t frag1 = gib_dict_frag(hash1, shift);
+    uint32_t frag2 = gib_dict_frag(hash2, shift);
+    if (frag1 == frag2) {
+        GibSymDict *node = gib_dict_alloc(ar, 1);
+        node->bitmap = 1U << frag1;
+        node->leafmap = 0;
+        node->slots[0].key = 0;
+        node->slots[0].val = gib_dict_pair(ar, shift + GIB_DICT_BITS,
+                                           key1, hash1, val1,
+                                           key2, hash2, val2);
+        return node;
+    }
+    GibSymDict *node = gib_dict_alloc(ar, 2);
+    node->bitmap = (1U << frag1) | (1U << frag2);
+    node->leafmap = node->bitmap;
+    int fst = frag1 < frag2 ? 0 : 1;
+    node->slots[fst].key = key1;
+    node->slots[fst].val = val1;
+    node->slots[1-fst].key = key2;
+    node->slots[1-fst].val = val2;
+    return node;
+}
+
+// Copy a node, leaving room for one extra slot at index 'hole' if 'grow' is set.
+static GibSymDict *gib_dict_copy_node(GibArena *ar, GibSymDict *node,
+                                      bool grow, int hole)
+{
+    int n = __builtin_popcount(node->bitmap);
+    GibSymDict *ret = gib_dict_alloc(ar, grow ? n + 1 : n);
+    ret->bitmap = node->bitmap;
+    ret->leafmap = node->leafmap;
+    if (grow) {
+        memcpy(ret->slots, node->slots, hole * sizeof(GibSymDictSlot));
+        memcpy(ret->slots + hole + 1, node->slots + hole,
+               (n - hole) * sizeof(GibSymDictSlot));
+    } else {
+        memcpy(ret->slots, node->slots, n * sizeof(GibSymDictSlot));
+    }
+    return ret;
+}
+
+static GibSymDict *gib_dict_insert_rec(GibArena *ar, GibSymDict *node, int shift,
+                                       GibSym key, uint64_t hash, void *val)
 {
-    GibSymDict *ret = gib_dict_alloc(ar);
-    ret->key = key;
-    ret->ptrval = val;
-    ret->next = ptr;
+    uint32_t bit = 1U << gib_dict_frag(hash, shift);
+    int idx = gib_dict_index(node->bitmap, bit);
+    GibSymDict *ret;
+    if (!(node->bitmap & bit)) {
+        ret = gib_dict_copy_node(ar, node, true, idx);
+        ret->bitmap |= bit;
+        ret->leafmap |= bit;
+        ret->slots[idx].key = key;
+        ret->slots[idx].val = val;
+        return ret;
+    }
+    ret = gib_dict_copy_node(ar, node, false, 0);
+    GibSymDictSlot *slot = &(ret->slots[idx]);
+    if (!(node->leafmap & bit)) {
+        slot->val = gib_dict_insert_rec(ar, (GibSymDict *) slot->val,
+                                        shift + GIB_DICT_BITS, key, hash, val);
+    } else if (slot->key == key) {
+        slot->val = val;
+    } else {
+        slot->val = gib_dict_pair(ar, shift + GIB_DICT_BITS,
+                                  slot->key, gib_dict_hash(slot->key), slot->val,
+                                  key, hash, val);
+        slot->key = 0;
+        ret->leafmap &= ~bit;
+    }
     return ret;
 }
 
+GibSymDict *gib_dict_insert_ptr(GibArena *ar, GibSymDict *ptr, GibSym key, GibPtr val)
+{
+    uint64_t hash = gib_dict_hash(key);
+    if (ptr == NULL) {
+        GibSymDict *ret = gib_dict_alloc(ar, 1);
+        ret->bitmap = 1U << gib_dict_frag(hash, 0);
+        ret->leafmap = ret->bitmap;
+        ret->slots[0].key = key;
+        ret->slots[0].val = val;
+        return ret;
+    }
+    return gib_dict_insert_rec(ar, ptr, 0, key, hash, val);
+}
+
 GibPtr gib_dict_lookup_ptr(GibSymDict *ptr, GibSym key)
 {
-    while (ptr != 0) {
-        if (ptr->key == key) {
-            return ptr->ptrval;
-        } else {
-            ptr = ptr->next;
+    uint64_t hash = gib_dict_hash(key);
+    int shift = 0;
+    while (ptr != NULL) {
+        uint32_t bit = 1U << gib_dict_frag(hash, shift);
+        if (!(ptr->bitmap & bit)) {
+            break;
+        }
+        GibSymDictSlot *slot = &(ptr->slots[gib_dict_index(ptr->bitmap, bit)]);
+        if (ptr->leafmap & bit) {
+            if (slot->key == key) {
+                return slot->val;
+            }
+            break;
         }
+        ptr = (GibSymDict *) slot->val;
+        shift += GIB_DICT_BITS;
     }
     fprintf(stderr, "Error, key %" PRId64 " not found!\n",key);
     exit(1);
@@ -335,7 +949,7 @@ GibSymSet *gib_insert_set(GibSymSet *set, int sym)
     GibSymSet *s;
     HASH_FIND_INT(set, &sym, s);  /* sym already in the hash? */
     if (s==NULL) {
-        s = (GibSymSet *) gib_alloc(sizeof(GibSymSet));
+        s = (GibSymSet *) malloc(sizeof(GibSymSet));
         s->val = sym;
         HASH_ADD_INT(set,val,s);
     }
@@ -364,7 +978,7 @@ GibSymHash *gib_insert_hash(GibSymHash *hash, int k, int v)
 {
     GibSymHash *s;
     // NOTE: not checking for duplicates!
-    s = (GibSymHash *) gib_alloc(sizeof(GibSymHash));
+    s = (GibSymHash *) malloc(sizeof(GibSymHash));
     s->val = v;
     s->key = k;
     HASH_ADD_INT(hash,key,s);
@@ -393,131 +1007,520 @@ GibBool gib_contains_hash(GibSymHash *hash, int sym)
 
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * Symbol table
+ * Printing
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  */
 
-static GibSym newline_symbol = -1;
-static GibSym space_symbol = -1;
-static GibSym comma_symbol = -1;
-static GibSym leftparen_symbol = -1;
-static GibSym rightparen_symbol = -1;
+#ifdef _GIBBON_PARALLEL
 
+// Under --parallel the output is a Cilk reducer, so that it comes out in the
+// same order as in a sequential run. Every strand appends to its own view,
+// and the views are concatenated in serial order when strands sync. Only the
+// leftmost view, which is stored in the reducer itself, precedes all other
+// output; it's the only one that is ever written to stdout.
+typedef struct gib_print_view {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool leftmost;
+    // Only taken for the leftmost view, see gib_flush_stdout_at_exit.
+    bool lock;
+} GibPrintView;
+
+static void gib_print_view_identity(void *reducer, void *view);
+static void gib_print_view_reduce(void *reducer, void *left, void *right);
+static void gib_print_view_destroy(void *reducer, void *view);
+
+static CILK_C_DECLARE_REDUCER(GibPrintView) gib_global_print_reducer =
+    CILK_C_INIT_REDUCER(GibPrintView,
+                        gib_print_view_reduce,
+                        gib_print_view_identity,
+                        gib_print_view_destroy,
+                        { NULL, 0, 0, true, false });
+
+STATIC_INLINE void gib_print_view_lock(GibPrintView *view)
+{
+    while (__atomic_test_and_set(&(view->lock), __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&(view->lock), __ATOMIC_RELAXED)) ;
+    }
+}
 
-// important! initialize to NULL
-static GibSymtable *global_sym_table = (GibSymtable *) NULL;
+STATIC_INLINE void gib_print_view_unlock(GibPrintView *view)
+{
+    __atomic_clear(&(view->lock), __ATOMIC_RELEASE);
+}
 
-void gib_add_symbol(GibSym idx, char *value)
+// Must be called with the view locked.
+static void gib_print_view_write(GibPrintView *view)
 {
-    GibSymtable *s;
-    s = (GibSymtable *) gib_alloc(sizeof(GibSymtable));
-    s->idx = idx;
-    strcpy(s->value, value);
-    HASH_ADD(hh, global_sym_table, idx, sizeof(GibSym), s);
-    if (idx > gib_global_gensym_counter) {
-        gib_global_gensym_counter = idx;
+    if (view->len > 0) {
+        fwrite(view->data, 1, view->len, stdout);
+        view->len = 0;
     }
-    return;
 }
 
-void gib_set_newline(GibSym idx)
+static void gib_print_view_identity(void *reducer, void *view)
 {
-    newline_symbol = idx;
-    gib_add_symbol(idx,"NEWLINE");
-    return;
+    (void) reducer;
+    *(GibPrintView *) view = (GibPrintView) { NULL, 0, 0, false, false };
 }
 
-void gib_set_space(GibSym idx)
+static void gib_print_view_append(GibPrintView *view, const char *str, size_t len)
 {
-    space_symbol = idx;
-    gib_add_symbol(idx,"SPACE");
-    return;
+    if (view->leftmost) {
+        gib_print_view_lock(view);
+        if (UNLIKELY((view->len + len) > view->cap)) {
+            gib_print_view_write(view);
+        }
+        if (UNLIKELY(len > view->cap)) {
+            fwrite(str, 1, len, stdout);
+        } else {
+            memcpy(view->data + view->len, str, len);
+            view->len += len;
+        }
+        gib_print_view_unlock(view);
+        return;
+    }
+    // The other views can't be written out before they are merged, so
+    // they grow instead.
+    if (UNLIKELY((view->len + len) > view->cap)) {
+        size_t cap = view->cap == 0 ? 256 : view->cap * 2;
+        while (cap < (view->len + len)) {
+            cap *= 2;
+        }
+        char *data = (char *) realloc(view->data, cap);
+        if (data == NULL) {
+            fprintf(stderr, "gib_print_view_append: realloc failed: %zu", cap);
+            exit(1);
+        }
+        view->data = data;
+        view->cap = cap;
+    }
+    memcpy(view->data + view->len, str, len);
+    view->len += len;
 }
 
-void gib_set_comma(GibSym idx)
+static void gib_print_view_reduce(void *reducer, void *left, void *right)
 {
-    comma_symbol = idx;
-    gib_add_symbol(idx,"COMMA");
-    return;
+    (void) reducer;
+    GibPrintView *r = (GibPrintView *) right;
+    gib_print_view_append((GibPrintView *) left, r->data, r->len);
+    r->len = 0;
 }
 
-void gib_set_leftparen(GibSym idx)
+static void gib_print_view_destroy(void *reducer, void *view)
 {
-    leftparen_symbol = idx;
-    gib_add_symbol(idx,"LEFTPAREN");
-    return;
+    (void) reducer;
+    free(((GibPrintView *) view)->data);
 }
 
-void gib_set_rightparen(GibSym idx)
+// Called from a strand other than the leftmost one, this doesn't write out
+// anything, the output isn't in order yet.
+void gib_flush_stdout(void)
 {
-    rightparen_symbol = idx;
-    gib_add_symbol(idx,"RIGHTPAREN");
-    return;
+    GibPrintView *view = &REDUCER_VIEW(gib_global_print_reducer);
+    if (view->leftmost) {
+        gib_print_view_lock(view);
+        gib_print_view_write(view);
+        gib_print_view_unlock(view);
+    }
+    fflush(stdout);
 }
 
-int gib_print_symbol(GibSym idx)
+// Registered with atexit. exit may be called by any worker while the others
+// are still printing, so this only writes out the leftmost view, under its
+// lock. Output of strands that haven't synced yet is lost.
+static void gib_flush_stdout_at_exit(void)
 {
-    if (idx == comma_symbol) {
-        return printf(",");
-    } else if (idx == newline_symbol) {
-        return printf("\n");
-    } else if (idx == space_symbol) {
-        return printf(" ");
-    } else if (idx == leftparen_symbol) {
-        return printf("(");
-    } else if (idx == rightparen_symbol) {
-        return printf(")");
-    } else {
-        GibSymtable *s;
-        HASH_FIND(hh, global_sym_table, &idx, sizeof(GibSym), s);
-        if (s == NULL) {
-            return printf("%" PRId64, idx);
-        } else {
-            return printf("%s", s->value);
-        }
+    GibPrintView *view = &(gib_global_print_reducer.value);
+    gib_print_view_lock(view);
+    gib_print_view_write(view);
+    gib_print_view_unlock(view);
+    fflush(stdout);
+}
 
+static void gib_print_init(void)
+{
+    GibPrintView *view = &(gib_global_print_reducer.value);
+    view->data = (char *) malloc(GIB_PRINT_BUFFER_SIZE);
+    if (view->data == NULL) {
+        fprintf(stderr, "gib_print_init: malloc failed: %zu", (size_t) GIB_PRINT_BUFFER_SIZE);
+        exit(1);
     }
+    view->cap = GIB_PRINT_BUFFER_SIZE;
+    CILK_C_REGISTER_REDUCER(gib_global_print_reducer);
+    atexit(gib_flush_stdout_at_exit);
 }
 
-GibSym gib_gensym(void)
+int gib_print_bytes(const char *str, size_t len)
 {
-    GibSym idx;
-#ifdef _GIBBON_PARALLEL
-    idx = __atomic_add_fetch(&gib_global_gensym_counter, 1, __ATOMIC_SEQ_CST);
-#else
-    gib_global_gensym_counter += 1;
-    idx = gib_global_gensym_counter;
-#endif
-    return idx;
+    gib_print_view_append(&REDUCER_VIEW(gib_global_print_reducer), str, len);
+    return (int) len;
 }
 
+#else
+
+static GibPrintBuffer gib_global_print_buffer;
 
-void gib_free_symtable(void)
+static void gib_print_buffer_flush(GibPrintBuffer *buf)
 {
-    GibSymtable *elt, *tmp;
-    HASH_ITER(hh, global_sym_table, elt, tmp) {
-        HASH_DEL(global_sym_table,elt);
-        gib_free(elt);
+    if (buf->len > 0) {
+        fwrite(buf->data, 1, buf->len, stdout);
+        buf->len = 0;
     }
-    return;
 }
 
+void gib_flush_stdout(void)
+{
+    gib_print_buffer_flush(&gib_global_print_buffer);
+    fflush(stdout);
+}
 
-GibCursor *gib_array_alloc(GibCursor *arr, size_t size)
+static void gib_print_init(void)
 {
+    // Don't lose buffered output if the program exits early.
+    atexit(gib_flush_stdout);
+}
 
-    GibCursor *arr_on_heap = (GibCursor *) malloc(sizeof(GibCursor) * size);
-    if (arr_on_heap == NULL) {
-        fprintf(stderr, "gib_array_alloc: malloc failed: %zu", sizeof(GibCursor) * size);
-        exit(1);
+// Returns a pointer to at least 'len' free bytes in the buffer.
+STATIC_INLINE char *gib_print_reserve(GibPrintBuffer *buf, size_t len)
+{
+    if (UNLIKELY((buf->len + len) > GIB_PRINT_BUFFER_SIZE)) {
+        gib_print_buffer_flush(buf);
     }
+    return buf->data + buf->len;
+}
 
-    #pragma GCC unroll 2
-    for (size_t i = 0; i < size; i++){
-        arr_on_heap[i] = arr[i];
+int gib_print_bytes(const char *str, size_t len)
+{
+    GibPrintBuffer *buf = &gib_global_print_buffer;
+    if (UNLIKELY(len > GIB_PRINT_BUFFER_SIZE)) {
+        gib_print_buffer_flush(buf);
+        fwrite(str, 1, len, stdout);
+        return (int) len;
     }
+    memcpy(gib_print_reserve(buf, len), str, len);
+    buf->len += len;
+    return (int) len;
+}
+
+#endif // _GIBBON_PARALLEL
+
+int gib_print_string(const char *str)
+{
+    return gib_print_bytes(str, strlen(str));
+}
+
+static const char gib_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes the digits of n backwards, ending just before 'end', and returns a
+// pointer to the first digit.
+STATIC_INLINE char *gib_format_uint(char *end, uint64_t n)
+{
+    while (n >= 100) {
+        uint64_t i = (n % 100) * 2;
+        n /= 100;
+        *--end = gib_digit_pairs[i + 1];
+        *--end = gib_digit_pairs[i];
+    }
+    if (n >= 10) {
+        *--end = gib_digit_pairs[n * 2 + 1];
+        *--end = gib_digit_pairs[n * 2];
+    } else {
+        *--end = (char) ('0' + n);
+    }
+    return end;
+}
+
+int gib_print_int(GibInt n)
+{
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *start;
+    if (n < 0) {
+        start = gib_format_uint(end, - (uint64_t) n);
+        *--start = '-';
+    } else {
+        start = gib_format_uint(end, (uint64_t) n);
+    }
+    return gib_print_bytes(start, end - start);
+}
+
+// Same output as printf("%.2f"). Values for which scaling by 100 could round
+// differently from printf (big numbers, or a third decimal close to 5) go
+// through snprintf.
+int gib_print_float(double f)
+{
+    double mag = fabs(f);
+    if (LIKELY(mag < 1e7)) {
+        double scaled = mag * 100.0;
+        double whole = floor(scaled);
+        double frac = scaled - whole;
+        if (LIKELY(fabs(frac - 0.5) > 1e-6)) {
+            uint64_t cents = (uint64_t) whole + (frac > 0.5);
+            char tmp[24];
+            char *end = tmp + sizeof(tmp);
+            uint64_t i = (cents % 100) * 2;
+            *--end = gib_digit_pairs[i + 1];
+            *--end = gib_digit_pairs[i];
+            *--end = '.';
+            char *start = gib_format_uint(end, cents / 100);
+            if (signbit(f)) {
+                *--start = '-';
+            }
+            return gib_print_bytes(start, tmp + sizeof(tmp) - start);
+        }
+    }
+    char tmp[512];
+    int len = snprintf(tmp, sizeof(tmp), "%.2f", f);
+    return gib_print_bytes(tmp, len);
+}
+
+int gib_print_char(GibChar c)
+{
+#ifdef _GIBBON_PARALLEL
+    return gib_print_bytes(&c, 1);
+#else
+    GibPrintBuffer *buf = &gib_global_print_buffer;
+    *gib_print_reserve(buf, 1) = c;
+    buf->len++;
+    return 1;
+#endif
+}
+
+int gib_print_bool(GibBool b)
+{
+    return gib_print_char(b ? '1' : '0');
+}
+
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Symbol table
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+static GibSymbolName **gib_global_symtable[GIB_SYMTABLE_NUM_PAGES];
+static GibArena *gib_global_symtable_strings = (GibArena *) NULL;
+#ifdef _GIBBON_PARALLEL
+static bool gib_global_symtable_lock = false;
+#endif
+
+STATIC_INLINE void gib_symtable_lock(void)
+{
+#ifdef _GIBBON_PARALLEL
+    while (__atomic_test_and_set(&gib_global_symtable_lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&gib_global_symtable_lock, __ATOMIC_RELAXED)) ;
+    }
+#endif
+}
+
+STATIC_INLINE void gib_symtable_unlock(void)
+{
+#ifdef _GIBBON_PARALLEL
+    __atomic_clear(&gib_global_symtable_lock, __ATOMIC_RELEASE);
+#endif
+}
+
+STATIC_INLINE GibSymbolName *gib_lookup_symbol(GibSym idx)
+{
+    uint64_t page_idx = idx >> GIB_SYMTABLE_PAGE_BITS;
+    if (UNLIKELY(page_idx >= GIB_SYMTABLE_NUM_PAGES)) {
+        return NULL;
+    }
+    GibSymbolName **page = __atomic_load_n(&gib_global_symtable[page_idx], __ATOMIC_ACQUIRE);
+    if (page == NULL) {
+        return NULL;
+    }
+    return __atomic_load_n(&page[idx & (GIB_SYMTABLE_PAGE_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+// Must be called with the symbol table lock held.
+static void gib_insert_symbol(GibSym idx, char *value)
+{
+    uint64_t page_idx = idx >> GIB_SYMTABLE_PAGE_BITS;
+    if (page_idx >= GIB_SYMTABLE_NUM_PAGES) {
+        fprintf(stderr, "gib_add_symbol: symbol %" PRIu64 " out of range.\n", idx);
+        exit(1);
+    }
+    GibSymbolName **page = gib_global_symtable[page_idx];
+    if (page == NULL) {
+        page = (GibSymbolName **) calloc(GIB_SYMTABLE_PAGE_SIZE, sizeof(GibSymbolName *));
+        if (page == NULL) {
+            fprintf(stderr, "gib_add_symbol: calloc failed: %zu",
+                    GIB_SYMTABLE_PAGE_SIZE * sizeof(GibSymbolName *));
+            exit(1);
+        }
+        __atomic_store_n(&gib_global_symtable[page_idx], page, __ATOMIC_RELEASE);
+    }
+    if (gib_global_symtable_strings == NULL) {
+        gib_global_symtable_strings = gib_alloc_arena();
+    }
+    size_t len = strlen(value);
+    GibSymbolName *name = (GibSymbolName *)
+        gib_extend_arena(gib_global_symtable_strings, sizeof(GibSymbolName) + len);
+    name->len = (uint32_t) len;
+    memcpy(name->str, value, len);
+    __atomic_store_n(&page[idx & (GIB_SYMTABLE_PAGE_SIZE - 1)], name, __ATOMIC_RELEASE);
+}
+
+void gib_add_symbol(GibSym idx, char *value)
+{
+    gib_symtable_lock();
+    gib_insert_symbol(idx, value);
+    if (idx > gib_global_gensym_counter) {
+        gib_global_gensym_counter = idx;
+    }
+    gib_symtable_unlock();
+    return;
+}
+
+// The special symbols used by the printers are interned as the text they
+// stand for, so gib_print_symbol doesn't need to special case them.
+
+void gib_set_newline(GibSym idx)
+{
+    gib_add_symbol(idx,"\n");
+    return;
+}
+
+void gib_set_space(GibSym idx)
+{
+    gib_add_symbol(idx," ");
+    return;
+}
+
+void gib_set_comma(GibSym idx)
+{
+    gib_add_symbol(idx,",");
+    return;
+}
+
+void gib_set_leftparen(GibSym idx)
+{
+    gib_add_symbol(idx,"(");
+    return;
+}
+
+void gib_set_rightparen(GibSym idx)
+{
+    gib_add_symbol(idx,")");
+    return;
+}
+
+int gib_print_symbol(GibSym idx)
+{
+    GibSymbolName *name = gib_lookup_symbol(idx);
+    if (name == NULL) {
+        return gib_print_int((GibInt) idx);
+    }
+    return gib_print_bytes(name->str, name->len);
+}
+
+GibSym gib_gensym(void)
+{
+    GibSym idx;
+#ifdef _GIBBON_PARALLEL
+    idx = __atomic_add_fetch(&gib_global_gensym_counter, 1, __ATOMIC_SEQ_CST);
+#else
+    gib_global_gensym_counter += 1;
+    idx = gib_global_gensym_counter;
+#endif
+    return idx;
+}
+
+// Generate a fresh symbol which prints as 'value'. Safe to call from
+// multiple threads.
+GibSym gib_gensym_named(char *value)
+{
+    GibSym idx = gib_gensym();
+    gib_symtable_lock();
+    gib_insert_symbol(idx, value);
+    gib_symtable_unlock();
+    return idx;
+}
+
+void gib_free_symtable(void)
+{
+    for (int i = 0; i < GIB_SYMTABLE_NUM_PAGES; i++) {
+        free(gib_global_symtable[i]);
+        gib_global_symtable[i] = NULL;
+    }
+    if (gib_global_symtable_strings != NULL) {
+        gib_free_arena(gib_global_symtable_strings);
+        gib_global_symtable_strings = NULL;
+    }
+    return;
+}
+
+
+// Cursor arrays bundle the cursors of a value in the factored (--SoA) layout:
+// the data constructor buffer followed by one buffer per field. One is made
+// for every constructor that's written or unpacked, and they can escape the
+// function that made them. So they are bump allocated out of thread-local
+// chunks rather than malloc'd one at a time. Every chunk is also pushed on a
+// global list, and gib_exit frees them all.
+#define GIB_CURSOR_ARRAY_CHUNK_SIZE (1 * MB)
 
-    return arr_on_heap;
+typedef struct gib_cursor_array_chunk {
+    struct gib_cursor_array_chunk *next;
+} GibCursorArrayChunk;
+
+static GibCursorArrayChunk *gib_global_cursor_array_chunks = (GibCursorArrayChunk *) NULL;
+static __thread char *gib_global_cursor_array_ptr = (char *) NULL;
+static __thread char *gib_global_cursor_array_ptr_end = (char *) NULL;
+
+static void gib_cursor_array_new_chunk(size_t bytes)
+{
+    size_t chunk_size = bytes > GIB_CURSOR_ARRAY_CHUNK_SIZE ? bytes : GIB_CURSOR_ARRAY_CHUNK_SIZE;
+    GibCursorArrayChunk *chunk =
+        (GibCursorArrayChunk *) malloc(sizeof(GibCursorArrayChunk) + chunk_size);
+    if (chunk == NULL) {
+        fprintf(stderr, "gib_array_alloc: malloc failed: %zu", chunk_size);
+        exit(1);
+    }
+    GibCursorArrayChunk *head = __atomic_load_n(&gib_global_cursor_array_chunks, __ATOMIC_RELAXED);
+    do {
+        chunk->next = head;
+    } while (!__atomic_compare_exchange_n(&gib_global_cursor_array_chunks, &head, chunk, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    gib_global_cursor_array_ptr = (char *) (chunk + 1);
+    gib_global_cursor_array_ptr_end = gib_global_cursor_array_ptr + chunk_size;
+}
+
+GibCursor *gib_array_alloc(GibCursor *arr, size_t size)
+{
+    size_t bytes = sizeof(GibCursor) * size;
+    if (UNLIKELY((size_t) (gib_global_cursor_array_ptr_end - gib_global_cursor_array_ptr) < bytes)) {
+        gib_cursor_array_new_chunk(bytes);
+    }
+    GibCursor *arr_out = (GibCursor *) gib_global_cursor_array_ptr;
+    memcpy(arr_out, arr, bytes);
+    gib_global_cursor_array_ptr += bytes;
+    return arr_out;
+}
+
+// Only called at exit, so the other threads' bump pointers aren't reset.
+static void gib_free_cursor_arrays(void)
+{
+    GibCursorArrayChunk *chunk = __atomic_exchange_n(&gib_global_cursor_array_chunks, NULL,
+                                                     __ATOMIC_ACQUIRE);
+    while (chunk != NULL) {
+        GibCursorArrayChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    gib_global_cursor_array_ptr = (char *) NULL;
+    gib_global_cursor_array_ptr_end = (char *) NULL;
 }
 
 
@@ -681,225 +1684,1634 @@ GibVector *gib_vector_merge(GibVector *vec1, GibVector *vec2)
         fprintf(stderr, "gib_vector_merge: gib_alloc failed: %zu", sizeof(GibVector));
         exit(1);
     }
-    merged->lower = vec1->lower;
-    merged->upper = vec2->upper;
-    merged->elt_size = vec1->elt_size;
-    merged->data = vec1->data;
-    return merged;
+    merged->lower = vec1->lower;
+    merged->upper = vec2->upper;
+    merged->elt_size = vec1->elt_size;
+    merged->data = vec1->data;
+    return merged;
+}
+
+void gib_print_timing_array(GibVector *times) {
+    gib_flush_stdout();
+    printf("ITER TIMES: [");
+    double *d;
+    GibInt n = gib_vector_length(times);
+    for(GibInt i = 0; i < n; i++) {
+        d = gib_vector_nth(times, i);
+        if (i == (n-1)) {
+            printf("%f",*d);
+        }
+        else {
+            printf("%f, ",*d);
+        }
+    }
+    printf("]\n");
+    return;
+}
+
+double gib_sum_timing_array(GibVector *times)
+{
+    double *d;
+    double acc = 0;
+    for(int i = 0; i < gib_vector_length(times); i++) {
+        d = gib_vector_nth(times, i);
+        acc += *d;
+    }
+    return acc;
+}
+
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Benchmarking
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+/*
+ * A timed expression compiled with iterate runs in a loop like this:
+ *
+ *     gib_bench_init(&bench, "name");
+ *     while (gib_bench_continue(&bench)) {
+ *         if (! gib_bench_is_last(&bench)) { save allocator state }
+ *         ... time the expression ...
+ *         if (! gib_bench_is_last(&bench)) { restore allocator state }
+ *         gib_bench_record(&bench, time);
+ *     }
+ *     gib_bench_report(&bench);
+ *
+ * It first runs --warmup iterations that aren't measured, then at least
+ * --iterate measured ones, and keeps going until those add up to --bench-time
+ * seconds. The result of the last iteration is the one that's kept, so the
+ * loop has to decide which one is last before running it; it's the one
+ * after which the budget is expected to run out, going by the time of the
+ * previous iteration.
+ */
+
+/*
+ * Hardware performance counters, read with perf_event_open. --perf-counters
+ * takes a comma separated list of event names (as in perf list). They're
+ * opened as one group in gib_init, and count user mode only. Counters that
+ * can't be opened (unknown name, no PMU, perf_event_paranoid too high...)
+ * are dropped with a warning, the timings are reported as usual.
+ *
+ * With _GIBBON_PARALLEL, the counters are inherited by threads created
+ * after they're opened, i.e. the Cilk workers, and reads add up all of
+ * them. Workers that already exist when gib_init runs aren't counted, and
+ * neither is anything if the kernel refuses inherited group counters; a
+ * warning says so.
+ */
+
+static int gib_global_perf_num_counters = 0;
+static const char *gib_global_perf_names[GIB_PERF_MAX_COUNTERS];
+static int gib_global_perf_fds[GIB_PERF_MAX_COUNTERS];
+// Values from the latest gib_perf_counters_stop.
+static uint64_t gib_global_perf_values[GIB_PERF_MAX_COUNTERS];
+
+#ifdef __linux__
+
+typedef struct gib_perf_event {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} GibPerfEvent;
+
+#define GIB_PERF_CACHE_EVENT(cache, op, result)                 \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const GibPerfEvent gib_perf_events[] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+    { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "stalled-cycles-frontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+    { "stalled-cycles-backend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+    { "L1-dcache-loads", PERF_TYPE_HW_CACHE,
+      GIB_PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS) },
+    { "L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+      GIB_PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "LLC-loads", PERF_TYPE_HW_CACHE,
+      GIB_PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS) },
+    { "LLC-load-misses", PERF_TYPE_HW_CACHE,
+      GIB_PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "dTLB-load-misses", PERF_TYPE_HW_CACHE,
+      GIB_PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static int gib_perf_open(const GibPerfEvent *ev, int group_fd, bool inherit)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = ev->type;
+    attr.config = ev->config;
+    attr.disabled = (group_fd == -1);
+    attr.inherit = inherit;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+void gib_perf_counters_open(void)
+{
+    static bool opened = false;
+    if (opened || gib_global_perf_counters_param == NULL) {
+        return;
+    }
+    opened = true;
+#ifdef _GIBBON_PARALLEL
+    bool inherit = true;
+#else
+    bool inherit = false;
+#endif
+    char *names = strdup(gib_global_perf_counters_param);
+    char *saveptr = NULL;
+    for (char *name = strtok_r(names, ",", &saveptr);
+         name != NULL;
+         name = strtok_r(NULL, ",", &saveptr)) {
+        if (gib_global_perf_num_counters == GIB_PERF_MAX_COUNTERS) {
+            fprintf(stderr, "Warning: at most %d perf counters are supported, ignoring %s.\n",
+                    GIB_PERF_MAX_COUNTERS, name);
+            continue;
+        }
+        const GibPerfEvent *ev = NULL;
+        for (size_t i = 0; i < sizeof(gib_perf_events) / sizeof(GibPerfEvent); i++) {
+            if (strcmp(gib_perf_events[i].name, name) == 0) {
+                ev = &(gib_perf_events[i]);
+                break;
+            }
+        }
+        if (ev == NULL) {
+            fprintf(stderr, "Warning: unknown perf counter %s, ignoring it.\n", name);
+            continue;
+        }
+        int leader = gib_global_perf_num_counters == 0 ? -1 : gib_global_perf_fds[0];
+        int fd = gib_perf_open(ev, leader, inherit);
+        if (fd == -1 && inherit && errno == EINVAL && leader == -1) {
+            fprintf(stderr, "Warning: inherited perf counters aren't supported, "
+                            "only the main thread will be counted.\n");
+            inherit = false;
+            fd = gib_perf_open(ev, leader, inherit);
+        }
+        if (fd == -1) {
+            fprintf(stderr, "Warning: couldn't open perf counter %s: %s\n", name, strerror(errno));
+            continue;
+        }
+        gib_global_perf_names[gib_global_perf_num_counters] = ev->name;
+        gib_global_perf_fds[gib_global_perf_num_counters] = fd;
+        gib_global_perf_num_counters++;
+    }
+    free(names);
+}
+
+void gib_perf_counters_start(void)
+{
+    if (LIKELY(gib_global_perf_num_counters == 0)) {
+        return;
+    }
+    ioctl(gib_global_perf_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(gib_global_perf_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void gib_perf_counters_stop(void)
+{
+    if (LIKELY(gib_global_perf_num_counters == 0)) {
+        return;
+    }
+    ioctl(gib_global_perf_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // nr, time_enabled, time_running, values...
+    uint64_t buf[3 + GIB_PERF_MAX_COUNTERS];
+    if (read(gib_global_perf_fds[0], buf, sizeof(buf)) == -1) {
+        fprintf(stderr, "Warning: couldn't read perf counters: %s\n", strerror(errno));
+        return;
+    }
+    // Scale up if the group was multiplexed with other events.
+    double scale = 1.0;
+    if (buf[2] != 0 && buf[2] < buf[1]) {
+        scale = (double) buf[1] / (double) buf[2];
+    }
+    for (uint64_t i = 0; i < buf[0] && i < GIB_PERF_MAX_COUNTERS; i++) {
+        gib_global_perf_values[i] = (uint64_t) ((double) buf[3 + i] * scale);
+    }
+}
+
+#else
+
+void gib_perf_counters_open(void)
+{
+    if (gib_global_perf_counters_param != NULL) {
+        fprintf(stderr, "Warning: --perf-counters is only supported on Linux.\n");
+    }
+}
+
+void gib_perf_counters_start(void) {}
+
+void gib_perf_counters_stop(void) {}
+
+#endif // __linux__
+
+static void gib_perf_counters_fprint(FILE *fp, const char *prefix, const uint64_t *values)
+{
+    fprintf(fp, "%s", prefix);
+    for (int i = 0; i < gib_global_perf_num_counters; i++) {
+        fprintf(fp, i == 0 ? "%s %" PRIu64 : ", %s %" PRIu64,
+                gib_global_perf_names[i], values[i]);
+    }
+    fprintf(fp, "\n");
+}
+
+// Counters of a timed expression that ran once.
+void gib_perf_counters_print(void)
+{
+    if (gib_global_perf_num_counters == 0) {
+        return;
+    }
+    gib_flush_stdout();
+    gib_perf_counters_fprint(stdout, "COUNTERS: ", gib_global_perf_values);
+}
+
+// Peak resident set size so far, in kilobytes. Only printed under
+// --print-max-rss, which BenchRunner passes.
+void gib_print_max_rss(void)
+{
+    if (!gib_global_print_max_rss_param) {
+        return;
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return;
+    }
+    gib_flush_stdout();
+    printf("MAXRSS: %ld\n", usage.ru_maxrss);
+}
+
+#define GIB_BENCH_BOOTSTRAP_RESAMPLES 1000
+
+static void gib_bench_pin(void)
+{
+    static bool pinned = false;
+    if (pinned || gib_global_pin_core_param < 0) {
+        return;
+    }
+    pinned = true;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(gib_global_pin_core_param, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fprintf(stderr, "Warning: couldn't pin to core %" PRId64 ": %s\n",
+                gib_global_pin_core_param, strerror(errno));
+    }
+#else
+    fprintf(stderr, "Warning: --pin-core is only supported on Linux.\n");
+#endif
+}
+
+// Needs root, gives up with a warning otherwise.
+static void gib_bench_drop_caches(void)
+{
+    if (! gib_global_drop_caches_param) {
+        return;
+    }
+    sync();
+    FILE *fp = fopen("/proc/sys/vm/drop_caches", "w");
+    if (fp == NULL || fputs("3\n", fp) == EOF || fclose(fp) == EOF) {
+        fprintf(stderr, "Warning: couldn't drop caches: %s\n", strerror(errno));
+        gib_global_drop_caches_param = false;
+    }
+}
+
+void gib_bench_init(GibBench *bench, const char *name)
+{
+    bench->name = name;
+    bench->warmup_left = gib_global_warmup_param;
+    bench->min_iters = gib_global_iters_param < 1 ? 1 : gib_global_iters_param;
+    bench->num_times = 0;
+    bench->elapsed = 0;
+    bench->last_time = 0;
+    bench->is_last = false;
+    bench->done = false;
+    bench->max_times = bench->min_iters;
+    bench->times = (double *) malloc(bench->max_times * sizeof(double));
+    bench->counters = (uint64_t *) malloc(bench->max_times * GIB_PERF_MAX_COUNTERS * sizeof(uint64_t));
+    if (bench->times == NULL || bench->counters == NULL) {
+        fprintf(stderr, "gib_bench_init: malloc failed.\n");
+        exit(1);
+    }
+    gib_bench_pin();
+}
+
+bool gib_bench_continue(GibBench *bench)
+{
+    if (bench->done) {
+        return false;
+    }
+    bench->is_last =
+        bench->warmup_left == 0 &&
+        bench->num_times + 1 >= bench->min_iters &&
+        bench->elapsed + bench->last_time >= gib_global_bench_time_param;
+    gib_bench_drop_caches();
+    return true;
+}
+
+bool gib_bench_is_last(GibBench *bench)
+{
+    return bench->is_last;
+}
+
+void gib_bench_record(GibBench *bench, double time)
+{
+    bench->last_time = time;
+    bench->done = bench->is_last;
+    if (bench->warmup_left > 0) {
+        bench->warmup_left--;
+        return;
+    }
+    if (bench->num_times == bench->max_times) {
+        bench->max_times *= 2;
+        bench->times = (double *) realloc(bench->times, bench->max_times * sizeof(double));
+        bench->counters = (uint64_t *) realloc(bench->counters,
+                                               bench->max_times * GIB_PERF_MAX_COUNTERS * sizeof(uint64_t));
+        if (bench->times == NULL || bench->counters == NULL) {
+            fprintf(stderr, "gib_bench_record: realloc failed.\n");
+            exit(1);
+        }
+    }
+    uint64_t *counters = bench->counters + bench->num_times * GIB_PERF_MAX_COUNTERS;
+    memcpy(counters, gib_global_perf_values, sizeof(gib_global_perf_values));
+    bench->times[bench->num_times++] = time;
+    bench->elapsed += time;
+    gib_flush_stdout();
+    printf("itertime: %lf\n", time);
+    if (gib_global_perf_num_counters > 0) {
+        gib_perf_counters_fprint(stdout, "itercounters: ", counters);
+    }
+}
+
+// Element at the given fraction of a sorted array.
+static double gib_bench_percentile(const double *sorted, GibInt n, double p)
+{
+    GibInt i = (GibInt) (p * n);
+    return sorted[i < n ? i : n - 1];
+}
+
+// 95% confidence interval of the mean, by resampling the measured times.
+static void gib_bench_bootstrap_ci(const double *times, GibInt n, double *lo, double *hi)
+{
+    double *means = (double *) malloc(GIB_BENCH_BOOTSTRAP_RESAMPLES * sizeof(double));
+    if (means == NULL) {
+        fprintf(stderr, "gib_bench_bootstrap_ci: malloc failed.\n");
+        exit(1);
+    }
+    // A private generator, the program's own stays untouched.
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int r = 0; r < GIB_BENCH_BOOTSTRAP_RESAMPLES; r++) {
+        double sum = 0;
+        for (GibInt i = 0; i < n; i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            sum += times[state % (uint64_t) n];
+        }
+        means[r] = sum / n;
+    }
+    qsort(means, GIB_BENCH_BOOTSTRAP_RESAMPLES, sizeof(double), gib_compare_doubles);
+    *lo = gib_bench_percentile(means, GIB_BENCH_BOOTSTRAP_RESAMPLES, 0.025);
+    *hi = gib_bench_percentile(means, GIB_BENCH_BOOTSTRAP_RESAMPLES, 0.975);
+    free(means);
+}
+
+static void gib_bench_write_json(GibBench *bench, const double *sorted)
+{
+    GibInt n = bench->num_times;
+    double mean = bench->elapsed / n;
+    double var = 0;
+    for (GibInt i = 0; i < n; i++) {
+        var += (bench->times[i] - mean) * (bench->times[i] - mean);
+    }
+    double stddev = n > 1 ? sqrt(var / (n - 1)) : 0;
+    double ci_lo, ci_hi;
+    gib_bench_bootstrap_ci(bench->times, n, &ci_lo, &ci_hi);
+
+    bool to_stdout = strcmp(gib_global_bench_json_param, "-") == 0;
+    FILE *fp = to_stdout ? stdout : fopen(gib_global_bench_json_param, "a");
+    if (fp == NULL) {
+        fprintf(stderr, "Warning: couldn't open %s: %s\n",
+                gib_global_bench_json_param, strerror(errno));
+        return;
+    }
+    fprintf(fp, "{\"name\": \"%s\", \"size\": %" PRId64 ", \"warmup\": %" PRId64
+            ", \"iters\": %" PRId64 ", \"mean\": %e, \"stddev\": %e"
+            ", \"min\": %e, \"max\": %e, \"p50\": %e, \"p90\": %e, \"p99\": %e"
+            ", \"ci95\": [%e, %e], \"batchtime\": %e, \"times\": [",
+            bench->name, gib_global_size_param, gib_global_warmup_param,
+            n, mean, stddev, sorted[0], sorted[n-1],
+            gib_bench_percentile(sorted, n, 0.5),
+            gib_bench_percentile(sorted, n, 0.9),
+            gib_bench_percentile(sorted, n, 0.99),
+            ci_lo, ci_hi, bench->elapsed);
+    for (GibInt i = 0; i < n; i++) {
+        fprintf(fp, i == 0 ? "%e" : ", %e", bench->times[i]);
+    }
+    fprintf(fp, "]");
+    if (gib_global_perf_num_counters > 0) {
+        fprintf(fp, ", \"counters\": {");
+        for (int c = 0; c < gib_global_perf_num_counters; c++) {
+            fprintf(fp, c == 0 ? "\"%s\": [" : ", \"%s\": [", gib_global_perf_names[c]);
+            for (GibInt i = 0; i < n; i++) {
+                fprintf(fp, i == 0 ? "%" PRIu64 : ", %" PRIu64,
+                        bench->counters[i * GIB_PERF_MAX_COUNTERS + c]);
+            }
+            fprintf(fp, "]");
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "}\n");
+    if (! to_stdout) {
+        fclose(fp);
+    }
+}
+
+void gib_bench_report(GibBench *bench)
+{
+    GibInt n = bench->num_times;
+    double *sorted = (double *) malloc(n * sizeof(double));
+    if (sorted == NULL) {
+        fprintf(stderr, "gib_bench_report: malloc failed.\n");
+        exit(1);
+    }
+    memcpy(sorted, bench->times, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), gib_compare_doubles);
+
+    gib_flush_stdout();
+    printf("ITER TIMES: [");
+    for (GibInt i = 0; i < n; i++) {
+        printf(i == 0 ? "%f" : ", %f", sorted[i]);
+    }
+    printf("]\n");
+    printf("ITERS: %" PRId64 "\n", n);
+    printf("SIZE: %" PRId64 "\n", gib_global_size_param);
+    printf("BATCHTIME: %e\n", bench->elapsed);
+    printf("SELFTIMED: %e\n", gib_bench_percentile(sorted, n, 0.5));
+    gib_print_max_rss();
+    if (gib_global_bench_json_param != NULL) {
+        gib_flush_stdout();
+        gib_bench_write_json(bench, sorted);
+    }
+    free(sorted);
+    free(bench->times);
+    free(bench->counters);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Linked lists
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+
+#ifdef _GIBBON_BUMPALLOC_LISTS
+// #define _GIBBON_DEBUG
+#pragma message "Using bump allocator."
+
+static __thread GibBumpallocArena gib_global_list_bumpalloc_arena;
+
+// Chunks are allocated on demand.
+void gib_init_list_bumpalloc(void) {}
+
+void *gib_list_bumpalloc(size_t n)
+{
+    return gib_bumpalloc(&gib_global_list_bumpalloc_arena, n);
+}
+
+// Snapshot the current thread's heap pointer.
+void gib_list_bumpalloc_save_state(void)
+{
+    gib_bumpalloc_save(&gib_global_list_bumpalloc_arena);
+#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
+    printf("Saved(%p): pos %zu\n", gib_global_list_bumpalloc_arena.ptr,
+           gib_global_list_bumpalloc_arena.num_saved);
+#endif
+}
+
+void gib_list_bumpalloc_restore_state(void)
+{
+    if (! gib_bumpalloc_restore(&gib_global_list_bumpalloc_arena)) {
+        fprintf(stderr, "Bad call to gib_list_bumpalloc_restore_state!  Saved stack empty!\n");
+        exit(1);
+    }
+#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
+    printf("Restored(%p): pos %zu\n", gib_global_list_bumpalloc_arena.ptr,
+           gib_global_list_bumpalloc_arena.num_saved);
+#endif
+}
+
+#else
+// Regular malloc mode:
+void gib_init_list_bumpalloc(void) {}
+void *gib_list_bumpalloc(size_t n) { return gib_alloc(n); }
+void gib_list_bumpalloc_save_state(void) {}
+void gib_list_bumpalloc_restore_state(void) {}
+
+#endif // _GIBBON_BUMPALLOC_LISTS
+
+
+// List API.
+
+GibList *gib_list_alloc(size_t data_size)
+{
+    // GibList *ls = gib_alloc(sizeof(GibList));
+    GibList *ls = gib_list_bumpalloc(sizeof(GibList));
+    ls->data_size = data_size;
+    ls->data = (void *) NULL;
+    ls->next = (GibList *) NULL;
+    return ls;
+}
+
+GibBool gib_list_is_empty(GibList *ls)
+{
+    return ls->next == NULL;
+}
+
+GibList *gib_list_cons(void *elt, GibList *ls)
+{
+    // void* data = gib_alloc(ls->data_size);
+    void* data = gib_list_bumpalloc(ls->data_size);
+    if (data == NULL) {
+        fprintf(stderr, "gib_list_cons: gib_alloc failed: %zu", ls->data_size);
+        exit(1);
+    }
+    memcpy(data, elt, ls->data_size);
+    // GibList *res = gib_alloc(sizeof(GibList));
+    GibList *res = gib_list_bumpalloc(sizeof(GibList));
+    res->data_size = ls->data_size;
+    res->data = data;
+    res->next = (GibList*) ls;
+    return res;
+}
+
+void *gib_list_head(GibList *ls)
+{
+    return ls->data;
+}
+
+GibList* gib_list_tail(GibList *ls)
+{
+    return ls->next;
+}
+
+void gib_list_free(GibList *ls)
+{
+    gib_free(ls->data);
+    gib_free(ls);
+    return;
+}
+
+GibList *gib_list_copy(GibList *ls)
+{
+    GibList *ls2 = gib_list_alloc(ls->data_size);
+    if (ls->data != NULL) {
+        void* data = gib_list_bumpalloc(ls->data_size);
+        memcpy(data, ls->data, ls->data_size);
+        ls2->data = data;
+    }
+    ls2->next = ls->next;
+    return ls2;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Ppm images
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+static void gib_ppm_drain(GibPpmWriter *writer)
+{
+    unsigned char *start = writer->buf;
+    size_t left = writer->len;
+    while (left > 0) {
+        ssize_t wrote = write(writer->fd, start, left);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "gib_ppm_drain: write failed: %s\n", strerror(errno));
+            exit(1);
+        }
+        start += wrote;
+        left -= wrote;
+    }
+    writer->len = 0;
+}
+
+GibPpmWriter *gib_ppm_open(char *filename, GibInt width, GibInt height)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "gib_ppm_open: couldn't open %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    GibPpmWriter *writer = (GibPpmWriter *) malloc(sizeof(GibPpmWriter));
+    writer->buf = (unsigned char *) malloc(GIB_PPM_BUFFER_SIZE);
+    writer->fd = fd;
+    writer->width = width;
+    writer->height = height;
+    writer->pixels_written = 0;
+    writer->len = snprintf((char *) writer->buf, GIB_PPM_BUFFER_SIZE,
+                           "P6\n%" PRId64 " %" PRId64 "\n255\n", width, height);
+    return writer;
+}
+
+STATIC_INLINE unsigned char gib_ppm_clamp(GibInt c)
+{
+    return (unsigned char) (c < 0 ? 0 : (c > 255 ? 255 : c));
+}
+
+void gib_ppm_write_pixels(GibPpmWriter *writer, GibPixel *pixels, GibInt n)
+{
+    for (GibInt i = 0; i < n; i++) {
+        if (UNLIKELY((writer->len + 3) > GIB_PPM_BUFFER_SIZE)) {
+            gib_ppm_drain(writer);
+        }
+        unsigned char *out = writer->buf + writer->len;
+        out[0] = gib_ppm_clamp(pixels[i].field0);
+        out[1] = gib_ppm_clamp(pixels[i].field1);
+        out[2] = gib_ppm_clamp(pixels[i].field2);
+        writer->len += 3;
+    }
+    writer->pixels_written += n;
+}
+
+void gib_ppm_write_vector(GibPpmWriter *writer, GibVector *pixels)
+{
+    GibInt len = gib_vector_length(pixels);
+    if (len > 0) {
+        gib_ppm_write_pixels(writer, (GibPixel *) gib_vector_nth(pixels, 0), len);
+    }
+}
+
+void gib_ppm_close(GibPpmWriter *writer)
+{
+    gib_ppm_drain(writer);
+    if (writer->pixels_written != writer->width * writer->height) {
+        fprintf(stderr, "gib_ppm_close: expected %" PRId64 " pixels, got %" PRId64 ".\n",
+                writer->width * writer->height, writer->pixels_written);
+    }
+    close(writer->fd);
+    free(writer->buf);
+    free(writer);
+}
+
+// Example: gib_write_ppm("gibbon_rgb_1000.ppm", 1000, 1000, pixels);
+void gib_write_ppm(char* filename, GibInt width, GibInt height, GibVector *pixels)
+{
+    GibPpmWriter *writer = gib_ppm_open(filename, width, height);
+    gib_ppm_write_vector(writer, pixels);
+    gib_ppm_close(writer);
+    return;
+}
+
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Random numbers
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+#ifdef _GIBBON_PARALLEL
+// Allocated by gib_init, one per worker.
+static GibRngState *gib_global_rng_states = (GibRngState *) NULL;
+#else
+static GibRngState gib_global_rng_state;
+#endif
+
+STATIC_INLINE GibRngState *gib_get_rng_state(void)
+{
+#ifdef _GIBBON_PARALLEL
+    return &(gib_global_rng_states[gib_get_thread_id()]);
+#else
+    return &gib_global_rng_state;
+#endif
+}
+
+STATIC_INLINE uint64_t gib_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256**, see https://prng.di.unimi.it.
+STATIC_INLINE uint64_t gib_rng_next(GibRngState *st)
+{
+    uint64_t *s = st->s;
+    uint64_t result = gib_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = gib_rotl(s[3], 45);
+    return result;
+}
+
+#ifdef _GIBBON_PARALLEL
+// Advance the state by 2^128 steps, which gives every worker its own
+// non-overlapping stream.
+static void gib_rng_jump(GibRngState *st)
+{
+    static const uint64_t jump[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                     0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (jump[i] & (UINT64_C(1) << b)) {
+                s0 ^= st->s[0];
+                s1 ^= st->s[1];
+                s2 ^= st->s[2];
+                s3 ^= st->s[3];
+            }
+            gib_rng_next(st);
+        }
+    }
+    st->s[0] = s0;
+    st->s[1] = s1;
+    st->s[2] = s2;
+    st->s[3] = s3;
+}
+#endif
+
+// Seed the generator of every worker from a single 64-bit seed. Worker 0
+// gets the state expanded from the seed with splitmix64, and each later
+// worker starts one jump after the previous one.
+void gib_rng_init(uint64_t seed)
+{
+    GibRngState st;
+    uint64_t x = seed;
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        st.s[i] = z ^ (z >> 31);
+    }
+#ifdef _GIBBON_PARALLEL
+    if (gib_global_rng_states == NULL) {
+        // Line up the padding with actual cache lines.
+        gib_global_rng_states = (GibRngState *) aligned_alloc(GIB_CACHE_LINE_SIZE,
+                                                              gib_global_num_threads *
+                                                              sizeof(GibRngState));
+        if (gib_global_rng_states == NULL) {
+            fprintf(stderr, "gib_rng_init: aligned_alloc failed.\n");
+            exit(1);
+        }
+    }
+    for (uint64_t i = 0; i < gib_global_num_threads; i++) {
+        gib_global_rng_states[i] = st;
+        gib_rng_jump(&st);
+    }
+#else
+    gib_global_rng_state = st;
+#endif
+}
+
+// Uniform in [0, 2^63).
+GibInt gib_rand(void)
+{
+    return (GibInt) (gib_rng_next(gib_get_rng_state()) >> 1);
+}
+
+// Uniform in [0, 1).
+GibFloat gib_frand(void)
+{
+    return (GibFloat) (gib_rng_next(gib_get_rng_state()) >> 40) * 0x1.0p-24f;
+}
+
+void gib_rand_fill_vector(GibVector *vec)
+{
+    if (vec->elt_size != sizeof(GibInt)) {
+        fprintf(stderr, "gib_rand_fill_vector: expected a vector of GibInt, got element size %zu.\n",
+                vec->elt_size);
+        exit(1);
+    }
+    GibRngState *st = gib_get_rng_state();
+    GibInt *data = (GibInt *) vec->data + vec->lower;
+    GibInt n = gib_vector_length(vec);
+    for (GibInt i = 0; i < n; i++) {
+        data[i] = (GibInt) (gib_rng_next(st) >> 1);
+    }
+}
+
+void gib_frand_fill_vector(GibVector *vec)
+{
+    if (vec->elt_size != sizeof(GibFloat)) {
+        fprintf(stderr, "gib_frand_fill_vector: expected a vector of GibFloat, got element size %zu.\n",
+                vec->elt_size);
+        exit(1);
+    }
+    GibRngState *st = gib_get_rng_state();
+    GibFloat *data = (GibFloat *) vec->data + vec->lower;
+    GibInt n = gib_vector_length(vec);
+    for (GibInt i = 0; i < n; i++) {
+        data[i] = (GibFloat) (gib_rng_next(st) >> 40) * 0x1.0p-24f;
+    }
+}
+
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Layout profiles
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+// Programs compiled with --profile-layout count how often every function is
+// entered, and write the counts out at exit as "<function> <count>" lines.
+// The compiler reads them back with --layout-profile.
+void gib_write_layout_profile(size_t num_funs, const char **names, const uint64_t *counts)
+{
+    FILE *fp = fopen(gib_global_layout_profile_param, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "gib_write_layout_profile: could not open %s.\n",
+                gib_global_layout_profile_param);
+        exit(1);
+    }
+    for (size_t i = 0; i < num_funs; i++) {
+        if (counts[i] > 0) {
+            fprintf(fp, "%s %" PRIu64 "\n", names[i], counts[i]);
+        }
+    }
+    fclose(fp);
+}
+
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Packed files
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+// FNV-1a of the layout the compiler generated for the datatype.
+static uint64_t gib_packed_file_datatype(const char *layout)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char *c = layout; *c != '\0'; c++) {
+        hash ^= (uint8_t) *c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void gib_packed_writer_write_all(int fd, char *src, size_t n)
+{
+    while (n > 0) {
+        ssize_t wrote = write(fd, src, n);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "gib_packed_writer: write failed: %s\n", strerror(errno));
+            exit(1);
+        }
+        src += wrote;
+        n -= wrote;
+    }
+}
+
+GibPackedWriter *gib_packed_writer_open(char *filename, const char *layout)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "gib_packed_writer_open: couldn't open %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    GibPackedWriter *writer = (GibPackedWriter *) malloc(sizeof(GibPackedWriter));
+    writer->buf = (char *) malloc(GIB_PACKED_WRITER_BUFFER_SIZE);
+    writer->fd = fd;
+    writer->datatype = gib_packed_file_datatype(layout);
+    writer->written = 0;
+    // The header is filled in by gib_packed_writer_close, once the size
+    // is known.
+    memset(writer->buf, 0, sizeof(GibPackedFileHeader));
+    writer->len = sizeof(GibPackedFileHeader);
+    return writer;
+}
+
+void gib_packed_writer_flush(GibPackedWriter *writer)
+{
+    gib_packed_writer_write_all(writer->fd, writer->buf, writer->len);
+    writer->len = 0;
+}
+
+void gib_packed_writer_write_large(GibPackedWriter *writer, GibCursor src, size_t n)
+{
+    gib_packed_writer_flush(writer);
+    if (n < GIB_PACKED_WRITER_BUFFER_SIZE) {
+        memcpy(writer->buf, src, n);
+        writer->len = n;
+    } else {
+        gib_packed_writer_write_all(writer->fd, src, n);
+    }
+    writer->written += n;
 }
 
-void gib_print_timing_array(GibVector *times) {
-    printf("ITER TIMES: [");
-    double *d;
-    GibInt n = gib_vector_length(times);
-    for(GibInt i = 0; i < n; i++) {
-        d = gib_vector_nth(times, i);
-        if (i == (n-1)) {
-            printf("%f",*d);
-        }
-        else {
-            printf("%f, ",*d);
+// Overwrite the 8 bytes at pos in the value, which may have been flushed
+// already. Used for the sizes and offsets of relative random access nodes.
+void gib_packed_writer_patch(GibPackedWriter *writer, uint64_t pos, GibInt val)
+{
+    // Offsets in the file, which starts with the header.
+    uint64_t at = sizeof(GibPackedFileHeader) + pos;
+    uint64_t buf_start = sizeof(GibPackedFileHeader) + writer->written - writer->len;
+    char *src = (char *) &val;
+    size_t n = sizeof(GibInt);
+    if (at < buf_start) {
+        size_t flushed = (at + n <= buf_start) ? n : (size_t) (buf_start - at);
+        if (pwrite(writer->fd, src, flushed, at) != (ssize_t) flushed) {
+            fprintf(stderr, "gib_packed_writer_patch: pwrite failed: %s\n", strerror(errno));
+            exit(1);
         }
+        src += flushed;
+        at += flushed;
+        n -= flushed;
     }
-    printf("]\n");
-    return;
+    memcpy(writer->buf + (at - buf_start), src, n);
 }
 
-double gib_sum_timing_array(GibVector *times)
+GibInt gib_packed_writer_close(GibPackedWriter *writer)
 {
-    double *d;
-    double acc = 0;
-    for(int i = 0; i < gib_vector_length(times); i++) {
-        d = gib_vector_nth(times, i);
-        acc += *d;
+    gib_packed_writer_flush(writer);
+    GibPackedFileHeader header = { GIB_PACKED_FILE_MAGIC, writer->datatype, writer->written };
+    if (pwrite(writer->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        fprintf(stderr, "gib_packed_writer_close: couldn't write header: %s\n", strerror(errno));
+        exit(1);
     }
-    return acc;
+    close(writer->fd);
+    GibInt written = (GibInt) writer->written;
+    free(writer->buf);
+    free(writer);
+    return written;
+}
+
+// Map a packed file into memory, and return a cursor to the value in it.
+// Its size is stored in *size.
+GibCursor gib_read_packed_file(char *filename, const char *tycon, const char *layout, GibInt *size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "gib_read_packed_file: couldn't open %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "gib_read_packed_file: couldn't stat %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "gib_read_packed_file: %s is empty.\n", filename);
+        exit(1);
+    }
+    GibCursor ptr = (GibCursor) mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        fprintf(stderr, "gib_read_packed_file: mmap failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    close(fd);
+    size_t header_size = sizeof(GibPackedFileHeader);
+    GibPackedFileHeader *header = (GibPackedFileHeader *) ptr;
+    if ((size_t) st.st_size < header_size || header->magic != GIB_PACKED_FILE_MAGIC) {
+        // Written before files had headers.
+        *size = (GibInt) st.st_size;
+        return ptr;
+    }
+    if (header->datatype != gib_packed_file_datatype(layout)) {
+        fprintf(stderr, "gib_read_packed_file: %s doesn't hold a value of type %s"
+                " with this layout.\n",
+                filename, tycon);
+        exit(1);
+    }
+    if (header->size != (uint64_t) st.st_size - header_size) {
+        fprintf(stderr, "gib_read_packed_file: %s is truncated, expected %" PRIu64
+                " bytes but found %zu.\n",
+                filename, header->size, (size_t) st.st_size - header_size);
+        exit(1);
+    }
+    *size = (GibInt) header->size;
+    return ptr + header_size;
 }
 
+
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * Linked lists
+ * S-expression ingestion
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  */
 
+typedef struct gib_sexp_buffer {
+    char *start;
+    size_t len;
+    size_t cap;
+} GibSexpBuffer;
+
+typedef struct gib_sexp_reader {
+    char *filename;
+    const char *text;
+    const char *pos;
+    const char *end;
+    const GibSexpDatatype *datatypes;
+    GibSexpBuffer *out;
+} GibSexpReader;
+
+// Symbol names seen so far, so that equal names get equal symbols.
+typedef struct gib_sexp_sym {
+    char *name;
+    GibSym sym;
+    UT_hash_handle hh;
+} GibSexpSym;
+
+static GibSexpSym *gib_global_sexp_syms = (GibSexpSym *) NULL;
+#ifdef _GIBBON_PARALLEL
+static bool gib_global_sexp_syms_lock = false;
+#endif
 
-#ifdef _GIBBON_BUMPALLOC_LISTS
-// #define _GIBBON_DEBUG
-#pragma message "Using bump allocator."
-
-static __thread char *gib_global_list_bumpalloc_heap_ptr = (char *) NULL;
-static __thread char *gib_global_list_bumpalloc_heap_ptr_end = (char *) NULL;
-static char *gib_global_list_saved_heap_ptr_stack[100];
-static int gib_global_list_num_saved_heap_ptr = 0;
+STATIC_INLINE void gib_sexp_syms_lock(void)
+{
+#ifdef _GIBBON_PARALLEL
+    while (__atomic_test_and_set(&gib_global_sexp_syms_lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&gib_global_sexp_syms_lock, __ATOMIC_RELAXED)) ;
+    }
+#endif
+}
 
-// For simplicity just use a single large slab:
-void gib_init_list_bumpalloc(void)
+STATIC_INLINE void gib_sexp_syms_unlock(void)
 {
-    gib_global_list_bumpalloc_heap_ptr =
-        (char*) gib_alloc(gib_global_biginf_init_chunk_size);
-    gib_global_list_bumpalloc_heap_ptr_end =
-        gib_global_list_bumpalloc_heap_ptr + gib_global_biginf_init_chunk_size;
-#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
-    printf("Arena size for bump alloc: %zu\n", gib_global_biginf_init_chunk_size);
-    printf("gib_init_list_bumpalloc DONE: heap_ptr = %p\n",
-           gib_global_list_bumpalloc_heap_ptr);
+#ifdef _GIBBON_PARALLEL
+    __atomic_clear(&gib_global_sexp_syms_lock, __ATOMIC_RELEASE);
 #endif
 }
 
-void *gib_list_bumpalloc(size_t n)
+static void gib_sexp_add_sym(char *name, GibSym sym)
+{
+    GibSexpSym *entry = (GibSexpSym *) malloc(sizeof(GibSexpSym));
+    entry->name = strdup(name);
+    entry->sym = sym;
+    HASH_ADD_KEYPTR(hh, gib_global_sexp_syms, entry->name, strlen(entry->name), entry);
+}
+
+// Symbols that the program already knows about, e.g. quoted ones, keep
+// their numbers.
+static void gib_sexp_init_syms(void)
 {
-    if (! gib_global_list_bumpalloc_heap_ptr) {
-        gib_init_list_bumpalloc();
+    for (GibSym idx = 0; idx <= gib_global_gensym_counter; idx++) {
+        GibSymbolName *name = gib_lookup_symbol(idx);
+        if (name == NULL) {
+            continue;
+        }
+        char *str = strndup(name->str, name->len);
+        GibSexpSym *entry;
+        HASH_FIND_STR(gib_global_sexp_syms, str, entry);
+        if (entry == NULL) {
+            gib_sexp_add_sym(str, idx);
+        }
+        free(str);
     }
-    if (gib_global_list_bumpalloc_heap_ptr + n <
-        gib_global_list_bumpalloc_heap_ptr_end) {
-        char* old= gib_global_list_bumpalloc_heap_ptr;
-        gib_global_list_bumpalloc_heap_ptr += n;
-        return old;
+}
+
+static void gib_sexp_free_syms(void)
+{
+    GibSexpSym *entry, *tmp;
+    HASH_ITER(hh, gib_global_sexp_syms, entry, tmp) {
+        HASH_DEL(gib_global_sexp_syms, entry);
+        free(entry->name);
+        free(entry);
+    }
+}
+
+static GibSym gib_sexp_intern(char *name)
+{
+    gib_sexp_syms_lock();
+    GibSexpSym *entry;
+    HASH_FIND_STR(gib_global_sexp_syms, name, entry);
+    GibSym sym;
+    if (entry != NULL) {
+        sym = entry->sym;
     } else {
-        fprintf(stderr, "Warning: bump allocator ran out of memory.");
-        exit(1);
+        sym = gib_gensym_named(name);
+        gib_sexp_add_sym(name, sym);
     }
+    gib_sexp_syms_unlock();
+    return sym;
 }
 
-// Snapshot the current heap pointer value across all threads.
-void gib_list_bumpalloc_save_state(void)
+static void gib_sexp_error(GibSexpReader *reader, const char *msg)
 {
-    char *heap_ptr = gib_global_list_bumpalloc_heap_ptr;
-    gib_global_list_saved_heap_ptr_stack[gib_global_list_num_saved_heap_ptr] = heap_ptr;
-    gib_global_list_num_saved_heap_ptr++;
-#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
-    printf("Saved(%p): pos %d\n", heap_ptr, gib_global_list_num_saved_heap_ptr);
-    printf("\n");
-#endif
+    size_t line = 1;
+    for (const char *c = reader->text; c < reader->pos; c++) {
+        line += (*c == '\n');
+    }
+    fprintf(stderr, "gib_read_sexp_file: %s:%zu: %s\n", reader->filename, line, msg);
+    exit(1);
 }
 
-void gib_list_bumpalloc_restore_state(void)
+STATIC_INLINE char *gib_sexp_reserve(GibSexpBuffer *buf, size_t n)
 {
-    if(gib_global_list_num_saved_heap_ptr <= 0) {
-        fprintf(stderr, "Bad call to gib_list_bumpalloc_restore_state!  Saved stack empty!\ne");
-        exit(1);
+    if (UNLIKELY(buf->len + n > buf->cap)) {
+        size_t cap = buf->cap * 2;
+        while (cap < buf->len + n) {
+            cap *= 2;
+        }
+        buf->start = (char *) realloc(buf->start, cap);
+        if (buf->start == NULL) {
+            fprintf(stderr, "gib_read_sexp_file: realloc failed: %zu\n", cap);
+            exit(1);
+        }
+        buf->cap = cap;
     }
-    gib_global_list_num_saved_heap_ptr--;
-    gib_global_list_bumpalloc_heap_ptr =
-        gib_global_list_saved_heap_ptr_stack[gib_global_list_num_saved_heap_ptr];
-#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
-    printf("Restored(%p): pos %d, discarding %p",
-           gib_global_list_saved_heap_ptr_stack[gib_global_list_num_saved_heap_ptr],
-           gib_global_list_num_saved_heap_ptr,
-           gib_global_list_bumpalloc_heap_ptr);
-#endif
+    char *dst = buf->start + buf->len;
+    buf->len += n;
+    return dst;
 }
 
-#else
-// Regular malloc mode:
-void gib_init_list_bumpalloc(void) {}
-void *gib_list_bumpalloc(size_t n) { return gib_alloc(n); }
-void gib_list_bumpalloc_save_state(void) {}
-void gib_list_bumpalloc_restore_state(void) {}
+static void gib_sexp_init_buffer(GibSexpBuffer *buf, size_t cap)
+{
+    buf->start = (char *) malloc(cap);
+    if (buf->start == NULL) {
+        fprintf(stderr, "gib_read_sexp_file: malloc failed: %zu\n", cap);
+        exit(1);
+    }
+    buf->len = 0;
+    buf->cap = cap;
+}
 
-#endif // _GIBBON_BUMPALLOC_LISTS
+STATIC_INLINE bool gib_sexp_is_delim(char c)
+{
+    return (c == '(' || c == ')' || c == ' ' || c == '\n' || c == '\t' ||
+            c == '\r' || c == ';' || c == '"');
+}
 
+STATIC_INLINE void gib_sexp_skip_space(GibSexpReader *reader)
+{
+    const char *pos = reader->pos;
+    while (pos < reader->end) {
+        char c = *pos;
+        if (c == ' ' || c == '\n' || c == '\t' || c == '\r') {
+            pos++;
+        } else if (c == ';') {
+            while (pos < reader->end && *pos != '\n') {
+                pos++;
+            }
+        } else {
+            break;
+        }
+    }
+    reader->pos = pos;
+}
 
-// List API.
+// The next atom. It isn't NUL terminated.
+STATIC_INLINE const char *gib_sexp_atom(GibSexpReader *reader, size_t *len)
+{
+    const char *start = reader->pos;
+    const char *pos = start;
+    while (pos < reader->end && !gib_sexp_is_delim(*pos)) {
+        pos++;
+    }
+    if (pos == start) {
+        gib_sexp_error(reader, "expected an atom.");
+    }
+    reader->pos = pos;
+    *len = pos - start;
+    return start;
+}
 
-GibList *gib_list_alloc(size_t data_size)
+STATIC_INLINE void gib_sexp_expect_close(GibSexpReader *reader)
 {
-    // GibList *ls = gib_alloc(sizeof(GibList));
-    GibList *ls = gib_list_bumpalloc(sizeof(GibList));
-    ls->data_size = data_size;
-    ls->data = (void *) NULL;
-    ls->next = (GibList *) NULL;
-    return ls;
+    gib_sexp_skip_space(reader);
+    if (reader->pos >= reader->end || *reader->pos != ')') {
+        gib_sexp_error(reader, "expected a ')'.");
+    }
+    reader->pos++;
 }
 
-GibBool gib_list_is_empty(GibList *ls)
+static void gib_sexp_read_scalar(GibSexpReader *reader, GibSexpFieldKind kind)
 {
-    return ls->next == NULL;
+    gib_sexp_skip_space(reader);
+    switch (kind) {
+        case GIB_SEXP_INT: {
+            size_t len;
+            const char *atom = gib_sexp_atom(reader, &len);
+            char tmp[32];
+            if (len >= sizeof(tmp)) {
+                gib_sexp_error(reader, "expected an Int.");
+            }
+            memcpy(tmp, atom, len);
+            tmp[len] = '\0';
+            char *endp;
+            errno = 0;
+            GibInt val = strtoll(tmp, &endp, 10);
+            if (endp == tmp || *endp != '\0') {
+                gib_sexp_error(reader, "expected an Int.");
+            }
+            if (errno == ERANGE) {
+                gib_sexp_error(reader, "Int out of range.");
+            }
+            memcpy(gib_sexp_reserve(reader->out, sizeof(GibInt)), &val, sizeof(GibInt));
+            break;
+        }
+        case GIB_SEXP_FLOAT: {
+            size_t len;
+            const char *atom = gib_sexp_atom(reader, &len);
+            char tmp[64];
+            if (len >= sizeof(tmp)) {
+                gib_sexp_error(reader, "expected a Float.");
+            }
+            memcpy(tmp, atom, len);
+            tmp[len] = '\0';
+            char *endp;
+            GibFloat val = strtof(tmp, &endp);
+            if (*endp != '\0') {
+                gib_sexp_error(reader, "expected a Float.");
+            }
+            memcpy(gib_sexp_reserve(reader->out, sizeof(GibFloat)), &val, sizeof(GibFloat));
+            break;
+        }
+        case GIB_SEXP_BOOL: {
+            size_t len;
+            const char *atom = gib_sexp_atom(reader, &len);
+            GibBool val;
+            if ((len == 2 && memcmp(atom, "#t", 2) == 0) || (len == 4 && memcmp(atom, "True", 4) == 0) ||
+                (len == 1 && atom[0] == '1')) {
+                val = true;
+            } else if ((len == 2 && memcmp(atom, "#f", 2) == 0) || (len == 5 && memcmp(atom, "False", 5) == 0) ||
+                       (len == 1 && atom[0] == '0')) {
+                val = false;
+            } else {
+                gib_sexp_error(reader, "expected a Bool.");
+            }
+            *(GibBool *) gib_sexp_reserve(reader->out, sizeof(GibBool)) = val;
+            break;
+        }
+        case GIB_SEXP_CHAR: {
+            size_t len;
+            const char *atom = gib_sexp_atom(reader, &len);
+            if (len == 3 && atom[0] == '#' && atom[1] == '\\') {
+                atom += 2;
+                len = 1;
+            }
+            if (len != 1) {
+                gib_sexp_error(reader, "expected a Char.");
+            }
+            *(GibChar *) gib_sexp_reserve(reader->out, sizeof(GibChar)) = atom[0];
+            break;
+        }
+        case GIB_SEXP_SYM: {
+            const char *start;
+            size_t len;
+            if (reader->pos < reader->end && *reader->pos == '"') {
+                start = ++reader->pos;
+                while (reader->pos < reader->end && *reader->pos != '"') {
+                    reader->pos++;
+                }
+                if (reader->pos == reader->end) {
+                    gib_sexp_error(reader, "unterminated string.");
+                }
+                len = reader->pos - start;
+                reader->pos++;
+            } else {
+                if (reader->pos < reader->end && *reader->pos == '\'') {
+                    reader->pos++;
+                }
+                start = gib_sexp_atom(reader, &len);
+            }
+            char tmp[256];
+            char *name = (len < sizeof(tmp)) ? tmp : (char *) malloc(len + 1);
+            memcpy(name, start, len);
+            name[len] = '\0';
+            GibSym val = gib_sexp_intern(name);
+            if (name != tmp) {
+                free(name);
+            }
+            memcpy(gib_sexp_reserve(reader->out, sizeof(GibSym)), &val, sizeof(GibSym));
+            break;
+        }
+        default:
+            gib_sexp_error(reader, "can't read a field of this type.");
+    }
 }
 
-GibList *gib_list_cons(void *elt, GibList *ls)
+// Read the head of a value: an optional paren and a constructor, whose tag
+// is written out.
+static const GibSexpDatacon *gib_sexp_read_head(GibSexpReader *reader, uint32_t datatype,
+                                                bool *open)
 {
-    // void* data = gib_alloc(ls->data_size);
-    void* data = gib_list_bumpalloc(ls->data_size);
-    if (data == NULL) {
-        fprintf(stderr, "gib_list_cons: gib_alloc failed: %zu", ls->data_size);
-        exit(1);
+    const GibSexpDatatype *dt = &(reader->datatypes[datatype]);
+    gib_sexp_skip_space(reader);
+    *open = (reader->pos < reader->end && *reader->pos == '(');
+    if (*open) {
+        reader->pos++;
+        gib_sexp_skip_space(reader);
     }
-    memcpy(data, elt, ls->data_size);
-    // GibList *res = gib_alloc(sizeof(GibList));
-    GibList *res = gib_list_bumpalloc(sizeof(GibList));
-    res->data_size = ls->data_size;
-    res->data = data;
-    res->next = (GibList*) ls;
-    return res;
+    size_t len;
+    const char *atom = gib_sexp_atom(reader, &len);
+    for (uint32_t i = 0; i < dt->num_datacons; i++) {
+        const GibSexpDatacon *dcon = &(dt->datacons[i]);
+        if (strlen(dcon->name) == len && memcmp(dcon->name, atom, len) == 0) {
+            if (!*open && dcon->num_fields > 0) {
+                gib_sexp_error(reader, "expected a '('.");
+            }
+            *(GibPackedTag *) gib_sexp_reserve(reader->out, sizeof(GibPackedTag)) = dcon->tag;
+            return dcon;
+        }
+    }
+    char msg[256];
+    snprintf(msg, sizeof(msg), "%.*s is not a constructor of %s.", (int) len, atom, dt->name);
+    gib_sexp_error(reader, msg);
+    return NULL;
 }
 
-void *gib_list_head(GibList *ls)
+// Skip over a value without reading it.
+static void gib_sexp_skip_value(GibSexpReader *reader)
 {
-    return ls->data;
+    gib_sexp_skip_space(reader);
+    if (reader->pos >= reader->end) {
+        gib_sexp_error(reader, "unexpected end of file.");
+    }
+    if (*reader->pos != '(') {
+        size_t len;
+        if (*reader->pos == '"') {
+            reader->pos++;
+            while (reader->pos < reader->end && *reader->pos != '"') {
+                reader->pos++;
+            }
+            reader->pos++;
+        } else {
+            gib_sexp_atom(reader, &len);
+        }
+        return;
+    }
+    size_t depth = 0;
+    const char *pos = reader->pos;
+    while (pos < reader->end) {
+        char c = *pos++;
+        if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            if (--depth == 0) {
+                reader->pos = pos;
+                return;
+            }
+        } else if (c == '"') {
+            while (pos < reader->end && *pos != '"') {
+                pos++;
+            }
+            pos++;
+        } else if (c == ';') {
+            while (pos < reader->end && *pos != '\n') {
+                pos++;
+            }
+        }
+    }
+    gib_sexp_error(reader, "unbalanced parens.");
 }
 
-GibList* gib_list_tail(GibList *ls)
+static void gib_sexp_read_value(GibSexpReader *reader, uint32_t datatype);
+
+// Read the fields of a constructor that --layout-profile reordered. They're
+// written in source order, so find where each one starts and read them in
+// layout order. If the last field is still last, it's left for the caller to
+// read in a loop: *datatype is set to its datatype and it returns true.
+static bool gib_sexp_read_reordered(GibSexpReader *reader, const GibSexpDatacon *dcon,
+                                    uint32_t *datatype)
 {
-    return ls->next;
+    uint32_t last = dcon->num_fields - 1;
+    const char *starts_buf[16];
+    const char **starts = (dcon->num_fields <= 16) ? starts_buf :
+                          (const char **) malloc(dcon->num_fields * sizeof(char *));
+    for (uint32_t i = 0; i <= last; i++) {
+        gib_sexp_skip_space(reader);
+        starts[i] = reader->pos;
+        if (i < last) {
+            gib_sexp_skip_value(reader);
+        }
+    }
+    bool tail = (dcon->layout[last] == last && dcon->fields[last].kind == GIB_SEXP_PACKED);
+    const char *end = reader->pos;
+    for (uint32_t j = 0; j < last + !tail; j++) {
+        uint32_t i = dcon->layout[j];
+        const GibSexpField *field = &(dcon->fields[i]);
+        reader->pos = starts[i];
+        if (field->kind != GIB_SEXP_PACKED) {
+            gib_sexp_read_scalar(reader, field->kind);
+        } else {
+            gib_sexp_read_value(reader, field->datatype);
+        }
+        if (i == last) {
+            end = reader->pos;
+        }
+    }
+    if (tail) {
+        reader->pos = starts[last];
+        *datatype = dcon->fields[last].datatype;
+    } else {
+        reader->pos = end;
+    }
+    if (starts != starts_buf) {
+        free(starts);
+    }
+    return tail;
 }
 
-void gib_list_free(GibList *ls)
+// Read a value and pack it. The last field of a constructor is read in a
+// loop rather than recursively, so lists don't use up the C stack.
+static void gib_sexp_read_value(GibSexpReader *reader, uint32_t datatype)
 {
-    gib_free(ls->data);
-    gib_free(ls);
-    return;
+    size_t pending_closes = 0;
+    while (true) {
+        bool open;
+        const GibSexpDatacon *dcon = gib_sexp_read_head(reader, datatype, &open);
+        bool tail = false;
+        if (dcon->layout != NULL) {
+            tail = gib_sexp_read_reordered(reader, dcon, &datatype);
+        } else {
+            for (uint32_t i = 0; i < dcon->num_fields; i++) {
+                const GibSexpField *field = &(dcon->fields[i]);
+                if (field->kind != GIB_SEXP_PACKED) {
+                    gib_sexp_read_scalar(reader, field->kind);
+                } else if (i == dcon->num_fields - 1) {
+                    tail = true;
+                    datatype = field->datatype;
+                } else {
+                    gib_sexp_read_value(reader, field->datatype);
+                }
+            }
+        }
+        if (!tail) {
+            if (open) {
+                gib_sexp_expect_close(reader);
+            }
+            break;
+        }
+        pending_closes += open;
+    }
+    for (size_t i = 0; i < pending_closes; i++) {
+        gib_sexp_expect_close(reader);
+    }
 }
 
-GibList *gib_list_copy(GibList *ls)
+#ifdef _GIBBON_PARALLEL
+// A field that's packed separately.
+typedef struct gib_sexp_task {
+    const char *start;
+    const char *end;
+    uint32_t datatype;
+    // Where its output goes in the output of the spine.
+    size_t offset;
+    GibSexpBuffer out;
+} GibSexpTask;
+
+static GibSexpTask *gib_sexp_new_task(GibSexpTask **tasks, size_t *num_tasks, size_t *cap_tasks)
 {
-    GibList *ls2 = gib_list_alloc(ls->data_size);
-    if (ls->data != NULL) {
-        void* data = gib_list_bumpalloc(ls->data_size);
-        memcpy(data, ls->data, ls->data_size);
-        ls2->data = data;
+    if (*num_tasks == *cap_tasks) {
+        *cap_tasks = (*cap_tasks == 0) ? 1024 : (*cap_tasks * 2);
+        *tasks = (GibSexpTask *) realloc(*tasks, *cap_tasks * sizeof(GibSexpTask));
+        if (*tasks == NULL) {
+            fprintf(stderr, "gib_read_sexp_file: realloc failed.\n");
+            exit(1);
+        }
     }
-    ls2->next = ls->next;
-    return ls2;
+    return &((*tasks)[(*num_tasks)++]);
 }
 
-/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * Ppm images
- * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- */
+static void gib_sexp_read_value_par(GibSexpReader *reader, uint32_t datatype)
+{
+    GibSexpTask *tasks = (GibSexpTask *) NULL;
+    size_t num_tasks = 0;
+    size_t cap_tasks = 0;
+
+    // Walk the spine and collect the tasks.
+    size_t pending_closes = 0;
+    while (true) {
+        bool open;
+        const GibSexpDatacon *dcon = gib_sexp_read_head(reader, datatype, &open);
+        bool tail = false;
+        if (dcon->layout != NULL) {
+            // Packed by this thread, without splitting up its fields.
+            tail = gib_sexp_read_reordered(reader, dcon, &datatype);
+        } else {
+            for (uint32_t i = 0; i < dcon->num_fields; i++) {
+                const GibSexpField *field = &(dcon->fields[i]);
+                if (field->kind != GIB_SEXP_PACKED) {
+                    gib_sexp_read_scalar(reader, field->kind);
+                } else if (i == dcon->num_fields - 1) {
+                    tail = true;
+                    datatype = field->datatype;
+                } else {
+                    gib_sexp_skip_space(reader);
+                    GibSexpTask *task = gib_sexp_new_task(&tasks, &num_tasks, &cap_tasks);
+                    task->start = reader->pos;
+                    gib_sexp_skip_value(reader);
+                    task->end = reader->pos;
+                    task->datatype = field->datatype;
+                    task->offset = reader->out->len;
+                }
+            }
+        }
+        if (!tail) {
+            if (open) {
+                gib_sexp_expect_close(reader);
+            }
+            break;
+        }
+        pending_closes += open;
+    }
+    for (size_t i = 0; i < pending_closes; i++) {
+        gib_sexp_expect_close(reader);
+    }
 
-// Example: writePpm("gibbon_rgb_1000.ppm", 1000, 1000, pixels);
-void gib_write_ppm(char* filename, GibInt width, GibInt height, GibVector *pixels)
+    cilk_for (size_t i = 0; i < num_tasks; i++) {
+        GibSexpTask *task = &(tasks[i]);
+        gib_sexp_init_buffer(&(task->out), (task->end - task->start) + 64);
+        GibSexpReader task_reader = { reader->filename, reader->text, task->start,
+                                      task->end, reader->datatypes, &(task->out) };
+        gib_sexp_read_value(&task_reader, task->datatype);
+    }
+
+    // Splice the output of the tasks into the output of the spine.
+    size_t total = reader->out->len;
+    for (size_t i = 0; i < num_tasks; i++) {
+        total += tasks[i].out.len;
+    }
+    GibSexpBuffer spine = *(reader->out);
+    gib_sexp_init_buffer(reader->out, total);
+    size_t spine_pos = 0;
+    for (size_t i = 0; i < num_tasks; i++) {
+        GibSexpTask *task = &(tasks[i]);
+        size_t n = task->offset - spine_pos;
+        memcpy(gib_sexp_reserve(reader->out, n), spine.start + spine_pos, n);
+        spine_pos = task->offset;
+        memcpy(gib_sexp_reserve(reader->out, task->out.len), task->out.start, task->out.len);
+        free(task->out.start);
+    }
+    size_t n = spine.len - spine_pos;
+    memcpy(gib_sexp_reserve(reader->out, n), spine.start + spine_pos, n);
+    free(spine.start);
+    free(tasks);
+}
+#endif
+
+bool gib_is_sexp_file(char *filename)
 {
-    FILE *fp;
-    fp = fopen(filename, "w+");
-    fprintf(fp, "P3\n");
-    // fprintf(fp, "%lld %lld\n255\n", width, height);
-    fprintf(fp, "%" PRId64 " %" PRId64 "\n255\n", width, height);
-    GibInt len = gib_vector_length(pixels);
-    gib_write_ppm_loop(fp, 0, len, pixels);
-    fclose(fp);
-    return;
+    size_t len = strlen(filename);
+    return (len >= 5 && strcmp(filename + len - 5, ".sexp") == 0);
 }
 
-void gib_write_ppm_loop(FILE *fp, GibInt idx, GibInt end, GibVector *pixels)
+GibCursor gib_read_sexp_file(char *filename, const GibSexpDatatype *datatypes,
+                             uint32_t num_datatypes, const char *tycon, GibInt *size)
 {
-    bool fltIf_5768_6575 = idx == end;
+    uint32_t root = 0;
+    while (root < num_datatypes && strcmp(datatypes[root].name, tycon) != 0) {
+        root++;
+    }
+    if (root == num_datatypes) {
+        fprintf(stderr, "gib_read_sexp_file: unknown datatype %s.\n", tycon);
+        exit(1);
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "gib_read_sexp_file: couldn't open %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "gib_read_sexp_file: couldn't stat %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "gib_read_sexp_file: %s is empty.\n", filename);
+        exit(1);
+    }
+    char *text = (char *) mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) {
+        fprintf(stderr, "gib_read_sexp_file: mmap failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    close(fd);
 
-    if (fltIf_5768_6575) {
-        return;
+    // The packed value is usually a good deal smaller than its text.
+    GibSexpBuffer out;
+    gib_sexp_init_buffer(&out, (st.st_size / 2) + 64);
+    GibSexpReader reader = { filename, text, text, text + st.st_size, datatypes, &out };
+    gib_sexp_init_syms();
+#ifdef _GIBBON_PARALLEL
+    if (st.st_size >= (off_t) GIB_SEXP_PARALLEL_THRESHOLD) {
+        gib_sexp_read_value_par(&reader, root);
     } else {
-        GibPixel *tmp_112;
-        tmp_112 = (GibPixel *) gib_vector_nth(pixels, idx);
-        GibPixel tup = *tmp_112;
-        GibInt x = tup.field0;
-        GibInt y = tup.field1;
-        GibInt z = tup.field2;
-        // write to file.
-        // fprintf(fp, "%lld %lld %lld\n", x, y, z);
-        fprintf(fp, "%" PRId64 " %" PRId64 " %" PRId64 "\n", x, y, z);
-        gib_write_ppm_loop(fp, (idx+1), end, pixels);
+        gib_sexp_read_value(&reader, root);
+    }
+#else
+    gib_sexp_read_value(&reader, root);
+#endif
+    gib_sexp_skip_space(&reader);
+    if (reader.pos != reader.end) {
+        gib_sexp_error(&reader, "trailing input after the value.");
     }
+    gib_sexp_free_syms();
+    munmap(text, st.st_size);
+    *size = (GibInt) out.len;
+    return out.start;
 }
 
 
@@ -1012,7 +3424,7 @@ void gib_check_rust_struct_sizes(void)
 {
     // Sizes in the Rust RTS.
     size_t *stack, *frame, *nursery, *generation, *reg_info, *footer, *gc_stats;
-    stack = (size_t *) gib_alloc(sizeof(size_t) * 7);
+    stack = (size_t *) malloc(sizeof(size_t) * 7);
     frame = (size_t *) ((char *) stack + sizeof(size_t));
     nursery = (size_t *) ((char *) frame + sizeof(size_t));
     generation = (size_t *) ((char *) nursery + sizeof(size_t));
@@ -1031,7 +3443,7 @@ void gib_check_rust_struct_sizes(void)
     assert(*gc_stats == sizeof(GibGcStats));
 
     // Done.
-    gib_free(stack);
+    free(stack);
 
     return;
 }
@@ -1098,44 +3510,13 @@ STATIC_INLINE void gib_perform_GC_(bool force_major);
  * ~~~~~~~~~~~~~~~~~~~~
  */
 
-GibChunk gib_alloc_region(size_t size);
-STATIC_INLINE GibChunk gib_alloc_region_in_nursery_fast(size_t size, bool collected);
-static GibChunk gib_alloc_region_in_nursery_slow(size_t size, bool collected);
-GibChunk gib_alloc_region_on_heap(size_t size);
-
-
-GibChunk gib_alloc_region(size_t size)
-{
-    return gib_alloc_region_in_nursery_fast(size, false);
-}
-
-STATIC_INLINE GibChunk gib_alloc_region_in_nursery_fast(size_t size, bool collected)
+// A copy of gib_alloc_region that is not inlined, for use via Rust.
+GibChunk gib_alloc_region_noinline(size_t size)
 {
-    GibNursery *nursery = DEFAULT_NURSERY;
-    char *old = nursery->alloc;
-    char *bump = old - size - sizeof(GibNurseryChunkFooter);
-    if (LIKELY((bump >= nursery->heap_start))) {
-
-#ifdef _GIBBON_GCSTATS
-        GC_STATS->nursery_regions++;
-        GC_STATS->mem_allocated_in_nursery += size;
-#endif
-        nursery->alloc = bump;
-        char *footer = old - sizeof(GibNurseryChunkFooter);
-        *(GibNurseryChunkFooter *) footer = size;
-
-#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
-        fprintf(stderr, "Allocated a nursery chunk of size %ld, (%p, %p).\n",
-                size, bump, footer);
-#endif
-
-        return (GibChunk) {bump, footer};
-    } else {
-        return gib_alloc_region_in_nursery_slow(size, collected);
-    }
+    return gib_alloc_region(size);
 }
 
-static GibChunk gib_alloc_region_in_nursery_slow(size_t size, bool collected)
+GibChunk gib_alloc_region_in_nursery_slow(size_t size, bool collected)
 {
     if (UNLIKELY((size > gib_nursery_region_max_size))) {
         return gib_alloc_region_on_heap(size);
@@ -1322,6 +3703,7 @@ static void gib_bump_global_region_count(void)
 
 void gib_print_global_region_count(void)
 {
+    gib_flush_stdout();
     printf("REGION_COUNT: %" PRId64 "\n", gib_global_region_count);
     return;
 }
@@ -1353,28 +3735,28 @@ UNUSED_IN_POINTER_BAK static void gib_storage_initialize(void)
     }
 
     // Initialize the stats object.
-    gib_global_gc_stats = (GibGcStats *) gib_alloc(sizeof(GibGcStats));
+    gib_global_gc_stats = (GibGcStats *) malloc(sizeof(GibGcStats));
     gib_gc_stats_initialize(gib_global_gc_stats);
 
     // Initialize nurseries.
     uint64_t n;
-    gib_global_nurseries = (GibNursery *) gib_alloc(gib_global_num_threads *
+    gib_global_nurseries = (GibNursery *) malloc(gib_global_num_threads *
                                                     sizeof(GibNursery));
     for (n = 0; n < gib_global_num_threads; n++) {
         gib_nursery_initialize(&(gib_global_nurseries[n]), gib_nursery_size);
     }
 
     // Initialize old generation.
-    gib_global_oldgen = (GibOldgen *) gib_alloc(sizeof(GibOldgen));
+    gib_global_oldgen = (GibOldgen *) malloc(sizeof(GibOldgen));
     gib_oldgen_initialize(gib_global_oldgen);
 
     // Initialize shadow stacks.
     uint64_t ss;
     gib_global_read_shadowstacks =
-            (GibShadowstack *) gib_alloc(gib_global_num_threads *
+            (GibShadowstack *) malloc(gib_global_num_threads *
                                          sizeof(GibShadowstack));
     gib_global_write_shadowstacks =
-            (GibShadowstack *) gib_alloc(gib_global_num_threads *
+            (GibShadowstack *) malloc(gib_global_num_threads *
                                          sizeof(GibShadowstack));
     for (ss = 0; ss < gib_global_num_threads; ss++) {
         gib_shadowstack_initialize(&(gib_global_read_shadowstacks[ss]),
@@ -1397,11 +3779,11 @@ UNUSED_IN_POINTER_BAK static void gib_storage_free(void)
     for (n = 0; n < gib_global_num_threads; n++) {
         gib_nursery_free(&(gib_global_nurseries[n]));
      }
-    gib_free(gib_global_nurseries);
+    free(gib_global_nurseries);
 
     // Free oldgen.
     gib_oldgen_free(gib_global_oldgen);
-    gib_free(gib_global_oldgen);
+    free(gib_global_oldgen);
 
     // Free shadow-stacks.
     uint64_t ss;
@@ -1409,8 +3791,8 @@ UNUSED_IN_POINTER_BAK static void gib_storage_free(void)
         gib_shadowstack_free(&(gib_global_read_shadowstacks[ss]));
         gib_shadowstack_free(&(gib_global_write_shadowstacks[ss]));
     }
-    gib_free(gib_global_read_shadowstacks);
-    gib_free(gib_global_write_shadowstacks);
+    free(gib_global_read_shadowstacks);
+    free(gib_global_write_shadowstacks);
 
     // Free the stats object.
     gib_gc_stats_free(gib_global_gc_stats);
@@ -1426,7 +3808,7 @@ UNUSED_IN_POINTER_BAK static void gib_storage_free(void)
 size_t gib_nursery_realloc(GibNursery *nursery, size_t size)
 {
     size_t old_size = nursery->heap_size;
-    gib_free(nursery->heap_start);
+    free(nursery->heap_start);
     gib_nursery_initialize(nursery, size);
     gib_nursery_size = size;
     gib_nursery_region_max_size = size / 2;
@@ -1436,9 +3818,9 @@ size_t gib_nursery_realloc(GibNursery *nursery, size_t size)
 static void gib_nursery_initialize(GibNursery *nursery, size_t nsize)
 {
     nursery->heap_size = nsize;
-    nursery->heap_start = (char *) gib_alloc(nsize);
+    nursery->heap_start = (char *) malloc(nsize);
     if (nursery->heap_start == NULL) {
-        fprintf(stderr, "gib_nursery_initialize: gib_alloc failed: %zu",
+        fprintf(stderr, "gib_nursery_initialize: malloc failed: %zu",
                 (size_t) nsize);
         exit(1);
     }
@@ -1456,7 +3838,7 @@ static void gib_nursery_initialize(GibNursery *nursery, size_t nsize)
 // Free data associated with a nursery.
 static void gib_nursery_free(GibNursery *nursery)
 {
-    gib_free(nursery->heap_start);
+    free(nursery->heap_start);
     return;
 }
 
@@ -1472,9 +3854,9 @@ static void gib_oldgen_initialize(GibOldgen *oldgen)
     oldgen->old_zct = (void *) NULL;
     oldgen->new_zct = (void *) NULL;
     // Initialize the remembered set.
-    oldgen->rem_set = (GibRememberedSet *) gib_alloc(sizeof(GibRememberedSet));
+    oldgen->rem_set = (GibRememberedSet *) malloc(sizeof(GibRememberedSet));
     if (oldgen->rem_set == NULL) {
-        fprintf(stderr, "gib_oldgen_initialize: gib_alloc failed: %zu",
+        fprintf(stderr, "gib_oldgen_initialize: malloc failed: %zu",
                 sizeof(GibRememberedSet));
         exit(1);
     }
@@ -1486,7 +3868,7 @@ static void gib_oldgen_initialize(GibOldgen *oldgen)
 static void gib_oldgen_free(GibOldgen *oldgen)
 {
     gib_shadowstack_free(oldgen->rem_set);
-    gib_free(oldgen->rem_set);
+    free(oldgen->rem_set);
     return;
 }
 
@@ -1500,9 +3882,9 @@ static void gib_oldgen_free(GibOldgen *oldgen)
 // Initialize a shadow stack.
 static void gib_shadowstack_initialize(GibShadowstack* stack, size_t stack_size)
 {
-    stack->start = (char *) gib_alloc(stack_size);
+    stack->start = (char *) malloc(stack_size);
     if (stack->start == NULL) {
-        fprintf(stderr, "gib_shadowstack_initialize: gib_alloc failed: %zu",
+        fprintf(stderr, "gib_shadowstack_initialize: malloc failed: %zu",
                 stack_size);
         exit(1);
     }
@@ -1513,7 +3895,7 @@ static void gib_shadowstack_initialize(GibShadowstack* stack, size_t stack_size)
 
 static void gib_shadowstack_free(GibShadowstack* stack)
 {
-    gib_free(stack->start);
+    free(stack->start);
     return;
 }
 
@@ -1614,7 +3996,7 @@ static void gib_gc_stats_initialize(GibGcStats *stats)
 
 static void gib_gc_stats_free(GibGcStats *stats)
 {
-    gib_free(stats);
+    free(stats);
 }
 
 #ifdef _GIBBON_GCSTATS
@@ -1682,25 +4064,25 @@ static void gib_gc_stats_print(GibGcStats *stats)
 
 GibGcStateSnapshot *gib_gc_init_state(uint64_t num_regions)
 {
-    GibGcStateSnapshot *snapshot = gib_alloc(sizeof(GibGcStateSnapshot));
+    GibGcStateSnapshot *snapshot = malloc(sizeof(GibGcStateSnapshot));
     if (snapshot == NULL) {
-        fprintf(stderr, "gib_gc_save_state: gib_alloc failed: %zu", sizeof(GibGcStateSnapshot));
+        fprintf(stderr, "gib_gc_save_state: malloc failed: %zu", sizeof(GibGcStateSnapshot));
         exit(1);
     }
-    snapshot->nursery_heap_start = gib_alloc(gib_nursery_size);
+    snapshot->nursery_heap_start = malloc(gib_nursery_size);
     if (snapshot->nursery_heap_start == NULL) {
-        fprintf(stderr, "gib_gc_save_state: gib_alloc failed: %zu", (size_t) gib_nursery_size);
+        fprintf(stderr, "gib_gc_save_state: malloc failed: %zu", (size_t) gib_nursery_size);
         exit(1);
     }
-    snapshot->reg_info_addrs = gib_alloc(num_regions * sizeof(GibRegionInfo*));
+    snapshot->reg_info_addrs = malloc(num_regions * sizeof(GibRegionInfo*));
     if (snapshot == NULL) {
-        fprintf(stderr, "gib_gc_save_state: gib_alloc failed: %zu",
+        fprintf(stderr, "gib_gc_save_state: malloc failed: %zu",
                 num_regions * sizeof(GibRegionInfo *));
         exit(1);
     }
-    snapshot->outsets = gib_alloc(num_regions * sizeof(char*));
+    snapshot->outsets = malloc(num_regions * sizeof(char*));
     if (snapshot == NULL) {
-        fprintf(stderr, "gib_gc_save_state: gib_alloc failed: %zu",
+        fprintf(stderr, "gib_gc_save_state: malloc failed: %zu",
                 num_regions * sizeof(void*));
         exit(1);
     }
@@ -1798,10 +4180,10 @@ void gib_gc_restore_state(GibGcStateSnapshot *snapshot)
 
 void gib_gc_free_state(GibGcStateSnapshot *snapshot)
 {
-    gib_free(snapshot->nursery_heap_start);
-    gib_free(snapshot->reg_info_addrs);
-    gib_free(snapshot->outsets);
-    gib_free(snapshot);
+    free(snapshot->nursery_heap_start);
+    free(snapshot->reg_info_addrs);
+    free(snapshot->outsets);
+    free(snapshot);
 }
 
 
@@ -1828,8 +4210,17 @@ void gib_show_usage(char** argv)
     printf(" --array-input <path>           Set the file from which to read the array input.\n");
     printf(" --array-input-length <int>     Set the size of the array input file.\n");
     printf(" --iterate <int>                Set the number of timing iterations to perform (default 1).\n");
+    printf(" --warmup <int>                 Run this many untimed iterations first (default 0).\n");
+    printf(" --bench-time <seconds>         Keep iterating until the timed iterations add up to this (default 0).\n");
+    printf(" --bench-json <path>            Append timing statistics to this file as JSON lines, '-' for stdout.\n");
+    printf(" --pin-core <int>               Pin the program to this core while benchmarking.\n");
+    printf(" --drop-caches                  Drop the page cache before every iteration (needs root).\n");
+    printf(" --perf-counters <events>       Count these hardware events (comma separated, e.g. cycles,instructions,LLC-load-misses) in timed expressions.\n");
+    printf(" --print-max-rss                Print the peak resident set size after timed expressions.\n");
     // TODO: Rectify the definition of size-param
     printf(" --size-param <int>             A parameter for size available as a language primitive which allows user to specify the size at runtime (default 1).\n");
+    printf(" --seed <int>                   Seed for the random number generators used by rand and frand (default 1).\n");
+    printf(" --layout-profile <path>        Where a program compiled with --profile-layout writes its profile (default gibbon_layout_profile.txt).\n");
     return;
 }
 
@@ -1986,7 +4377,7 @@ int gib_init(int argc, char **argv)
         else if (strcmp(argv[i], "--bench-prog") == 0 && i < argc - 1) {
             check_args(i, argc, argv, "--bench-prog");
             int len = strlen(argv[i+1]);
-            gib_global_bench_prog_param = (char*) gib_alloc((len+1)*sizeof(char));
+            gib_global_bench_prog_param = (char*) malloc((len+1)*sizeof(char));
             strncpy(gib_global_bench_prog_param,argv[i+1],len);
             i++;
         }
@@ -1995,6 +4386,50 @@ int gib_init(int argc, char **argv)
             gib_global_iters_param = atoll(argv[i+1]);
             i++;
         }
+        else if ((strcmp(argv[i], "--warmup") == 0)) {
+            check_args(i, argc, argv, "--warmup");
+            gib_global_warmup_param = atoll(argv[i+1]);
+            i++;
+        }
+        else if ((strcmp(argv[i], "--bench-time") == 0)) {
+            check_args(i, argc, argv, "--bench-time");
+            gib_global_bench_time_param = atof(argv[i+1]);
+            i++;
+        }
+        else if ((strcmp(argv[i], "--bench-json") == 0)) {
+            check_args(i, argc, argv, "--bench-json");
+            gib_global_bench_json_param = argv[i+1];
+            i++;
+        }
+        else if ((strcmp(argv[i], "--pin-core") == 0)) {
+            check_args(i, argc, argv, "--pin-core");
+            gib_global_pin_core_param = atoll(argv[i+1]);
+            i++;
+        }
+        else if ((strcmp(argv[i], "--perf-counters") == 0)) {
+            check_args(i, argc, argv, "--perf-counters");
+            gib_global_perf_counters_param = argv[i+1];
+            i++;
+        }
+        else if ((strncmp(argv[i], "--perf-counters=", 16) == 0)) {
+            gib_global_perf_counters_param = argv[i] + 16;
+        }
+        else if ((strcmp(argv[i], "--drop-caches") == 0)) {
+            gib_global_drop_caches_param = true;
+        }
+        else if ((strcmp(argv[i], "--print-max-rss") == 0)) {
+            gib_global_print_max_rss_param = true;
+        }
+        else if ((strcmp(argv[i], "--seed") == 0)) {
+            check_args(i, argc, argv, "--seed");
+            gib_global_seed_param = strtoull(argv[i+1], NULL, 10);
+            i++;
+        }
+        else if ((strcmp(argv[i], "--layout-profile") == 0)) {
+            check_args(i, argc, argv, "--layout-profile");
+            gib_global_layout_profile_param = argv[i+1];
+            i++;
+        }
         else if ((strcmp(argv[i], "--size-param") == 0)) {
             check_args(i, argc, argv, "--size-param");
             gib_global_size_param = atoll(argv[i+1]);
@@ -2012,10 +4447,13 @@ int gib_init(int argc, char **argv)
     // Initialize gib_global_bench_prog_param to an empty string in case
     // the runtime argument --bench-prog isn't passed.
     if (gib_global_bench_prog_param == NULL) {
-        gib_global_bench_prog_param = (char*) gib_alloc(1*sizeof(char));
+        gib_global_bench_prog_param = (char*) malloc(1*sizeof(char));
         *gib_global_bench_prog_param = '\n';
     }
 
+    // Before the Cilk workers start, so that they inherit the counters.
+    gib_perf_counters_open();
+
     // Initialize number of threads before the storage.
 #ifdef _GIBBON_PARALLEL
     gib_global_num_threads = __cilkrts_get_nworkers();
@@ -2025,6 +4463,9 @@ int gib_init(int argc, char **argv)
     printf("Number of threads: %ld\n", gib_global_num_threads);
 #endif
 
+    gib_print_init();
+    gib_rng_init(gib_global_seed_param);
+
 #ifndef _GIBBON_POINTER
     // Initialize the nursery and shadow stack.
     gib_storage_initialize();
@@ -2042,7 +4483,8 @@ int gib_init(int argc, char **argv)
 // Called from gib_main_expr.
 int gib_exit(void)
 {
-    gib_free(gib_global_bench_prog_param);
+    gib_flush_stdout();
+    free(gib_global_bench_prog_param);
 
 #ifndef _GIBBON_POINTER
 
@@ -2063,6 +4505,7 @@ int gib_exit(void)
 
 #endif // ifndef _GIBBON_POINTER
 
+    gib_free_cursor_arrays();
     // gib_free_symtable();
 
     return 0;
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <string.h>
 #include <uthash.h>
 #include <assert.h>
 #include <limits.h>
@@ -128,6 +129,8 @@ char *gib_read_bench_prog_param(void);
 char *gib_read_benchfile_param(void);
 char *gib_read_arrayfile_param(void);
 uint64_t gib_read_arrayfile_length_param(void);
+uint64_t gib_get_seed_param(void);
+char *gib_read_layout_profile_param(void);
 
 // Number of regions allocated.
 int64_t gib_read_region_count(void);
@@ -165,6 +168,16 @@ static const GibTaggedPtr GIB_POINTER_MASK = (UINTPTR_MAX >> GIB_TAG_BITS);
 #define GIB_GET_TAG(tagged)                               \
     (uint16_t) (((GibTaggedPtr) tagged) >> GIB_POINTER_BITS) \
 
+// Issued by the code generated with --prefetch as soon as the target of an
+// indirection, a redirection or a random access node is read. The distance
+// (in bytes past the target) can be tuned with -DGIB_PREFETCH_DISTANCE=<n>.
+#ifndef GIB_PREFETCH_DISTANCE
+#define GIB_PREFETCH_DISTANCE 0
+#endif
+
+#define gib_prefetch(ptr)                                                     \
+    __builtin_prefetch(((char *) (ptr)) + GIB_PREFETCH_DISTANCE, 0, 3)        \
+
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * Allocators
@@ -185,15 +198,44 @@ void gib_ptr_bumpalloc_restore_state(void);
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  */
 
+// An arena is a chain of chunks which is bump allocated and freed all at once.
+// Chunks double in size as the arena grows, up to GIB_ARENA_MAX_CHUNK_SIZE,
+// and requests bigger than that get a chunk of their own. Memory allocated
+// outside the arena can be tied to its lifetime by adding it to the reflist.
+
+#define GIB_ARENA_INIT_CHUNK_SIZE (64 * KB)
+#define GIB_ARENA_MAX_CHUNK_SIZE (16 * MB)
+#define GIB_ARENA_ALIGN 8
+
+typedef struct gib_arena_chunk {
+  struct gib_arena_chunk *prev;
+  size_t size; // Usable bytes that follow this header.
+} GibArenaChunk;
+
+typedef struct gib_arena_ref {
+  struct gib_arena_ref *next;
+  void *ptr;
+} GibArenaRef;
+
 typedef struct gib_arena {
-  int ind;
-  char *mem; // TODO(vollmerm): make this a list of chunks?
-  void *reflist;
+  size_t ind;            // Bump offset into the current chunk.
+  GibArenaChunk *chunk;  // Current chunk, chained to the previous ones.
+  GibArenaRef *reflist;  // Pointers to gib_free along with the arena.
 } GibArena;
 
+// A position in an arena, see gib_arena_reset.
+typedef struct gib_arena_mark {
+  GibArenaChunk *chunk;
+  size_t ind;
+  GibArenaRef *reflist;
+} GibArenaMark;
+
 GibArena *gib_alloc_arena(void);
 void gib_free_arena(GibArena *ar);
 GibCursor gib_extend_arena(GibArena *ar, int size);
+void gib_arena_add_ref(GibArena *ar, void *ptr);
+GibArenaMark gib_arena_mark(GibArena *ar);
+void gib_arena_reset(GibArena *ar, GibArenaMark mark);
 
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -201,14 +243,29 @@ GibCursor gib_extend_arena(GibArena *ar, int size);
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  */
 
-typedef struct gib_symdict {
-  struct gib_symdict *next;
+// A persistent hash array mapped trie (HAMT). Every node branches 32 ways on
+// 5 bits of the (mixed) key; only occupied slots are stored, compressed via
+// the bitmap. A slot holds either a key/value leaf or a pointer to a child
+// node, as recorded in leafmap. Nodes are never mutated after construction,
+// inserts copy the path from the root, and the empty dictionary is NULL.
+
+#define GIB_DICT_BITS 5
+#define GIB_DICT_FANOUT (1 << GIB_DICT_BITS)
+#define GIB_DICT_MASK (GIB_DICT_FANOUT - 1)
+
+typedef struct gib_symdict_slot {
   GibSym key;
-  void *ptrval;
+  void *val; // GibPtr for a leaf, GibSymDict* for a child node.
+} GibSymDictSlot;
+
+typedef struct gib_symdict {
+  uint32_t bitmap;
+  uint32_t leafmap;
+  GibSymDictSlot slots[];
 } GibSymDict;
 
 
-GibSymDict *gib_dict_alloc(GibArena *ar);
+GibSymDict *gib_dict_alloc(GibArena *ar, int num_slots);
 GibSymDict *gib_dict_insert_ptr(GibArena *ar, GibSymDict *ptr, GibSym key, GibPtr val);
 GibPtr gib_dict_lookup_ptr(GibSymDict *ptr, GibSym key);
 
@@ -250,20 +307,57 @@ GibSym gib_lookup_hash(GibSymHash *hash, int k);
 GibBool gib_contains_hash(GibSymHash *hash, int sym);
 
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Printing
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+// The Print primitives format into a buffer which is handed to stdio only
+// when it fills up, or when gib_flush_stdout is called. Anything that writes
+// to stdout directly must call gib_flush_stdout first to keep the output in
+// order. In parallel builds the buffer is a Cilk reducer, and the output is
+// in the same order as in a sequential run.
+//
+// gib_print_string writes the string as it is. It used to be passed to
+// printf as the format, so a '%' in it is no longer interpreted.
+
+#define GIB_PRINT_BUFFER_SIZE (64 * KB)
+
+typedef struct gib_print_buffer {
+    size_t len;
+    char data[GIB_PRINT_BUFFER_SIZE];
+} GibPrintBuffer;
+
+int gib_print_bytes(const char *str, size_t len);
+int gib_print_string(const char *str);
+int gib_print_int(GibInt n);
+int gib_print_float(double f);
+int gib_print_char(GibChar c);
+int gib_print_bool(GibBool b);
+void gib_flush_stdout(void);
+
+
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * Symbol table
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  */
 
-#define MAX_SYMBOL_LEN 256
+// Symbol names are interned into a single arena as length-prefixed strings
+// and indexed densely by symbol through a two-level table of pages. Pages
+// never move once published, so lookups don't need to synchronize with
+// concurrent insertions.
 
-typedef struct gib_symtable {
-    GibSym idx;                 /* key */
-    char value[MAX_SYMBOL_LEN];
-    UT_hash_handle hh;         /* makes this structure hashable */
-} GibSymtable;
+#define GIB_SYMTABLE_PAGE_BITS 12
+#define GIB_SYMTABLE_PAGE_SIZE (1 << GIB_SYMTABLE_PAGE_BITS)
+#define GIB_SYMTABLE_NUM_PAGES (1 << 16)
+
+typedef struct gib_symbol_name {
+    uint32_t len;
+    char str[];
+} GibSymbolName;
 
 void gib_add_symbol(GibSym idx, char *value);
+GibSym gib_gensym_named(char *value);
 void gib_set_newline(GibSym idx);
 void gib_set_space(GibSym idx);
 void gib_set_comma(GibSym idx);
@@ -295,7 +389,7 @@ typedef struct gib_vector {
 typedef int (*GibCmpFn)(const void *, const void*) ;
 
 GibVector *gib_vector_alloc(GibInt num, size_t elt_size);
-inline __attribute__((always_inline)) GibCursor *gib_array_alloc(GibCursor *data, size_t arr_size);
+GibCursor *gib_array_alloc(GibCursor *data, size_t arr_size);
 GibInt gib_vector_length(GibVector *vec);
 GibBool gib_vector_is_empty(GibVector *vec);
 GibVector *gib_vector_slice(GibInt i, GibInt n, GibVector *vec);
@@ -311,6 +405,47 @@ void gib_print_timing_array(GibVector *times);
 double gib_sum_timing_array(GibVector *times);
 
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Benchmarking
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+// Hardware performance counters, enabled with --perf-counters.
+#define GIB_PERF_MAX_COUNTERS 8
+
+void gib_perf_counters_open(void);
+void gib_perf_counters_start(void);
+void gib_perf_counters_stop(void);
+void gib_perf_counters_print(void);
+
+void gib_print_max_rss(void);
+
+// State of the iterate loop generated for a timed expression, see
+// gib_bench_continue.
+typedef struct gib_bench {
+    const char *name;
+    GibInt warmup_left;
+    GibInt min_iters;
+    // Measured iterations so far, and their sum.
+    GibInt num_times;
+    double elapsed;
+    // Time of the latest iteration, warmup or not.
+    double last_time;
+    bool is_last;
+    bool done;
+    double *times;
+    // GIB_PERF_MAX_COUNTERS values for every measured iteration.
+    uint64_t *counters;
+    GibInt max_times;
+} GibBench;
+
+void gib_bench_init(GibBench *bench, const char *name);
+bool gib_bench_continue(GibBench *bench);
+bool gib_bench_is_last(GibBench *bench);
+void gib_bench_record(GibBench *bench, double time);
+void gib_bench_report(GibBench *bench);
+
+
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * Linked lists
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -346,8 +481,175 @@ typedef struct gib_pixel {
     GibInt field2;
 } GibPixel;
 
+// Binary (P6) images are written through a buffer which is drained with
+// write(2) whenever it fills up. Pixels can be streamed in row by row as
+// they are produced, so the whole image never needs to be resident.
+
+#define GIB_PPM_BUFFER_SIZE (1 * MB)
+
+typedef struct gib_ppm_writer {
+    int fd;
+    GibInt width;
+    GibInt height;
+    GibInt pixels_written;
+    size_t len;
+    unsigned char *buf;
+} GibPpmWriter;
+
+GibPpmWriter *gib_ppm_open(char *filename, GibInt width, GibInt height);
+void gib_ppm_write_pixels(GibPpmWriter *writer, GibPixel *pixels, GibInt n);
+void gib_ppm_write_vector(GibPpmWriter *writer, GibVector *pixels);
+void gib_ppm_close(GibPpmWriter *writer);
 void gib_write_ppm(char* filename, GibInt width, GibInt height, GibVector *pixels);
-void gib_write_ppm_loop(FILE *fp, GibInt idx, GibInt end, GibVector *pixels);
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Random numbers
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+// Every worker owns a xoshiro256** generator, padded to a cache line so that
+// workers don't contend on it. All of them are derived from --seed.
+
+#define GIB_CACHE_LINE_SIZE 64
+
+typedef struct gib_rng_state {
+    uint64_t s[4];
+    char pad[GIB_CACHE_LINE_SIZE - 4 * sizeof(uint64_t)];
+} GibRngState;
+
+void gib_rng_init(uint64_t seed);
+GibInt gib_rand(void);
+GibFloat gib_frand(void);
+void gib_rand_fill_vector(GibVector *vec);
+void gib_frand_fill_vector(GibVector *vec);
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Layout profiles
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+void gib_write_layout_profile(size_t num_funs, const char **names, const uint64_t *counts);
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Packed files
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+// WritePackedFile streams a value straight from its regions into the file.
+// The compiler generates a serializer for every datatype that follows
+// indirections and redirections and drops absolute random access nodes, so
+// the file holds one compacted value. Relative random access nodes are kept,
+// and their sizes and offsets are patched once the fields have been written.
+// It goes out through a buffer, and large runs of bytes bypass the buffer
+// entirely.
+//
+// Files start with a header that records the datatype and the size of the
+// value. The datatype is a hash of its layout: the tags and field types of
+// its constructors, and of every datatype reachable from it. ReadPackedFile
+// checks both before handing out a cursor. Files without a header are read
+// as-is, like before.
+
+#define GIB_PACKED_FILE_MAGIC 0x00314b4450424947ULL // "GIBPKD1\0"
+#define GIB_PACKED_WRITER_BUFFER_SIZE (4 * MB)
+
+typedef struct gib_packed_file_header {
+    uint64_t magic;
+    uint64_t datatype;
+    uint64_t size;
+} GibPackedFileHeader;
+
+typedef struct gib_packed_writer {
+    int fd;
+    uint64_t datatype;
+    uint64_t written;
+    size_t len;
+    char *buf;
+} GibPackedWriter;
+
+GibPackedWriter *gib_packed_writer_open(char *filename, const char *layout);
+void gib_packed_writer_flush(GibPackedWriter *writer);
+void gib_packed_writer_write_large(GibPackedWriter *writer, GibCursor src, size_t n);
+void gib_packed_writer_patch(GibPackedWriter *writer, uint64_t pos, GibInt val);
+GibInt gib_packed_writer_close(GibPackedWriter *writer);
+GibCursor gib_read_packed_file(char *filename, const char *tycon, const char *layout, GibInt *size);
+
+INLINE_HEADER void gib_packed_writer_write(GibPackedWriter *writer, GibCursor src, size_t n)
+{
+    if (UNLIKELY(writer->len + n > GIB_PACKED_WRITER_BUFFER_SIZE)) {
+        gib_packed_writer_write_large(writer, src, n);
+        return;
+    }
+    memcpy(writer->buf + writer->len, src, n);
+    writer->len += n;
+    writer->written += n;
+}
+
+INLINE_HEADER void gib_packed_writer_write_tag(GibPackedWriter *writer, GibPackedTag tag)
+{
+    if (UNLIKELY(writer->len + sizeof(GibPackedTag) > GIB_PACKED_WRITER_BUFFER_SIZE)) {
+        gib_packed_writer_flush(writer);
+    }
+    *(GibPackedTag *) (writer->buf + writer->len) = tag;
+    writer->len += sizeof(GibPackedTag);
+    writer->written += sizeof(GibPackedTag);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * S-expression ingestion
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+// ReadPackedFile can also read a value written as an S-expression, in the
+// syntax the printers use: (Node (Leaf 1) (Leaf 2)). The text is parsed and
+// packed in a single pass, guided by a description of the datatypes that the
+// compiler generates. Nullary constructors can be written with or without
+// parens, and symbols with the same name get the same GibSym. Fields are
+// always written in source order, even if --layout-profile reordered them.
+//
+// In parallel builds, large files are split up: the constructors along the
+// spine formed by the last field of every constructor are packed by the
+// calling thread, and every other field becomes a task. For the usual list
+// of top-level forms, that's one task per form. The tasks are packed in
+// parallel and the results are copied into place.
+
+#define GIB_SEXP_PARALLEL_THRESHOLD (1 * MB)
+
+typedef enum gib_sexp_field_kind {
+    GIB_SEXP_INT,
+    GIB_SEXP_FLOAT,
+    GIB_SEXP_BOOL,
+    GIB_SEXP_CHAR,
+    GIB_SEXP_SYM,
+    GIB_SEXP_PACKED,
+    GIB_SEXP_UNSUPPORTED
+} GibSexpFieldKind;
+
+typedef struct gib_sexp_field {
+    GibSexpFieldKind kind;
+    // For GIB_SEXP_PACKED, an index into the datatypes.
+    uint32_t datatype;
+} GibSexpField;
+
+typedef struct gib_sexp_datacon {
+    const char *name;
+    GibPackedTag tag;
+    uint32_t num_fields;
+    // In source order.
+    const GibSexpField *fields;
+    // If the fields were reordered, the source position of every field in
+    // the packed value. NULL otherwise.
+    const uint32_t *layout;
+} GibSexpDatacon;
+
+typedef struct gib_sexp_datatype {
+    const char *name;
+    uint32_t num_datacons;
+    const GibSexpDatacon *datacons;
+} GibSexpDatatype;
+
+bool gib_is_sexp_file(char *filename);
+GibCursor gib_read_sexp_file(char *filename, const GibSexpDatatype *datatypes,
+                             uint32_t num_datatypes, const char *tycon, GibInt *size);
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * Threads and parallelism
@@ -693,7 +995,8 @@ void gib_print_gc_config(void);
  */
 
 // Region allocation.
-GibChunk gib_alloc_region(size_t size);
+INLINE_HEADER GibChunk gib_alloc_region(size_t size);
+GibChunk gib_alloc_region_noinline(size_t size);
 GibChunk gib_alloc_region_on_heap(size_t size);
 INLINE_HEADER void gib_grow_region(char **writeloc_addr, char **footer_addr);
 void gib_grow_region_noinline(char **writeloc_addr, char **footer_addr);
@@ -707,6 +1010,47 @@ GibChunk gib_alloc_counted_region(size_t size);
 void gib_print_global_region_count(void);
 void *gib_alloc_counted_struct(size_t size);
 
+/*
+ * ~~~~~~~~~~~~~~~~~~~~
+ * Region allocation
+ * ~~~~~~~~~~~~~~~~~~~~
+ */
+
+INLINE_HEADER GibChunk gib_alloc_region_in_nursery_fast(size_t size, bool collected);
+GibChunk gib_alloc_region_in_nursery_slow(size_t size, bool collected);
+
+// Bumping the nursery is inlined into the generated code, collecting it is not.
+INLINE_HEADER GibChunk gib_alloc_region(size_t size)
+{
+    return gib_alloc_region_in_nursery_fast(size, false);
+}
+
+INLINE_HEADER GibChunk gib_alloc_region_in_nursery_fast(size_t size, bool collected)
+{
+    GibNursery *nursery = DEFAULT_NURSERY;
+    char *old = nursery->alloc;
+    char *bump = old - size - sizeof(GibNurseryChunkFooter);
+    if (LIKELY((bump >= nursery->heap_start))) {
+
+#ifdef _GIBBON_GCSTATS
+        GC_STATS->nursery_regions++;
+        GC_STATS->mem_allocated_in_nursery += size;
+#endif
+        nursery->alloc = bump;
+        char *footer = old - sizeof(GibNurseryChunkFooter);
+        *(GibNurseryChunkFooter *) footer = size;
+
+#if defined _GIBBON_VERBOSITY && _GIBBON_VERBOSITY >= 3
+        fprintf(stderr, "Allocated a nursery chunk of size %ld, (%p, %p).\n",
+                size, bump, footer);
+#endif
+
+        return (GibChunk) {bump, footer};
+    } else {
+        return gib_alloc_region_in_nursery_slow(size, collected);
+    }
+}
+
 /*
  * ~~~~~~~~~~~~~~~~~~~~
  * Region growth
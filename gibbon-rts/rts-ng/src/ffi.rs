@@ -68,6 +68,10 @@ pub mod c {
     pub const COPIED_TAG: GibPackedTag = 251;
     pub const SCALAR_TAG: GibPackedTag = 250;
 
+    // Constructors with a size field and relative random access nodes
+    // (--reloffsets) get tags starting here; see Lower.getTagOfDataCon.
+    pub const REL_RAN_TAG_START: GibPackedTag = 150;
+
     /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
      * Pointer tagging
      * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -98,12 +102,34 @@ pub mod c {
      * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
      */
 
+    #[repr(C)]
+    #[derive(Debug)]
+    pub struct GibArenaChunk {
+        pub prev: *mut GibArenaChunk,
+        pub size: usize,
+    }
+
+    #[repr(C)]
+    #[derive(Debug)]
+    pub struct GibArenaRef {
+        pub next: *mut GibArenaRef,
+        pub ptr: *mut c_void,
+    }
+
     #[repr(C)]
     #[derive(Debug)]
     pub struct GibArena {
-        pub ind: c_int,
-        pub mem: *mut c_char,
-        pub reflist: *mut c_void,
+        pub ind: usize,
+        pub chunk: *mut GibArenaChunk,
+        pub reflist: *mut GibArenaRef,
+    }
+
+    #[repr(C)]
+    #[derive(Debug, Copy, Clone)]
+    pub struct GibArenaMark {
+        pub chunk: *mut GibArenaChunk,
+        pub ind: usize,
+        pub reflist: *mut GibArenaRef,
     }
 
     extern "C" {
@@ -111,6 +137,9 @@ pub mod c {
         pub fn gib_alloc_arena() -> *mut GibArena;
         pub fn gib_free_arena(ar: *mut GibArena);
         pub fn gib_extend_arena(ar: *mut GibArena, size: c_int) -> GibCursor;
+        pub fn gib_arena_add_ref(ar: *mut GibArena, ptr: *mut c_void);
+        pub fn gib_arena_mark(ar: *mut GibArena) -> GibArenaMark;
+        pub fn gib_arena_reset(ar: *mut GibArena, mark: GibArenaMark);
     }
 
     /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -120,14 +149,24 @@ pub mod c {
 
     #[repr(C)]
     #[derive(Debug)]
-    pub struct GibSymDict {
-        pub next: *mut GibSymDict,
+    pub struct GibSymDictSlot {
         pub key: GibSym,
-        pub ptrval: *mut c_void,
+        pub val: *mut c_void,
+    }
+
+    #[repr(C)]
+    #[derive(Debug)]
+    pub struct GibSymDict {
+        pub bitmap: u32,
+        pub leafmap: u32,
+        pub slots: [GibSymDictSlot; 0],
     }
 
     extern "C" {
-        pub fn gib_dict_alloc(ar: *mut GibArena) -> *mut GibSymDict;
+        pub fn gib_dict_alloc(
+            ar: *mut GibArena,
+            num_slots: c_int,
+        ) -> *mut GibSymDict;
         pub fn gib_dict_insert_ptr(
             ar: *mut GibArena,
             ptr: *mut GibSymDict,
@@ -195,15 +234,14 @@ pub mod c {
     /*
     #[repr(C)]
     #[derive(Debug)]
-    pub struct GibSymtable {
-        pub idx: GibSym,
-        pub value: [c_char; 256usize],
-        // TODO: uthash.
-        pub hh: c_void,
+    pub struct GibSymbolName {
+        pub len: u32,
+        pub str: [c_char; 0],
     }
 
     extern "C" {
         pub fn gib_add_symbol(idx: GibSym, value: *mut c_char);
+        pub fn gib_gensym_named(value: *mut c_char) -> GibSym;
         pub fn gib_set_newline(idx: GibSym);
         pub fn gib_set_space(idx: GibSym);
         pub fn gib_set_comma(idx: GibSym);
@@ -300,6 +338,17 @@ pub mod c {
         pub field2: GibInt,
     }
 
+    #[repr(C)]
+    #[derive(Debug)]
+    pub struct GibPpmWriter {
+        pub fd: c_int,
+        pub width: GibInt,
+        pub height: GibInt,
+        pub pixels_written: GibInt,
+        pub len: usize,
+        pub buf: *mut u8,
+    }
+
     extern "C" {
         pub fn gib_write_ppm(
             filename: *mut c_char,
@@ -308,15 +357,21 @@ pub mod c {
             pixels: *mut GibVector,
         );
 
-        /*
-        pub fn gib_write_ppm_loop(
-            // TODO: FILE.
-            fp: *mut c_void,
-            idx: GibInt,
-            end: GibInt,
+        pub fn gib_ppm_open(
+            filename: *mut c_char,
+            width: GibInt,
+            height: GibInt,
+        ) -> *mut GibPpmWriter;
+        pub fn gib_ppm_write_pixels(
+            writer: *mut GibPpmWriter,
+            pixels: *mut GibPixel,
+            n: GibInt,
+        );
+        pub fn gib_ppm_write_vector(
+            writer: *mut GibPpmWriter,
             pixels: *mut GibVector,
         );
-        */
+        pub fn gib_ppm_close(writer: *mut GibPpmWriter);
 
     }
 
@@ -479,7 +534,7 @@ pub mod c {
 
     extern "C" {
         // Region allocation.
-        pub fn gib_alloc_region(size: usize) -> GibChunk;
+        pub fn gib_alloc_region_noinline(size: usize) -> GibChunk;
         pub fn gib_alloc_region_on_heap(size: usize) -> GibChunk;
         pub fn gib_grow_region_noinline(
             writeloc_addr: *mut *mut c_char,
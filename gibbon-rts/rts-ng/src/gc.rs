@@ -593,6 +593,10 @@ enum EvacAction {
     RestoreSrc(*mut i8, *mut i8, *mut i8, GibDatatype),
     // Update the skip-over environment.
     SkipoverEnvWrite(*mut i8),
+    // Recompute the size and offsets of an evacuated K* node once all its
+    // fields are copied. We store its address in the destination buffer,
+    // that buffer's footer, and the number of offsets. See write_rel_offsets.
+    RelOffsets(*mut i8, *mut i8, usize),
 }
 
 /*
@@ -1051,6 +1055,11 @@ unsafe fn evacuate_packed(
                                         debug_assert!(pending_shortcut_ptr.is_none());
                                         dbgprintln!("   did not process {:?}", top);
                                     }
+                                    // A K* node inside the data being inlined;
+                                    // it's copied again below.
+                                    EvacAction::RelOffsets(node, node_dst_end, num_offsets) => {
+                                        write_rel_offsets(node, node_dst_end, num_offsets, None);
+                                    }
                                     EvacAction::RestoreSrc(new_src, old_dst, old_dst_end, ty) => {
                                         saw_indirection = true;
                                         // (0): Copy this redirection here as is so that it
@@ -1222,6 +1231,9 @@ unsafe fn evacuate_packed(
                         dbgprintln!("   regular datacon, field_tys {:?}", field_tys);
                         let scalar_bytes1 = *scalar_bytes;
                         let num_shortcut1 = *num_shortcut;
+                        // A constructor with relative random access nodes.
+                        // Its size field and offsets count as scalars.
+                        let rel_ran = tag >= REL_RAN_TAG_START;
 
                         // Check bound of the destination buffer before copying.
                         // Reserve additional space for a redirection node or a
@@ -1241,7 +1253,7 @@ unsafe fn evacuate_packed(
                         let dst_shortcuts_start = dst2;
                         src2 = src2.add(num_shortcut1 * 8);
                         dst2 = dst2.add(num_shortcut1 * 8);
-                        let shortcut_addrs: Vec<Option<*mut i8>> = if num_shortcut1 > 0 {
+                        let mut shortcut_addrs: Vec<Option<*mut i8>> = if num_shortcut1 > 0 {
                             // If a datatype has shortcut pointers, there
                             // will be a pointer corresponding to every packed
                             // field, except the first one. The pointers
@@ -1291,6 +1303,22 @@ unsafe fn evacuate_packed(
                         src2 = src2.add(scalar_bytes1);
                         dst2 = dst2.add(scalar_bytes1);
 
+                        // Offsets in a K* node are like shortcut pointers
+                        // except that they're relative. Each one gets the
+                        // absolute address of its field in the destination
+                        // and RelOffsets turns them back into offsets.
+                        if rel_ran {
+                            for i in 1..field_tys.len() {
+                                let field = rel_ran_field(src_after_tag, i - 1);
+                                let dst_slot = dst_shortcuts_start.add(8 + (i - 1) * 8);
+                                if st.nursery.contains_addr(field) {
+                                    shortcut_addrs[i] = Some(dst_slot);
+                                } else {
+                                    write(dst_slot, field as GibTaggedPtr);
+                                }
+                            }
+                        }
+
                         #[cfg(feature = "gcstats")]
                         {
                             // write_shortcut_pointer adds 8 bytes for each shortcut it writes.
@@ -1368,6 +1396,13 @@ unsafe fn evacuate_packed(
                             }
                         }
 
+                        if rel_ran {
+                            worklist.push(EvacAction::RelOffsets(
+                                dst_shortcuts_start.sub(1),
+                                dst_end2,
+                                field_tys.len() - 1,
+                            ));
+                        }
                         for (ty, shct) in field_tys.iter().zip(shortcut_addrs.iter()).rev() {
                             worklist.push(EvacAction::ProcessTy(*ty, *shct));
                         }
@@ -1394,9 +1429,16 @@ unsafe fn evacuate_packed(
 
                 worklist_next!(worklist, next_action);
             }
+            EvacAction::RelOffsets(node, node_dst_end, num_offsets) => {
+                write_rel_offsets(node, node_dst_end, num_offsets, Some((dst, dst_end)));
+                worklist_next!(worklist, next_action);
+            }
         }
     } // End the worklist loop
 
+    // Stopping at a redirection can leave K* nodes open.
+    finish_rel_offsets(&worklist);
+
     dbgprintln!("+Finished evacuate_packed: recording in so_env {:?} -> {:?}", orig_src, src);
 
     if burn {
@@ -1420,6 +1462,9 @@ unsafe fn evacuate_packed(
 // (1) Indirections are copied directly,
 // (2) a redirection stops the copy,
 // (3) other tags like copied, copied_to, cauterized cannot occur in the data.
+//
+// The only shortcut pointers written here, other than the one for the whole
+// value, are the offsets of K* nodes that point inside the copied data.
 unsafe fn evacuate_packed_simpl(
     st: &mut EvacState,
     orig_ty: GibDatatype,
@@ -1460,12 +1505,15 @@ unsafe fn evacuate_packed_simpl(
             EvacAction::RestoreSrc(_, _, _, _) | EvacAction::SkipoverEnvWrite(_) => {
                 panic!("   [SIMPL] unexpected action: {:?}", next_action);
             }
+            EvacAction::RelOffsets(node, node_dst_end, num_offsets) => {
+                write_rel_offsets(node, node_dst_end, num_offsets, Some((dst, dst_end)));
+                worklist_next!(worklist, next_action);
+            }
             EvacAction::ProcessTy(next_ty, mb_shortcut_addr) => {
                 dbgprintln!(
                     "   [SIMPL] shortcut pointer at {:?} will be updated",
                     mb_shortcut_addr
                 );
-                debug_assert!(mb_shortcut_addr.is_none());
 
                 let (tag, src_after_tag): (GibPackedTag, *const i8) = read(src);
                 dbgprintln!("+++[SIMPL] Read next tag {} from src {:?}", tag, src);
@@ -1481,6 +1529,7 @@ unsafe fn evacuate_packed_simpl(
                         let space_reqd = 32;
                         let (dst1, dst_end1) =
                             Heap::check_bounds(st.oldgen, space_reqd, dst, dst_end);
+                        write_shortcut_ptr!(mb_shortcut_addr, dst1, dst_end1);
                         let dst_after_tag = write(dst1, INDIRECTION_TAG);
                         let dst_after_indr = write(dst_after_tag, tagged_pointee);
                         let tagged = TaggedPointer::from_usize(tagged_pointee);
@@ -1492,9 +1541,11 @@ unsafe fn evacuate_packed_simpl(
                         src = src_after_indr;
                         dst = dst_after_indr;
                         dst_end = dst_end1;
+                        worklist_next!(worklist, next_action);
                     }
 
                     REDIRECTION_TAG => {
+                        debug_assert!(mb_shortcut_addr.is_none());
                         dbgprintln!("   [SIMPL] copying redirection as is");
                         let (tagged_next_chunk, _src_after_next_chunk): (GibTaggedPtr, _) =
                             read(src_after_tag);
@@ -1515,16 +1566,42 @@ unsafe fn evacuate_packed_simpl(
                         let space_reqd: usize = 32 + scalar_bytes1;
                         let (mut dst2, dst_end2) =
                             Heap::check_bounds(st.oldgen, space_reqd, dst, dst_end);
+                        write_shortcut_ptr!(mb_shortcut_addr, dst2, dst_end2);
+                        let dst_node = dst2;
                         dst2 = write(dst2, tag);
                         let mut src2 = src_after_tag;
                         // ASSUMPTION: all the shortcut pointers have been filled in
                         // and can be copied directly. See the comment in evacuate_packed.
                         let bytes_to_copy = scalar_bytes1 + (num_shortcut1 * 8);
                         dst2.copy_from_nonoverlapping(src2, bytes_to_copy);
+                        // Offsets of a K* node move with the data they point
+                        // to, if it's being copied, see evacuate_packed.
+                        let mut shortcut_addrs: Vec<Option<*mut i8>> = vec![None; field_tys.len()];
+                        if tag >= REL_RAN_TAG_START {
+                            let src_chunk = orig_src..(orig_src_end as *const i8);
+                            let copied = |field: *const i8| {
+                                src_chunk.contains(&field)
+                                    && (field < copy_upto || !src_chunk.contains(&copy_upto))
+                            };
+                            for i in 1..field_tys.len() {
+                                let field = rel_ran_field(src_after_tag, i - 1);
+                                let dst_slot = dst2.add(8 + (i - 1) * 8);
+                                if copied(field) {
+                                    shortcut_addrs[i] = Some(dst_slot);
+                                } else {
+                                    write(dst_slot, field as GibTaggedPtr);
+                                }
+                            }
+                            worklist.push(EvacAction::RelOffsets(
+                                dst_node,
+                                dst_end2,
+                                field_tys.len() - 1,
+                            ));
+                        }
                         src2 = src2.add(bytes_to_copy);
                         dst2 = dst2.add(bytes_to_copy);
-                        for ty in field_tys.iter().rev() {
-                            worklist.push(EvacAction::ProcessTy(*ty, None));
+                        for (ty, shct) in field_tys.iter().zip(shortcut_addrs.iter()).rev() {
+                            worklist.push(EvacAction::ProcessTy(*ty, *shct));
                         }
                         dbgprintln!(
                             "   [SIMPL] added to worklist, length after this {}, prefix(5): {:?}",
@@ -1540,6 +1617,74 @@ unsafe fn evacuate_packed_simpl(
             }
         }
     }
+
+    finish_rel_offsets(&worklist);
+}
+
+/*
+
+Relative offsets
+~~~~~~~~~~~~~~~~
+
+A K* node (tags REL_RAN_TAG_START and above, see Note [Relative offsets] in
+AddRAN.hs) is laid out as:
+
+    tag size offset_1 ... offset_n fields...
+
+The size counts the tag, the offsets and the fields, i.e. everything but the
+size field itself. Offset i is the distance from the end of offset i to the
+start of packed field i+1. The node can span chunks like any other value, so
+its offsets are only meaningful as distances between addresses and the GC
+can't copy it as a block.
+
+Evacuation copies it field by field like a regular constructor. The offsets are
+treated like shortcut pointers: an offset whose field is being copied is filled
+in with the absolute address of the field's copy, other ones with the absolute
+address of the field. A RelOffsets action that runs after the last field
+turns these back into offsets and records the new size. A node that doesn't
+end in the chunk it starts in doesn't have a meaningful size, we record -1.
+Nothing in the runtime reads the size field.
+
+*/
+
+// The address of the field that the ith offset of a K* node points to.
+#[inline(always)]
+unsafe fn rel_ran_field(node_after_tag: *const i8, i: usize) -> *const i8 {
+    let (offset, after_offset): (i64, _) = read(node_after_tag.add(8 + i * 8));
+    after_offset.offset(offset as isize)
+}
+
+// Turn the absolute addresses evacuation wrote into the offsets of a K* node
+// back into offsets, and record its size. 'end' is the destination cursor and
+// its footer after the last field, or None if the copy stopped before that.
+unsafe fn write_rel_offsets(
+    node: *mut i8,
+    node_dst_end: *mut i8,
+    num_offsets: usize,
+    end: Option<(*mut i8, *mut i8)>,
+) {
+    let size_field = node.add(1);
+    for i in 0..num_offsets {
+        let slot = size_field.add(8 + i * 8);
+        let (tagged_field, after_slot): (GibTaggedPtr, _) = read_mut(slot);
+        let field = TaggedPointer::from_usize(tagged_field).untag();
+        write(slot, field.offset_from(after_slot) as i64);
+    }
+    let size: i64 = match end {
+        Some((dst, dst_end)) if dst_end == node_dst_end => (dst.offset_from(node) - 8) as i64,
+        _ => -1,
+    };
+    write(size_field, size);
+    dbgprintln!("   wrote relative offsets of {:?}, size {}", node, size);
+}
+
+// Close the K* nodes left on a worklist when a copy stops early.
+unsafe fn finish_rel_offsets(worklist: &[EvacAction]) {
+    for action in worklist.iter().rev() {
+        if let EvacAction::RelOffsets(node, node_dst_end, num_offsets) = *action {
+            write_rel_offsets(node, node_dst_end, num_offsets, None);
+        }
+    }
 }
 
 fn sort_roots(
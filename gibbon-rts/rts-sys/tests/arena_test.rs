@@ -0,0 +1,102 @@
+use gibbon_rts_sys::*;
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#[test]
+pub fn arena_tests() {
+    println!("");
+    unsafe {
+        // Test 1.
+        test_arena_growth();
+
+        // Test 2.
+        test_arena_big_alloc();
+
+        // Test 3.
+        test_arena_mark_reset();
+    }
+}
+
+/// Number of chunks in an arena.
+unsafe fn num_chunks(ar: *mut GibArena) -> usize {
+    let mut n = 0;
+    let mut chunk = (*ar).chunk;
+    while !chunk.is_null() {
+        n += 1;
+        chunk = (*chunk).prev;
+    }
+    n
+}
+
+/// Allocate well past the first chunk, and check that nothing allocated
+/// earlier is clobbered when the arena grows.
+unsafe fn test_arena_growth() {
+    let ar = gib_alloc_arena();
+    let n: u64 = 100000;
+    let mut ptrs: Vec<*mut u64> = Vec::new();
+    for i in 0..n {
+        // Odd sizes, to check that every allocation is aligned.
+        let ptr = gib_extend_arena(ar, 20) as *mut u64;
+        assert!((ptr as usize) % 8 == 0);
+        *ptr = i;
+        *ptr.add(1) = i * 2;
+        ptrs.push(ptr);
+    }
+    assert!(num_chunks(ar) > 1);
+    for i in 0..n {
+        let ptr = ptrs[i as usize];
+        assert!(*ptr == i);
+        assert!(*ptr.add(1) == i * 2);
+    }
+    // Chunks double in size up to the maximum.
+    let mut chunk = (*ar).chunk;
+    while !(*chunk).prev.is_null() {
+        let prev = (*chunk).prev;
+        assert!((*chunk).size <= 2 * (*prev).size);
+        chunk = prev;
+    }
+    gib_free_arena(ar);
+}
+
+/// A request larger than the maximum chunk size gets a chunk of its own.
+unsafe fn test_arena_big_alloc() {
+    let ar = gib_alloc_arena();
+    let small = gib_extend_arena(ar, 8) as *mut u64;
+    *small = 42;
+    let size: usize = 32 * 1024 * 1024;
+    let big = gib_extend_arena(ar, size as i32) as *mut u8;
+    assert!((*(*ar).chunk).size == size);
+    *big = 1;
+    *big.add(size - 1) = 2;
+    let after = gib_extend_arena(ar, 8) as *mut u64;
+    *after = 43;
+    assert!(num_chunks(ar) == 3);
+    assert!(*small == 42);
+    assert!(*big == 1 && *big.add(size - 1) == 2);
+    assert!(*after == 43);
+    gib_free_arena(ar);
+}
+
+/// Resetting to a mark frees the chunks added since, and the next
+/// allocation reuses the space right after the mark.
+unsafe fn test_arena_mark_reset() {
+    let ar = gib_alloc_arena();
+    let before = gib_extend_arena(ar, 16) as *mut u64;
+    *before = 42;
+    let mark = gib_arena_mark(ar);
+    let first = gib_extend_arena(ar, 16);
+    for _ in 0..100000 {
+        gib_extend_arena(ar, 64);
+    }
+    gib_arena_add_ref(ar, gib_alloc(128));
+    assert!(num_chunks(ar) > 1);
+    assert!(!(*ar).reflist.is_null());
+    gib_arena_reset(ar, mark);
+    assert!(num_chunks(ar) == 1);
+    assert!((*ar).chunk == mark.chunk);
+    assert!((*ar).ind == mark.ind);
+    assert!((*ar).reflist.is_null());
+    assert!(gib_extend_arena(ar, 16) == first);
+    assert!(*before == 42);
+    gib_free_arena(ar);
+}
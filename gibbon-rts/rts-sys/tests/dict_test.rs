@@ -0,0 +1,65 @@
+use std::os::raw::c_void;
+use std::ptr::null_mut;
+
+use gibbon_rts_sys::*;
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#[test]
+pub fn dict_tests() {
+    println!("");
+    unsafe {
+        // Test 1.
+        test_dict_insert_lookup();
+
+        // Test 2.
+        test_dict_persistent();
+    }
+}
+
+fn to_val(i: u64) -> GibPtr {
+    (i as usize + 1) as GibPtr
+}
+
+/// Enough keys to need several levels of the trie.
+unsafe fn test_dict_insert_lookup() {
+    let ar = gib_alloc_arena();
+    let n: u64 = 50000;
+    let mut dict: *mut GibSymDict = null_mut();
+    for k in 0..n {
+        dict = gib_dict_insert_ptr(ar, dict, k, to_val(k));
+    }
+    for k in 0..n {
+        assert!(gib_dict_lookup_ptr(dict, k) == to_val(k));
+    }
+    gib_free_arena(ar);
+}
+
+/// Inserting returns a new dictionary and leaves the old one as it was.
+unsafe fn test_dict_persistent() {
+    let ar = gib_alloc_arena();
+    let mut d1: *mut GibSymDict = null_mut();
+    for k in 0..1000 {
+        d1 = gib_dict_insert_ptr(ar, d1, k, to_val(k));
+    }
+    let mut d2 = d1;
+    for k in 500..1500 {
+        d2 = gib_dict_insert_ptr(ar, d2, k, to_val(k * 10));
+    }
+    for k in 0..1000 {
+        assert!(gib_dict_lookup_ptr(d1, k) == to_val(k));
+    }
+    for k in 0..500 {
+        assert!(gib_dict_lookup_ptr(d2, k) == to_val(k));
+    }
+    for k in 500..1500 {
+        assert!(gib_dict_lookup_ptr(d2, k) == to_val(k * 10));
+    }
+    // The arena keeps a reference to a value allocated outside of it.
+    let boxed = gib_alloc(8) as *mut u64;
+    *boxed = 7;
+    gib_arena_add_ref(ar, boxed as *mut c_void);
+    let d3 = gib_dict_insert_ptr(ar, d2, 2000, boxed as GibPtr);
+    assert!(*(gib_dict_lookup_ptr(d3, 2000) as *const u64) == 7);
+    gib_free_arena(ar);
+}
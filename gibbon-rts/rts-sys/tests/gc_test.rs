@@ -6,6 +6,7 @@ use gibbon_rts_sys::*;
 mod utils;
 use crate::utils::heap::{
     test_no_eager_promote, test_redirections_in_inlined_data, test_redirections_in_inlined_data2,
+    test_rel_offsets_big, test_rel_offsets_in_inlined_data, test_rel_offsets_redirection,
     test_reverse1, test_split_root,
 };
 
@@ -19,9 +20,9 @@ pub fn gc_tests1() {
         gib_init(0, null_mut());
 
         // Test 0; check if clear_all works.
-        let chunk1 = gib_alloc_region(1024);
+        let chunk1 = gib_alloc_region_noinline(1024);
         clear_all();
-        let chunk2 = gib_alloc_region(1024);
+        let chunk2 = gib_alloc_region_noinline(1024);
         assert!(chunk1.start == chunk2.start);
         assert!(chunk1.end == chunk2.end);
 
@@ -67,9 +68,33 @@ pub fn gc_tests2() {
     }
 }
 
+#[test]
+pub fn gc_tests_rel_offsets() {
+    println!("");
+    unsafe {
+        // Initialize storage.
+        gib_init(0, null_mut());
+
+        // Test 1.
+        test_rel_offsets_big();
+        clear_all();
+
+        // Test 2.
+        test_rel_offsets_redirection();
+        clear_all();
+
+        // Test 3.
+        test_rel_offsets_in_inlined_data();
+        clear_all();
+
+        // Free storage.
+        gib_exit();
+    }
+}
+
 /// Test if some simple functions from the FFI work.
 fn test_ffi_works() {
-    let chunk = unsafe { gib_alloc_region(1024) };
+    let chunk = unsafe { gib_alloc_region_noinline(1024) };
     assert!(!chunk.start.is_null());
     assert!(!chunk.end.is_null());
 }
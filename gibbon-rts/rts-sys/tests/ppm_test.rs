@@ -0,0 +1,66 @@
+use std::ffi::CString;
+use std::fs;
+
+use gibbon_rts_sys::*;
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#[test]
+pub fn ppm_tests() {
+    println!("");
+    unsafe {
+        // Test 1.
+        test_ppm_stream_rows();
+    }
+}
+
+/// Color of a pixel. Some of them are out of range, to check the clamping.
+fn color(x: i64, y: i64) -> (i64, i64, i64) {
+    (x - 100, y + 100, (x * y) % 300)
+}
+
+fn clamp(c: i64) -> u8 {
+    if c < 0 {
+        0
+    } else if c > 255 {
+        255
+    } else {
+        c as u8
+    }
+}
+
+/// Stream an image in one row at a time. It's larger than the writer's
+/// buffer, so the rows are drained to the file along the way.
+unsafe fn test_ppm_stream_rows() {
+    let width: i64 = 700;
+    let height: i64 = 600;
+    let path = std::env::temp_dir().join("gibbon_ppm_test.ppm");
+    let filename = CString::new(path.to_str().unwrap()).unwrap();
+    let writer = gib_ppm_open(filename.as_ptr() as *mut _, width, height);
+    for y in 0..height {
+        let mut row: Vec<GibPixel> = (0..width)
+            .map(|x| {
+                let (r, g, b) = color(x, y);
+                GibPixel { field0: r, field1: g, field2: b }
+            })
+            .collect();
+        gib_ppm_write_pixels(writer, row.as_mut_ptr(), width);
+    }
+    gib_ppm_close(writer);
+
+    let bytes = fs::read(&path).unwrap();
+    let header = format!("P6\n{} {}\n255\n", width, height);
+    assert!(bytes.len() == header.len() + (3 * width * height) as usize);
+    assert!(&bytes[..header.len()] == header.as_bytes());
+    let pixels = &bytes[header.len()..];
+    for y in 0..height {
+        for x in 0..width {
+            let (r, g, b) = color(x, y);
+            let i = (3 * (y * width + x)) as usize;
+            assert!(pixels[i] == clamp(r));
+            assert!(pixels[i + 1] == clamp(g));
+            assert!(pixels[i + 2] == clamp(b));
+        }
+    }
+    fs::remove_file(&path).unwrap();
+}
@@ -77,6 +77,9 @@ enum Object {
     KSP4(GibTaggedPtr, GibInt, Box<Object>, Box<Object>),
     KSP5(GibChar, GibBool, GibFloat, Box<Object>, Box<Object>),
     KSP6(GibChar, GibBool, GibFloat, GibInt, Box<Object>, Box<Object>),
+    // Constructor with a size field and a relative offset to its second
+    // packed field (K*).
+    KR(GibInt, Box<Object>, Box<Object>),
 
     // Meta, control constructors
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -104,6 +107,9 @@ impl Object {
                 Box::new((*obj1).sans_metadata()),
                 Box::new((*obj2).sans_metadata()),
             ),
+            Object::KR(i, obj1, obj2) => {
+                Object::KR(*i, Box::new((*obj1).sans_metadata()), Box::new((*obj2).sans_metadata()))
+            }
             Object::FreshNurseryReg(_, obj) => (*obj).sans_metadata(),
             Object::FreshOldgenReg(_, obj) => (*obj).sans_metadata(),
             Object::InitNurseryReg(_, obj) => (*obj).sans_metadata(),
@@ -128,6 +134,7 @@ enum ObjectTag {
     KSP4 = 8,
     KSP5 = 9,
     KSP6 = 10,
+    KR = REL_RAN_TAG_START,
     Indir = INDIRECTION_TAG,
     Redir = REDIRECTION_TAG,
 }
@@ -203,6 +210,13 @@ impl ObjectTag {
                 let len = field_tys.len() as u8;
                 (size, 0, 3, len, field_tys, len)
             }
+            ObjectTag::KR => {
+                // The size field and the offset count as scalars.
+                let size = size_of::<GibInt>() + size_of::<GibInt>() + size_of::<GibInt>();
+                let field_tys = vec![OBJECT_T, OBJECT_T];
+                let len = field_tys.len() as u8;
+                (size, 0, 3, len, field_tys, len)
+            }
             ObjectTag::Indir => {
                 panic!("INDIRECTION_TAG shouldn't be in the info table")
             }
@@ -226,6 +240,7 @@ fn info_table_initialize() {
         ObjectTag::KSP4,
         ObjectTag::KSP5,
         ObjectTag::KSP6,
+        ObjectTag::KR,
     ];
     // 7 built-in types + the OBJECT_T packed type.
     gib_info_table_initialize(8);
@@ -249,13 +264,17 @@ fn info_table_initialize() {
 enum SerAction<'a> {
     ProcessObj(&'a Object),
     RestoreDst(*mut i8, *mut i8),
+    // Fill in the offset at this address to point to the next object.
+    RelOffset(*mut i8),
+    // Fill in the size field of the K* node at this address.
+    RelSize(*mut i8),
 }
 
 fn serialize(obj_0: &Object) -> (*const i8, *const i8) {
     let mut worklist: Vec<SerAction> = Vec::new();
     let (orig_dst, mut dst, mut dst_end) = match obj_0 {
         Object::InitNurseryReg(size, obj) => {
-            let chunk0 = unsafe { gib_alloc_region(*size) };
+            let chunk0 = unsafe { gib_alloc_region_noinline(*size) };
             worklist.push(SerAction::ProcessObj(obj));
             (chunk0.start, chunk0.start, chunk0.end)
         }
@@ -265,7 +284,7 @@ fn serialize(obj_0: &Object) -> (*const i8, *const i8) {
             (chunk0.start, chunk0.start, chunk0.end)
         }
         _ => {
-            let chunk0 = unsafe { gib_alloc_region(1024) };
+            let chunk0 = unsafe { gib_alloc_region_noinline(1024) };
             worklist.push(SerAction::ProcessObj(obj_0));
             (chunk0.start, chunk0.start, chunk0.end)
         }
@@ -278,10 +297,20 @@ fn serialize(obj_0: &Object) -> (*const i8, *const i8) {
                 dst = new_dst;
                 dst_end = new_dst_end;
             }
+            SerAction::RelOffset(slot) => {
+                // Make sure the next object starts here.
+                bounds_check(&mut dst, &mut dst_end, 32);
+                unsafe {
+                    write(slot, dst.offset_from(slot.add(8)) as GibInt);
+                }
+            }
+            SerAction::RelSize(node) => unsafe {
+                write(node.add(1), dst.offset_from(node) as GibInt - 8);
+            },
             SerAction::ProcessObj(obj_1) => match obj_1 {
                 Object::FreshNurseryReg(size, obj) => {
                     bounds_check(&mut dst, &mut dst_end, 32);
-                    let chunk = unsafe { gib_alloc_region(*size) };
+                    let chunk = unsafe { gib_alloc_region_noinline(*size) };
                     unsafe {
                         gib_indirection_barrier_noinline(
                             dst,
@@ -345,6 +374,20 @@ fn serialize(obj_0: &Object) -> (*const i8, *const i8) {
                     worklist.push(SerAction::ProcessObj(obj2));
                     worklist.push(SerAction::ProcessObj(obj1));
                 }
+                Object::KR(i, obj1, obj2) => {
+                    assert!(!dst.is_null() && !dst_end.is_null());
+                    bounds_check(&mut dst, &mut dst_end, 32);
+                    let node = dst;
+                    let dst_after_tag = write(dst, ObjectTag::KR);
+                    let dst_after_size = write(dst_after_tag, 0 as GibInt);
+                    let dst_after_offset = write(dst_after_size, 0 as GibInt);
+                    let dst_after_int = write(dst_after_offset, *i);
+                    dst = dst_after_int;
+                    worklist.push(SerAction::RelSize(node));
+                    worklist.push(SerAction::ProcessObj(obj2));
+                    worklist.push(SerAction::RelOffset(dst_after_size));
+                    worklist.push(SerAction::ProcessObj(obj1));
+                }
                 _ => todo!(),
             },
         }
@@ -373,6 +416,20 @@ fn deserialize_(src: *const i8) -> (Object, *const i8) {
             let (field2, src_after_field2) = deserialize_(src_after_field1);
             (Object::KSP3(b, Box::new(field1), Box::new(field2)), src_after_field2)
         }
+        ObjectTag::KR => {
+            // Read the second field through the offset, like generated code
+            // does, and check the size if the node is in one chunk.
+            let (size, src_after_size): (GibInt, _) = read(src_after_tag);
+            let (offset, src_after_offset): (GibInt, _) = read(src_after_size);
+            let (i, src_after_int): (GibInt, _) = read(src_after_offset);
+            let (field1, _) = deserialize_(src_after_int);
+            let field2_start = unsafe { src_after_offset.offset(offset as isize) };
+            let (field2, src_after_field2) = deserialize_(field2_start);
+            if size >= 0 {
+                assert_eq!(src_after_field2, unsafe { src.add(8 + size as usize) });
+            }
+            (Object::KR(i, Box::new(field1), Box::new(field2)), src_after_field2)
+        }
         ObjectTag::Indir => {
             let (tagged_pointee, src_after_indr): (GibTaggedPtr, _) = read(src_after_tag);
             let tagged = TaggedPointer::from_usize(tagged_pointee);
@@ -757,3 +814,109 @@ fn mklist_with_redir(n: u8) -> Object {
         Object::KSP2(n as i64, Box::new(Object::GrowRegion(Box::new(mklist_with_redir(n - 1)))))
     }
 }
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+// K* nodes are evacuated field by field, their offsets have to point to
+// the new copies of their fields afterwards.
+
+/// A K* node bigger than an oldgen chunk.
+pub fn test_rel_offsets_big() {
+    info_table_initialize();
+    let obj = Object::InitNurseryReg(
+        1024,
+        Box::new(Object::KR(
+            1,
+            Box::new(mktree(15)),
+            Box::new(Object::KR(
+                2,
+                Box::new(Object::KSP2(3, Box::new(Object::K0))),
+                Box::new(Object::K0),
+            )),
+        )),
+    );
+    let (start, end) = serialize(&obj);
+    ss_push(RW::Read, start, end, OBJECT_T);
+    let nursery: &mut GibNursery = unsafe { &mut *gib_global_nurseries };
+    let stats = ValueStats::from_frame(ss_peek(RW::Read), nursery);
+    assert!(stats.size > 65536);
+    unsafe {
+        gib_perform_GC(false);
+    }
+    let frame = ss_peek(RW::Read);
+    let obj2 = unsafe { deserialize((*frame).ptr) };
+    gib_info_table_clear();
+    assert!(obj2 == obj.sans_metadata());
+}
+
+/// A K* node whose first field continues in a new chunk.
+pub fn test_rel_offsets_redirection() {
+    info_table_initialize();
+    let obj = Object::InitNurseryReg(
+        128,
+        Box::new(Object::KR(
+            5,
+            Box::new(Object::KSP2(6, Box::new(Object::GrowRegion(Box::new(Object::K0))))),
+            Box::new(Object::KSP2(7, Box::new(Object::K0))),
+        )),
+    );
+    let (start, end) = serialize(&obj);
+    ss_push(RW::Read, start, end, OBJECT_T);
+    let nursery: &mut GibNursery = unsafe { &mut *gib_global_nurseries };
+    let stats = ValueStats::from_frame(ss_peek(RW::Read), nursery);
+    assert_eq!(stats.num_redirections, 1);
+    unsafe {
+        gib_perform_GC(false);
+    }
+    let frame = ss_peek(RW::Read);
+    let obj2 = unsafe { deserialize((*frame).ptr) };
+    gib_info_table_clear();
+    assert!(obj2 == obj.sans_metadata());
+}
+
+/// Like the above, but the K* node is behind an indirection, so inlining it
+/// is aborted and it's copied again to a new buffer.
+pub fn test_rel_offsets_in_inlined_data() {
+    info_table_initialize();
+    let obj = Object::KSP3(
+        false,
+        Box::new(Object::FreshNurseryReg(
+            128,
+            Box::new(Object::KR(
+                8,
+                Box::new(Object::KSP3(
+                    true,
+                    Box::new(Object::KSP2(9, Box::new(Object::K0))),
+                    Box::new(Object::KSP2(10, Box::new(Object::K0))),
+                )),
+                Box::new(Object::KSP2(
+                    11,
+                    Box::new(Object::GrowRegion(Box::new(Object::KSP2(12, Box::new(Object::K0))))),
+                )),
+            )),
+        )),
+        Box::new(Object::KSP2(13, Box::new(Object::K0))),
+    );
+    let (start, end) = serialize(&obj);
+    ss_push(RW::Read, start, end, OBJECT_T);
+    let nursery: &mut GibNursery = unsafe { &mut *gib_global_nurseries };
+    let stats = ValueStats::from_frame(ss_peek(RW::Read), nursery);
+    assert_eq!(stats.num_indirections, 1);
+    assert_eq!(stats.num_redirections, 1);
+    unsafe {
+        gib_perform_GC(false);
+    }
+    let frame = ss_peek(RW::Read);
+    let obj2 = unsafe { deserialize((*frame).ptr) };
+    gib_info_table_clear();
+    assert!(obj2 == obj.sans_metadata());
+}
+
+/// Returns a complete binary tree of KSP3 nodes.
+fn mktree(depth: u8) -> Object {
+    if depth == 0 {
+        Object::K0
+    } else {
+        Object::KSP3(depth % 2 == 0, Box::new(mktree(depth - 1)), Box::new(mktree(depth - 1)))
+    }
+}